@@ -0,0 +1,120 @@
+// STL includes
+#include <iostream>
+
+// Boost includes
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+// Own header files
+#include "CyclicPoller.hpp"
+
+static const unsigned char pollerSourceId=2; /*!< The source ID of the poll requests. It is the ID the server uses for its own requests. */
+static const std::chrono::steady_clock::duration maxPollReplyWait=std::chrono::milliseconds(100); /*!< If a poll request was not answered within this time (including the resends of the serial interface), it is considered lost and the value is polled again. */
+
+/** \brief The key of a polled value in the cache. Replies are mapped to the key of their request by decrementing the command. */
+static unsigned int polledValueKey(unsigned char clientId, unsigned char protocol, unsigned char command){
+	return (static_cast<unsigned int>(clientId)<<16) | (static_cast<unsigned int>(protocol)<<8) | command;
+}
+
+CyclicPoller::CyclicPoller(boost::function<void (boost::shared_ptr<const BfbMessage>)> sendMessageHandle, std::chrono::microseconds pollPeriod, std::chrono::microseconds maxValueAge):
+	SendMessageHandle(sendMessageHandle),
+	PollPeriod(pollPeriod),
+	MaxValueAge(maxValueAge),
+	Work(IoService),
+	PollTimer(IoService),
+	IoServiceThread(boost::bind(&boost::asio::io_service::run,&IoService)){
+}
+
+CyclicPoller::~CyclicPoller(){
+	Stop();
+}
+
+void CyclicPoller::Stop(){
+	IoService.stop();
+	if(IoServiceThread.joinable()){
+		IoServiceThread.join();
+	};
+}
+
+void CyclicPoller::AddPolledValue(unsigned char clientId, unsigned char protocol, unsigned char command){
+	boost::lock_guard<boost::mutex> lock(PolledValuesMutex);
+	PolledValue& value=PolledValues[polledValueKey(clientId, protocol, command)];
+	value.Request=boost::make_shared<const BfbMessage>(clientId, pollerSourceId, true, false, protocol, command);
+}
+
+void CyclicPoller::Start(){
+	IoService.post([this](){
+		PollTimer.expires_at(std::chrono::steady_clock::now());
+		PollTimer.async_wait(boost::bind(&CyclicPoller::HandleExpiredPollTimer, this, boost::asio::placeholders::error));
+	});
+}
+
+void CyclicPoller::HandleExpiredPollTimer(const boost::system::error_code& error){
+	if(error==boost::asio::error::operation_aborted){
+		return;
+	};
+	std::vector<boost::shared_ptr<const BfbMessage>> requests;
+	{
+		boost::lock_guard<boost::mutex> lock(PolledValuesMutex);
+		std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now();
+		for(auto it=PolledValues.begin(); it!=PolledValues.end(); it++){
+			if(!it->second.IsPollPending || now-it->second.TimeOfLastPoll>maxPollReplyWait){ // Do not pile up requests in the queue of a line that can not keep up with the poll period.
+				it->second.IsPollPending=true;
+				it->second.TimeOfLastPoll=now;
+				requests.push_back(it->second.Request);
+			};
+		};
+	};
+	for(auto it=requests.begin(); it!=requests.end(); it++){
+		SendMessageHandle(*it);
+	};
+	PollTimer.expires_at(PollTimer.expiry()+PollPeriod);
+	PollTimer.async_wait(boost::bind(&CyclicPoller::HandleExpiredPollTimer, this, boost::asio::placeholders::error));
+}
+
+void CyclicPoller::ProcessIncomingMessage(boost::shared_ptr<const BfbMessage> message){
+	if(message->GetBusAllocation() || message->GetCommand()==0){ // Only replies are cached.
+		return;
+	};
+	boost::lock_guard<boost::mutex> lock(PolledValuesMutex);
+	auto value=PolledValues.find(polledValueKey(message->GetSource(), message->GetProtocol(), message->GetCommand()-1));
+	if(value==PolledValues.end()){
+		return;
+	};
+	if(message->GetDestination()==pollerSourceId){
+		value->second.IsPollPending=false;
+	};
+	if(!message->GetError()){
+		value->second.Reply=message;
+		value->second.TimeOfReply=std::chrono::steady_clock::now();
+	};
+}
+
+boost::shared_ptr<const BfbMessage> CyclicPoller::GetCachedReply(boost::shared_ptr<const BfbMessage> request){
+	if(!request->GetBusAllocation()){ // No reply is expected.
+		return boost::shared_ptr<const BfbMessage>();
+	};
+	boost::shared_ptr<BfbMessage> reply;
+	{
+		boost::lock_guard<boost::mutex> lock(PolledValuesMutex);
+		auto value=PolledValues.find(polledValueKey(request->GetDestination(), request->GetProtocol(), request->GetCommand()));
+		if(value==PolledValues.end()){
+			return boost::shared_ptr<const BfbMessage>();
+		};
+		if(!value->second.Reply || std::chrono::steady_clock::now()-value->second.TimeOfReply>MaxValueAge){
+			NumOfForwardedRequests++;
+			return boost::shared_ptr<const BfbMessage>();
+		};
+		NumOfCachedReplies++;
+		reply=boost::make_shared<BfbMessage>(*value->second.Reply);
+	};
+	reply->SetDestination(request->GetSource());
+	return reply;
+}
+
+void CyclicPoller::PrintStatistics(){
+	boost::lock_guard<boost::mutex> lock(PolledValuesMutex);
+	std::cout<<std::dec<<"Polled values: "<<PolledValues.size()<<std::endl;
+	std::cout<<"Read requests answered from the cache: "<<NumOfCachedReplies<<std::endl;
+	std::cout<<"Read requests of polled values forwarded to the bus: "<<NumOfForwardedRequests<<std::endl;
+}
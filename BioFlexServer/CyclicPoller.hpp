@@ -0,0 +1,84 @@
+#ifndef CYCLICPOLLER_HPP
+#define CYCLICPOLLER_HPP
+
+// STL includes
+#include <stdlib.h>
+#include <chrono>
+#include <map>
+
+// Boost includes
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+// Own header files
+#include <BfbMessage.hpp>
+
+/** \brief The class reads a declared set of values cyclically from the serial clients and keeps the latest reply of each value.
+ * 	If several TCP clients (e.g. a controller, a logger and a GUI) read the same values, every request would otherwise be forwarded to the bus.
+ * 	Instead, read requests for a polled value are answered from the cache as long as the cached reply is fresh enough. In this way, the load of the bus
+ * 	only depends on the number of polled values and the poll period, but not on the number of connected TCP clients.
+ * 	The poll requests are sent via the normal send handle of the serial interface, which serves both lines of a bus master separately.
+ */
+class CyclicPoller
+{
+	public:
+		/** \brief The constructor does not start the polling. Add the values first and call "Start" afterwards.
+		 * \param sendMessageHandle The handle the poll requests are sent with (usually the send handle of the serial interface).
+		 * \param pollPeriod The time between two poll requests for the same value.
+		 * \param maxValueAge A read request is answered from the cache if the cached reply is not older than this.
+		 */
+		CyclicPoller(boost::function<void (boost::shared_ptr<const BfbMessage>)> sendMessageHandle, std::chrono::microseconds pollPeriod, std::chrono::microseconds maxValueAge);
+		~CyclicPoller();
+
+		/** \brief Declare a value that is read cyclically.
+		 * \param clientId The bus ID of the client the value is read from.
+		 * \param protocol The protocol the value belongs to.
+		 * \param command The command of the read request. The reply is expected with the command incremented by one.
+		 */
+		void AddPolledValue(unsigned char clientId, unsigned char protocol, unsigned char command);
+		/** \brief Start sending the poll requests. */
+		void Start();
+		/** \brief Stop sending the poll requests. This must be called before the object the send handle refers to is destroyed. */
+		void Stop();
+
+		/** \brief Store the message if it is a reply to a polled value. It does not matter whether the poller or a TCP client requested it. */
+		void ProcessIncomingMessage(boost::shared_ptr<const BfbMessage> message);
+		/** \brief Answer a read request from the cache.
+		 * \return The cached reply addressed to the source of the request or an empty pointer if the requested value is not polled or its cached reply is too old. In the latter case, the request must be forwarded to the bus.
+		 */
+		boost::shared_ptr<const BfbMessage> GetCachedReply(boost::shared_ptr<const BfbMessage> request);
+
+		/** \brief Print the number of requests answered from the cache and forwarded to the bus. */
+		void PrintStatistics();
+	private:
+		CyclicPoller(const CyclicPoller&) = delete;
+		CyclicPoller & operator=(const CyclicPoller&) = delete;
+
+		/** \brief The state of one polled value. */
+		struct PolledValue{
+			boost::shared_ptr<const BfbMessage> Request; /*!< The poll request sent to the client. */
+			boost::shared_ptr<const BfbMessage> Reply; /*!< The latest reply of the client. */
+			std::chrono::steady_clock::time_point TimeOfReply; /*!< The time at which the latest reply was received. */
+			std::chrono::steady_clock::time_point TimeOfLastPoll; /*!< The time at which the last poll request was sent. */
+			bool IsPollPending=false; /*!< True while the last poll request has not been answered. A new request is only sent after the reply or after "maxPollReplyWait". */
+		};
+		std::map<unsigned int, PolledValue> PolledValues; /*!< The polled values accessible by the key of their read request (see "polledValueKey"). */
+		boost::mutex PolledValuesMutex; /*!< The cache is written by the forwarding thread of the serial interface and read by the TCP server. */
+		unsigned long NumOfCachedReplies=0;
+		unsigned long NumOfForwardedRequests=0;
+
+		boost::function<void (boost::shared_ptr<const BfbMessage>)> SendMessageHandle;
+		std::chrono::steady_clock::duration PollPeriod;
+		std::chrono::steady_clock::duration MaxValueAge;
+
+		boost::asio::io_service IoService; /*!< Asynchronous handler that runs the poll timer. */
+		boost::asio::io_service::work Work;
+		boost::asio::steady_timer PollTimer; /*!< Timer that expires once per poll period. The expiry times are computed from the start time, so the polling does not drift. */
+		/** \brief Send the poll requests of all values whose previous request has been answered and restart the timer. */
+		void HandleExpiredPollTimer(const boost::system::error_code& error);
+		boost::thread IoServiceThread; /*!< Thread in which the IoService object runs it's run method. */
+};
+#endif
@@ -0,0 +1,170 @@
+// STL includes
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <limits>
+
+// Own header files
+#include "LatencyStatistics.hpp"
+
+LatencyHistogram::LatencyHistogram(unsigned char protocol, unsigned char command):
+	Protocol(protocol),
+	Command(command),
+	NumOfRetries(0),
+	NumOfTimeouts(0),
+	MaxLatency(0){
+	for(auto it=Counts.begin(); it!=Counts.end(); it++){
+		it->store(0, std::memory_order_relaxed);
+	};
+}
+
+unsigned int LatencyHistogram::BucketOf(unsigned long long latency){
+	if(latency<numOfSubBuckets){ // The first buckets count single microseconds.
+		return latency;
+	};
+	unsigned int exponent=63-__builtin_clzll(latency);
+	unsigned int subBucket=(latency>>(exponent-numOfSubBucketBits)) & (numOfSubBuckets-1);
+	return std::min((exponent-numOfSubBucketBits+1)*numOfSubBuckets+subBucket, numOfBuckets-1);
+}
+
+unsigned long long LatencyHistogram::LatencyOf(unsigned int bucket){
+	if(bucket<numOfSubBuckets){
+		return bucket;
+	};
+	unsigned int exponent=bucket/numOfSubBuckets+numOfSubBucketBits-1;
+	unsigned long long width=1ull<<(exponent-numOfSubBucketBits);
+	return (numOfSubBuckets+bucket%numOfSubBuckets)*width+width/2;
+}
+
+void LatencyHistogram::RecordReply(std::chrono::steady_clock::duration latency){
+	unsigned long long microseconds=std::max<long long>(std::chrono::duration_cast<std::chrono::microseconds>(latency).count(), 0);
+	Counts[BucketOf(microseconds)].fetch_add(1, std::memory_order_relaxed);
+	if(microseconds>MaxLatency.load(std::memory_order_relaxed)){ // There's only one writer, so no compare and swap is needed.
+		MaxLatency.store(microseconds, std::memory_order_relaxed);
+	};
+}
+
+void LatencyHistogram::RecordRetry(){
+	NumOfRetries.fetch_add(1, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::RecordTimeout(){
+	NumOfTimeouts.fetch_add(1, std::memory_order_relaxed);
+}
+
+LatencySummary LatencyHistogram::GetSummary(unsigned char clientId) const{
+	LatencySummary summary;
+	summary.ClientId=clientId;
+	summary.Protocol=Protocol;
+	summary.Command=Command;
+	summary.NumOfRetries=NumOfRetries.load(std::memory_order_relaxed);
+	summary.NumOfTimeouts=NumOfTimeouts.load(std::memory_order_relaxed);
+	summary.MaxLatency=MaxLatency.load(std::memory_order_relaxed);
+	std::array<unsigned long, numOfBuckets> counts;
+	for(unsigned int i=0; i<numOfBuckets; i++){
+		counts[i]=Counts[i].load(std::memory_order_relaxed);
+		summary.NumOfReplies+=counts[i];
+	};
+	unsigned long medianRank=(summary.NumOfReplies+1)/2;
+	unsigned long percentile99Rank=summary.NumOfReplies-summary.NumOfReplies/100;
+	unsigned long numOfCountedReplies=0;
+	bool isMedianFound=false;
+	for(unsigned int i=0; i<numOfBuckets && numOfCountedReplies<percentile99Rank; i++){
+		numOfCountedReplies+=counts[i];
+		if(!isMedianFound && numOfCountedReplies>=medianRank){
+			isMedianFound=true;
+			summary.MedianLatency=std::min<unsigned long long>(LatencyOf(i), summary.MaxLatency);
+		};
+		if(numOfCountedReplies>=percentile99Rank){
+			summary.Percentile99Latency=std::min<unsigned long long>(LatencyOf(i), summary.MaxLatency);
+		};
+	};
+	return summary;
+}
+
+LatencyStatistics::LatencyStatistics(){
+	for(auto it=HistogramsOfClient.begin(); it!=HistogramsOfClient.end(); it++){
+		it->store(nullptr);
+	};
+}
+
+LatencyStatistics::~LatencyStatistics(){
+	for(auto it=HistogramsOfClient.begin(); it!=HistogramsOfClient.end(); it++){
+		LatencyHistogram* histogram=it->load();
+		while(histogram){
+			LatencyHistogram* next=histogram->Next;
+			delete histogram;
+			histogram=next;
+		};
+	};
+}
+
+LatencyHistogram& LatencyStatistics::HistogramOf(unsigned char clientId, unsigned char protocol, unsigned char command){
+	LatencyHistogram* first=HistogramsOfClient[clientId].load(std::memory_order_relaxed); // Only this thread stores to the list.
+	for(LatencyHistogram* histogram=first; histogram; histogram=histogram->Next){
+		if(histogram->Protocol==protocol && histogram->Command==command){
+			return *histogram;
+		};
+	};
+	LatencyHistogram* histogram=new LatencyHistogram(protocol, command);
+	histogram->Next=first;
+	HistogramsOfClient[clientId].store(histogram, std::memory_order_release); // The readers see the histogram only after it has been initialised completely.
+	return *histogram;
+}
+
+void LatencyStatistics::RecordReply(unsigned char clientId, unsigned char protocol, unsigned char command, std::chrono::steady_clock::duration latency){
+	HistogramOf(clientId, protocol, command).RecordReply(latency);
+}
+
+void LatencyStatistics::RecordRetry(unsigned char clientId, unsigned char protocol, unsigned char command){
+	HistogramOf(clientId, protocol, command).RecordRetry();
+}
+
+void LatencyStatistics::RecordTimeout(unsigned char clientId, unsigned char protocol, unsigned char command){
+	HistogramOf(clientId, protocol, command).RecordTimeout();
+}
+
+std::vector<LatencySummary> LatencyStatistics::GetSummaries(unsigned char clientId) const{
+	std::vector<LatencySummary> summaries;
+	for(LatencyHistogram* histogram=HistogramsOfClient[clientId].load(std::memory_order_acquire); histogram; histogram=histogram->Next){
+		summaries.push_back(histogram->GetSummary(clientId));
+	};
+	std::sort(summaries.begin(), summaries.end(), [](const LatencySummary& first, const LatencySummary& second){
+		return first.Protocol<second.Protocol || (first.Protocol==second.Protocol && first.Command<second.Command);
+	});
+	return summaries;
+}
+
+/** \brief Append the value as four bytes in little endian order. Larger values are saturated. */
+static void appendUint32(std::vector<unsigned char>& payload, unsigned long value){
+	value=std::min<unsigned long>(value, std::numeric_limits<uint32_t>::max());
+	for(unsigned int i=0; i<4; i++){
+		payload.push_back((value>>(8*i)) & 0xFF);
+	};
+}
+
+std::vector<unsigned char> encodeLatencySummaries(unsigned char clientId, const std::vector<LatencySummary>& summaries){
+	size_t numOfSummaries=std::min<size_t>(summaries.size(), 255);
+	std::vector<unsigned char> payload;
+	payload.push_back(clientId);
+	payload.push_back(numOfSummaries);
+	for(size_t i=0; i<numOfSummaries; i++){
+		payload.push_back(summaries[i].Protocol);
+		payload.push_back(summaries[i].Command);
+		appendUint32(payload, summaries[i].NumOfReplies);
+		appendUint32(payload, summaries[i].NumOfRetries);
+		appendUint32(payload, summaries[i].NumOfTimeouts);
+		appendUint32(payload, summaries[i].MedianLatency);
+		appendUint32(payload, summaries[i].Percentile99Latency);
+		appendUint32(payload, summaries[i].MaxLatency);
+	};
+	return payload;
+}
+
+void printLatencySummaries(std::ostream& stream, const std::vector<LatencySummary>& summaries){
+	for(auto it=summaries.begin(); it!=summaries.end(); it++){
+		stream<<std::dec<<"  client "<<std::setw(3)<<int(it->ClientId)<<" protocol "<<std::setw(3)<<int(it->Protocol)<<" command "<<std::setw(3)<<int(it->Command)
+			<<": "<<it->NumOfReplies<<" replies, "<<it->NumOfRetries<<" retries, "<<it->NumOfTimeouts<<" timeouts, latency median "<<it->MedianLatency
+			<<" us, 99% "<<it->Percentile99Latency<<" us, max "<<it->MaxLatency<<" us"<<std::endl;
+	};
+}
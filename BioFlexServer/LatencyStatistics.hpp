@@ -0,0 +1,89 @@
+#ifndef LATENCYSTATISTICS_HPP
+#define LATENCYSTATISTICS_HPP
+
+// STL includes
+#include <stdlib.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+/** \brief The summary of the round trips of one request type (client, protocol and command). The latencies are given in microseconds. */
+struct LatencySummary{
+	unsigned char ClientId;
+	unsigned char Protocol;
+	unsigned char Command; /*!< The command of the request. */
+	unsigned long NumOfReplies=0;
+	unsigned long NumOfRetries=0; /*!< The number of times a request was resent since its reply did not arrive in time. */
+	unsigned long NumOfTimeouts=0; /*!< The number of requests that were not answered after the last transmission attempt. */
+	unsigned long MedianLatency=0;
+	unsigned long Percentile99Latency=0;
+	unsigned long MaxLatency=0;
+};
+
+/** \brief A histogram of round-trip latencies with logarithmic buckets that are subdivided linearly (as in HDR histograms).
+ * 	Every power of two is split into 16 buckets, so the relative error of a recorded latency is below 6.25% between 1 µs and more than 1000 s.
+ * 	The histogram is written by the I/O thread of a serial port and may be read at the same time by other threads. All counters are atomic, so neither side takes a lock.
+ */
+class LatencyHistogram{
+	public:
+		LatencyHistogram(unsigned char protocol, unsigned char command);
+
+		void RecordReply(std::chrono::steady_clock::duration latency);
+		void RecordRetry();
+		void RecordTimeout();
+		/** \brief Compute the summary from the current counts. Since the writer is not stopped, the counts may be slightly inconsistent. */
+		LatencySummary GetSummary(unsigned char clientId) const;
+
+		const unsigned char Protocol;
+		const unsigned char Command;
+		LatencyHistogram* Next=nullptr; /*!< The next histogram of the same client. It is set before the histogram is published and never changed afterwards. */
+	private:
+		static const unsigned int numOfSubBucketBits=4;
+		static const unsigned int numOfSubBuckets=1<<numOfSubBucketBits;
+		static const unsigned int numOfBuckets=28*numOfSubBuckets;
+		/** \brief The index of the bucket the passed latency in microseconds is counted in. */
+		static unsigned int BucketOf(unsigned long long latency);
+		/** \brief The latency in microseconds represented by the bucket (the middle of its range). */
+		static unsigned long long LatencyOf(unsigned int bucket);
+
+		std::array<std::atomic<unsigned long>, numOfBuckets> Counts;
+		std::atomic<unsigned long> NumOfRetries;
+		std::atomic<unsigned long> NumOfTimeouts;
+		std::atomic<unsigned long long> MaxLatency;
+};
+
+/** \brief The round-trip statistics of all clients served by one serial port.
+ * 	The histograms of a client are kept in a singly linked list that is only ever prepended. The I/O thread of the port is the only writer. It publishes a new histogram with a single atomic store, so readers may traverse the lists at any time without locking.
+ */
+class LatencyStatistics{
+	public:
+		LatencyStatistics();
+		~LatencyStatistics();
+
+		/** \brief Record the time between the last transmission of a request and its reply. This must only be called from the I/O thread of the port. */
+		void RecordReply(unsigned char clientId, unsigned char protocol, unsigned char command, std::chrono::steady_clock::duration latency);
+		/** \brief Record that a request was resent. This must only be called from the I/O thread of the port. */
+		void RecordRetry(unsigned char clientId, unsigned char protocol, unsigned char command);
+		/** \brief Record that a request was not answered after the last transmission attempt. This must only be called from the I/O thread of the port. */
+		void RecordTimeout(unsigned char clientId, unsigned char protocol, unsigned char command);
+
+		/** \brief The summaries of all request types sent to the passed client. This may be called from any thread. */
+		std::vector<LatencySummary> GetSummaries(unsigned char clientId) const;
+	private:
+		LatencyStatistics(const LatencyStatistics&) = delete;
+		LatencyStatistics & operator=(const LatencyStatistics&) = delete;
+
+		/** \brief Find the histogram of the request type or create it. */
+		LatencyHistogram& HistogramOf(unsigned char clientId, unsigned char protocol, unsigned char command);
+		std::array<std::atomic<LatencyHistogram*>, 256> HistogramsOfClient; /*!< The first histogram of each client ID. */
+};
+
+/** \brief Encode the summaries as payload of a reply. The payload starts with the client ID and the number of summaries. Every summary consists of the protocol and the command (one byte each) followed by the numbers of replies, retries and timeouts and the median, 99th percentile and maximum latency in microseconds (four bytes each, little endian). */
+std::vector<unsigned char> encodeLatencySummaries(unsigned char clientId, const std::vector<LatencySummary>& summaries);
+
+/** \brief Print the summaries as a table. */
+void printLatencySummaries(std::ostream& stream, const std::vector<LatencySummary>& summaries);
+
+#endif
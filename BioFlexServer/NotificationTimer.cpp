@@ -1,11 +1,11 @@
 // STL includes
 #include <algorithm>
-#include <iterator>
-#include <list>
+#include <chrono>
+#include <limits>
+#include <vector>
 
 // Boost includes
 #include <boost/asio.hpp>
-#include <boost/date_time.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/mutex.hpp>
@@ -15,6 +15,17 @@
 #include <BfbMessage.hpp>
 #include "BfbProtocolIds.hpp"
 
+static const size_t notScheduled=std::numeric_limits<size_t>::max(); /*!< Heap position of a process that is not waiting for a notification. */
+
+/** \brief The commands of the SIMSERV_1_PROT protocol handled by the timer. A notification is answered with the command incremented by one. */
+enum TimerCommand : unsigned char{
+	resetTimerStateCommand=0,
+	setResetTimerStateCommand=2,
+	setRelTimerMsCommand=12,
+	setRelTimerUsCommand=16,
+	setAbsTimerMsCommand=20,
+	setAbsTimerUsCommand=24
+};
 
 /** \brief The class represents one programm that is connected via TCP with the server. It is responsible for storing the time at which the process wants to be  woken up.
  * 	In order to have the same interface between the server and the simulation, a control program is supposed to send a message that tells the server/simulation that 
@@ -26,55 +37,74 @@
 class Process
 {
 	public:
-		Process(unsigned int tcpId);
+		Process(unsigned int tcpId, unsigned short connectionId);
 		void ResetTimer();
-		void AddTime(double seconds);
-		void AddTime(boost::posix_time::time_duration deltaT);
-		boost::posix_time::ptime GetNextUpdateTime();
-		unsigned int GetTcpId();
+		/** \brief Move the next update time by the passed duration. Relative timer commands refer to the last timer state, not to the current time, so a periodically running client does not drift. */
+		void AddTime(std::chrono::microseconds deltaT);
+		/** \brief Set the next update time to the passed duration after the last reset of the timer. */
+		void SetTime(std::chrono::microseconds timeSinceReset);
+		std::chrono::steady_clock::time_point GetNextUpdateTime() const;
+		unsigned int GetTcpId() const;
+		unsigned short GetConnectionId() const;
+		unsigned char ReplyCommand=setRelTimerMsCommand+1; /*!< The command of the notification that is sent when the next update time has been reached. */
+		size_t HeapPosition=notScheduled; /*!< The position of the process in the heap of outstanding notifications. */
 	private:
-		boost::posix_time::ptime NextUpdateTime;
+		std::chrono::steady_clock::time_point TimeOfReset;
+		std::chrono::steady_clock::time_point NextUpdateTime;
 		unsigned int TcpId;
+		unsigned short ConnectionId; /*!< The connection of the program at the TCP server. Programs that share the multiplexed TCP-ID are told apart by it. */
 };
 
 
-Process::Process(unsigned int tcpId):
-		NextUpdateTime(boost::posix_time::microsec_clock::local_time()),
-		TcpId(tcpId){
+Process::Process(unsigned int tcpId, unsigned short connectionId):
+		TimeOfReset(std::chrono::steady_clock::now()),
+		NextUpdateTime(TimeOfReset),
+		TcpId(tcpId),
+		ConnectionId(connectionId){
 }
 
 void Process::ResetTimer(){
-	NextUpdateTime=boost::posix_time::microsec_clock::local_time();
+	TimeOfReset=std::chrono::steady_clock::now();
+	NextUpdateTime=TimeOfReset;
 };
 
-void Process::AddTime(double seconds){
-	if(seconds<0){
-		seconds=0;
-	};
-	NextUpdateTime+=boost::posix_time::milliseconds(static_cast<unsigned int>(seconds*1000));
-}
-void Process::AddTime(boost::posix_time::time_duration deltaT){
-	if(deltaT.is_negative()){
+void Process::AddTime(std::chrono::microseconds deltaT){
+	if(deltaT.count()<0){
 		return;
 	};
 	NextUpdateTime+=deltaT;
 }
 
-boost::posix_time::ptime Process::GetNextUpdateTime(){
+void Process::SetTime(std::chrono::microseconds timeSinceReset){
+	NextUpdateTime=TimeOfReset+timeSinceReset;
+}
+
+std::chrono::steady_clock::time_point Process::GetNextUpdateTime() const{
 	return NextUpdateTime;
 };
 
-unsigned int Process::GetTcpId(){return TcpId;};
+unsigned int Process::GetTcpId() const{return TcpId;};
 
+unsigned short Process::GetConnectionId() const{return ConnectionId;};
 
-NotificationTimer::NotificationTimer(boost::function<void (boost::shared_ptr<const BfbMessage>)> sendMessageHandle):
+
+/** \brief Convert the little-endian payload of a timer command into an unsigned number. Up to eight bytes are used. */
+static unsigned long long payloadToNumber(const std::vector<unsigned char>& payload){
+	unsigned long long number=0;
+	for(unsigned int i=0;i<payload.size() && i<sizeof(number);i++){
+		number|=static_cast<unsigned long long>(payload[i])<<(8*i);
+	};
+	return number;
+}
+
+
+NotificationTimer::NotificationTimer(boost::function<void (unsigned short, boost::shared_ptr<const BfbMessage>)> sendMessageHandle):
 	SendMessageHandle(sendMessageHandle),
-	IoServiceThread(boost::bind(&boost::asio::io_service::run,&IoService)), // Start the IO-handler needed for communication.
 	Work(IoService),
 	AsyncTimer(IoService),
-	Processes(std::map<unsigned int, boost::shared_ptr<Process>>()),
-	OutstandingNotifications(std::list<boost::shared_ptr<Process>>()),
-	SingleAccessMutex(new boost::mutex){
+	Processes(std::map<unsigned short, boost::shared_ptr<Process>>()),
+	SingleAccessMutex(new boost::mutex),
+	IoServiceThread(boost::bind(&boost::asio::io_service::run,&IoService)){ // Start the IO-handler needed for communication.
 }
 
 
@@ -84,110 +114,167 @@ NotificationTimer::~NotificationTimer(){
 }
 
 
-void NotificationTimer::ResetTimer(unsigned char TcpId){
-	try{
-		auto tempProcess=Processes.at(TcpId);
-		tempProcess->ResetTimer();
-	}catch(const std::out_of_range& oor){
-	
-		
+void NotificationTimer::ResetTimer(unsigned short connectionId){
+	boost::lock_guard<boost::mutex> lock(*SingleAccessMutex);
+	auto process=Processes.find(connectionId);
+	if(process!=Processes.end()){
+		process->second->ResetTimer();
+		CancelNotification(process->second);
+		RestartTimer();
 	};
 }
 
 
-void NotificationTimer::ProcessMessage(boost::shared_ptr<const BfbMessage > message){
-	bool resetTimer=false;
-	if(message->GetDestination()==TimerId && message->GetProtocol()==BfbProtocolIds::SIMSERV_1_PROT){
-		boost::lock_guard<boost::mutex> lock(*SingleAccessMutex); 
-		boost::shared_ptr<Process> tempProcess;
-		try{
-			tempProcess=Processes.at(message->GetSource());
-		}catch(const std::out_of_range& oor){
-			Processes.insert(std::pair<unsigned int, boost::shared_ptr<Process>>(message->GetSource(), boost::make_shared<Process>(Process(message->GetSource()))));
-			tempProcess=Processes.at(message->GetSource());
-		};
-		switch(message->GetCommand()){
-			case 0:{
-				tempProcess->ResetTimer();
-			};
-			case 12:{
-				// Set Timer
-				auto payload=message->GetPayload();
-				double seconds=0;
-				for(unsigned int i=0;i<payload.size();i++){
-					seconds+=double(payload[i])/1000*pow(256,i);
-				};
-				boost::posix_time::time_duration deltaT=boost::posix_time::millisec((seconds*1000));
-				tempProcess->AddTime(deltaT);
-				
-				// If there's currently an outstanding notification in the list for this process, it will be deleted in favor of the new notification request.
-				OutstandingNotifications.remove(tempProcess);
-				
-				/*!< Next, the notification must be inserted into the list at the appropriate position. If the notification time of this process
-				 * is later than the last element, it should be 'push_back'ed. If the notification time is less than the first element, it should be
-				 * 'push_front'ed. In order to reduce the number of conditional clauses, a reverse iterator to the last element is created.
-				 * This iterator is then incremented (since it's a reverse iterator, every increment moves it further to the front) until either the 
-				 * first element has been exceeded or the next update time of an element is bigger than
-				 * that of the current process.  
-				 * This whole process could have been easier if a normal iterator (front->back) was used. But the chances are high that the new notification
-				 * should be executed at last (later than the already planned notifications).
-				 */
-				std::list<boost::shared_ptr<Process>>::reverse_iterator iter;
-				for(iter=OutstandingNotifications.rbegin(); iter!=OutstandingNotifications.rend() && (*(iter))->GetNextUpdateTime()<tempProcess->GetNextUpdateTime();iter++){};
-				/*!< The iterator points to an element that is one position further to the front than the position the new notification should be placed.
-				 * Therefore, the iterator must be decremented before use. BUT since the iterator is of the reverse type, it can not be used directly in the insert-method
-				 * of the list. This method accepts only normal iterators. Therefore, it must be converted using its base-method first. This, however, changes the position
-				 * the now normal iterator points to (see http://www.drdobbs.com/cpp/three-guidelines-for-effective-iterator/184401406?pgno=3 ).
-				 */
-				if(iter==OutstandingNotifications.rend()){
-					/*!< If the iterator points now to the very first element, obviously, the newly inserted notification is the one that should be processed earliest.
-					* Therefore, the asynchronous timer should be cancelled and newly set.
-					*/
-					OutstandingNotifications.push_front(tempProcess);
-					resetTimer=true;
-				}else{
-					OutstandingNotifications.insert(iter.base(),tempProcess);
-				};
+void NotificationTimer::ProcessMessage(boost::shared_ptr<const BfbMessage > message, unsigned short connectionId){
+	if(message->GetDestination()!=TimerId || message->GetProtocol()!=BfbProtocolIds::SIMSERV_1_PROT){
+		return;
+	};
+	boost::lock_guard<boost::mutex> lock(*SingleAccessMutex); 
+	boost::shared_ptr<Process> tempProcess;
+	auto process=Processes.find(connectionId);
+	if(process==Processes.end()){
+		tempProcess=boost::make_shared<Process>(message->GetSource(), connectionId);
+		Processes.insert(std::pair<unsigned short, boost::shared_ptr<Process>>(connectionId, tempProcess));
+	}else{
+		tempProcess=process->second;
+	};
+	std::chrono::microseconds value(payloadToNumber(message->GetPayload()));
+	switch(message->GetCommand()){
+		case resetTimerStateCommand:
+		case setResetTimerStateCommand:{
+			tempProcess->ResetTimer();
+			CancelNotification(tempProcess);
+			if(message->GetBusAllocation()){
+				SendNotification(tempProcess, message->GetCommand()+1);
 			};
-		}
-	}
-	if(resetTimer){
-		//AsyncTimer.expires_at(OutstandingNotifications.front()->GetNextUpdateTime());
-		boost::posix_time::time_duration deltaT= (OutstandingNotifications.front()->GetNextUpdateTime()-boost::posix_time::microsec_clock::local_time());
-		AsyncTimer.expires_from_now( deltaT );
-		AsyncTimer.async_wait(boost::bind(&NotificationTimer::HandleExpiredTimer, this, boost::asio::placeholders::error));
+			break;
+		};
+		case setRelTimerMsCommand:
+			tempProcess->AddTime(value*1000);
+			break;
+		case setRelTimerUsCommand:
+			tempProcess->AddTime(value);
+			break;
+		case setAbsTimerMsCommand:
+			tempProcess->SetTime(value*1000);
+			break;
+		case setAbsTimerUsCommand:
+			tempProcess->SetTime(value);
+			break;
+		default:
+			return;
 	};
-	return;
+	if(message->GetCommand()!=resetTimerStateCommand && message->GetCommand()!=setResetTimerStateCommand){
+		// If there's currently an outstanding notification for this process, it is replaced by the new notification request.
+		tempProcess->ReplyCommand=message->GetCommand()+1;
+		ScheduleNotification(tempProcess);
+	};
+	RestartTimer();
 }
 
-boost::function<void (boost::shared_ptr<const BfbMessage>)>  NotificationTimer::GetProcessMessageHandle()
+boost::function<void (boost::shared_ptr<const BfbMessage>, unsigned short)>  NotificationTimer::GetProcessMessageHandle()
 {
-	return [&, this](boost::shared_ptr<const BfbMessage> message)->void{
+	return [&, this](boost::shared_ptr<const BfbMessage> message, unsigned short connectionId)->void{
 		if(this){
-			this->ProcessMessage(message);
+			this->ProcessMessage(message, connectionId);
+		};
+	};
+}
+
+void NotificationTimer::ScheduleNotification(boost::shared_ptr<Process> process){
+	if(process->HeapPosition==notScheduled){
+		process->HeapPosition=OutstandingNotifications.size();
+		OutstandingNotifications.push_back(process);
+	};
+	// The update time may have moved in either direction. If the entry does not move up, it may have to move down.
+	size_t position=process->HeapPosition;
+	if(SiftUp(position)==position){
+		SiftDown(position);
+	};
+}
+
+void NotificationTimer::CancelNotification(boost::shared_ptr<Process> process){
+	size_t position=process->HeapPosition;
+	if(position==notScheduled){
+		return;
+	};
+	SwapNotifications(position, OutstandingNotifications.size()-1);
+	OutstandingNotifications.pop_back();
+	process->HeapPosition=notScheduled;
+	if(position<OutstandingNotifications.size() && SiftUp(position)==position){
+		SiftDown(position);
+	};
+}
+
+size_t NotificationTimer::SiftUp(size_t position){
+	while(position>0){
+		size_t parent=(position-1)/2;
+		if(OutstandingNotifications[parent]->GetNextUpdateTime()<=OutstandingNotifications[position]->GetNextUpdateTime()){
+			break;
+		};
+		SwapNotifications(position, parent);
+		position=parent;
+	};
+	return position;
+}
+
+void NotificationTimer::SiftDown(size_t position){
+	while(true){
+		size_t earliest=position;
+		for(size_t child=2*position+1; child<=2*position+2 && child<OutstandingNotifications.size(); child++){
+			if(OutstandingNotifications[child]->GetNextUpdateTime()<OutstandingNotifications[earliest]->GetNextUpdateTime()){
+				earliest=child;
+			};
+		};
+		if(earliest==position){
+			return;
 		};
+		SwapNotifications(position, earliest);
+		position=earliest;
+	};
+}
+
+void NotificationTimer::SwapNotifications(size_t first, size_t second){
+	std::swap(OutstandingNotifications[first], OutstandingNotifications[second]);
+	OutstandingNotifications[first]->HeapPosition=first;
+	OutstandingNotifications[second]->HeapPosition=second;
+}
+
+void NotificationTimer::RestartTimer(){
+	if(OutstandingNotifications.empty()){
+		AsyncTimer.expires_at(std::chrono::steady_clock::time_point::min()); // Cancels the waiting operation.
+		return;
+	};
+	std::chrono::steady_clock::time_point nextUpdateTime=OutstandingNotifications.front()->GetNextUpdateTime();
+	if(AsyncTimer.expiry()==nextUpdateTime){ // The timer is already waiting for the earliest notification.
+		return;
 	};
+	AsyncTimer.expires_at(nextUpdateTime);
+	AsyncTimer.async_wait(boost::bind(&NotificationTimer::HandleExpiredTimer, this, boost::asio::placeholders::error));
+}
+
+void NotificationTimer::SendNotification(boost::shared_ptr<Process> process, unsigned char command){
+	// Create a reply message
+	boost::shared_ptr<BfbMessage> reply=boost::make_shared<BfbMessage>();
+	reply->SetDestination(process->GetTcpId());
+	reply->SetSource(TimerId);
+	reply->SetBusAllocationFlag(false);
+	reply->SetProtocol(BfbProtocolIds::SIMSERV_1_PROT);
+	reply->SetCommand(command);
+	SendMessageHandle(process->GetConnectionId(), reply);
 }
 
 void NotificationTimer::HandleExpiredTimer(const boost::system::error_code& error){
 	if( error != boost::asio::error::operation_aborted){
 		boost::lock_guard<boost::mutex> lock(*SingleAccessMutex); 
-		while(!(OutstandingNotifications.empty()) && (OutstandingNotifications.front()->GetNextUpdateTime())<=boost::posix_time::microsec_clock::local_time()){
-			// Create a reply message
-			boost::shared_ptr<BfbMessage> reply=boost::make_shared<BfbMessage>();
-			reply->SetDestination(OutstandingNotifications.front()->GetTcpId() );
-			reply->SetSource(TimerId);
-			reply->SetBusAllocationFlag(false);
-			reply->SetProtocol(BfbProtocolIds::SIMSERV_1_PROT);
-			reply->SetCommand(13);
-			SendMessageHandle(reply);
-			OutstandingNotifications.pop_front();
+		std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now();
+		while(!(OutstandingNotifications.empty()) && (OutstandingNotifications.front()->GetNextUpdateTime())<=now){
+			boost::shared_ptr<Process> process=OutstandingNotifications.front();
+			CancelNotification(process);
+			SendNotification(process, process->ReplyCommand);
 		};
-		if(!(OutstandingNotifications.empty())){
-			boost::posix_time::time_duration deltaT= (OutstandingNotifications.front()->GetNextUpdateTime()-boost::posix_time::microsec_clock::local_time());
-			AsyncTimer.expires_from_now( deltaT );
-			//AsyncTimer.expires_at(OutstandingNotifications.front()->GetNextUpdateTime());
-			AsyncTimer.async_wait(boost::bind(&NotificationTimer::HandleExpiredTimer, this, boost::asio::placeholders::error));
-		}
+		// The expiry is moved so that a timer which has just expired is always restarted.
+		AsyncTimer.expires_at(std::chrono::steady_clock::time_point::min());
+		RestartTimer();
 	};
 };
@@ -3,10 +3,13 @@
 
 // STL includes
 #include <stdlib.h>
+#include <chrono>
 #include <map>
+#include <vector>
 
 // Boost includes
 #include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/bind.hpp>
 #include <boost/thread.hpp>
 
@@ -21,34 +24,50 @@ const unsigned int TimerProtocolId=12;
 class NotificationTimer
 {
 	public:
-		NotificationTimer(boost::function<void (boost::shared_ptr<const BfbMessage>)> sendMessageHandle);
+		/** \brief The constructor.
+		 * \param sendMessageHandle The function that sends a notification to the TCP connection with the passed connection ID (see TcpServer::SendMessageToConnection).
+		 */
+		NotificationTimer(boost::function<void (unsigned short, boost::shared_ptr<const BfbMessage>)> sendMessageHandle);
 		~NotificationTimer();
-		void ProcessMessage(boost::shared_ptr<const BfbMessage> message);
+		/** \brief Process a timer command. The timers are kept per connection, so programs that share the multiplexed TCP-ID have their own timers. */
+		void ProcessMessage(boost::shared_ptr<const BfbMessage> message, unsigned short connectionId);
 		/** \brief This method returns a handle to the SendMessage-method of the instance. This makes it redundant to work with boost::bind in order to create a handle manually. */
-		boost::function<void (boost::shared_ptr<const BfbMessage>)> GetProcessMessageHandle();
-		void ResetTimer(unsigned char TcpId);
+		boost::function<void (boost::shared_ptr<const BfbMessage>, unsigned short)> GetProcessMessageHandle();
+		void ResetTimer(unsigned short connectionId);
 	private:
 		NotificationTimer(const NotificationTimer&) = delete;
 		NotificationTimer & operator=(const NotificationTimer&) = delete;
-		
+
 		const unsigned int TimerId=14;
-		boost::function<void (boost::shared_ptr<BfbMessage>)> SendMessageHandle;
+		boost::function<void (unsigned short, boost::shared_ptr<const BfbMessage>)> SendMessageHandle;
 
 		boost::asio::io_service IoService; /*!< Asynchronous communication handler used by the instance to connect to the socket and to call the handler methods. */
-
-		boost::thread IoServiceThread; /*!< Thread in which the IoService object runs it's run method. */
 		boost::asio::io_service::work Work;
-		boost::asio::deadline_timer AsyncTimer; /*!< Timer that is used for client timing purposes. If a client must run with a certain frequency, a defined message can be used to configure the timer such that it will expire after the desired time interval. Then, the "HandleTimer" method will be called. This is helpful if a client should run both with a non-realtime simulation and with this interface that is connected to a real (and therefore realtime) system. */
+		boost::asio::steady_timer AsyncTimer; /*!< Timer that is used for client timing purposes. If a client must run with a certain frequency, a defined message can be used to configure the timer such that it will expire after the desired time interval. Then, the "HandleTimer" method will be called. This is helpful if a client should run both with a non-realtime simulation and with this interface that is connected to a real (and therefore realtime) system. The timer uses the steady clock, so adjustments of the system time do not shift the notifications. */
 
-		std::map<unsigned int, boost::shared_ptr<Process>> Processes;
-		std::list<boost::shared_ptr<Process>> OutstandingNotifications;
-		/** \brief This method will be called if the timer expires. It will then send a message to notify the connected client. */  
+		std::map<unsigned short, boost::shared_ptr<Process>> Processes; /*!< The processes by the connection ID of their TCP connection. */
+		/** \brief Binary min-heap of the processes waiting for a notification, ordered by their next update time. Every process stores its position in the heap, so a new request of a process that is already waiting moves it in O(log n) instead of searching and removing it. */
+		std::vector<boost::shared_ptr<Process>> OutstandingNotifications;
+		/** \brief Insert the process into the heap or move it to the position matching its changed update time. */
+		void ScheduleNotification(boost::shared_ptr<Process> process);
+		/** \brief Remove the process from the heap if it is waiting for a notification. */
+		void CancelNotification(boost::shared_ptr<Process> process);
+		/** \brief Move the heap entry at the passed position towards the root until its parent is not later. Returns the new position. */
+		size_t SiftUp(size_t position);
+		/** \brief Move the heap entry at the passed position towards the leaves until none of its children is earlier. */
+		void SiftDown(size_t position);
+		/** \brief Swap two heap entries and update their stored positions. */
+		void SwapNotifications(size_t first, size_t second);
+		/** \brief Let the asynchronous timer expire at the earliest outstanding notification. */
+		void RestartTimer();
+		/** \brief This method will be called if the timer expires. It will then send a message to notify the connected client. */
 		void HandleExpiredTimer(const boost::system::error_code& error);
-		
-		/** \brief This method should be called if a message was received that contains timer-specific commands.*/
-		//void HandleTimingRequest(boost::shared_ptr<BfbMessage> message);
-		//boost::shared_ptr<boost::asio::io_service::work> Work; /*!< The worker keeps the IoService object busy. Without it, the IOService is sometimes runs out of work before the asynchronous receive operations are started and stops itself.*/
+		/** \brief Send a message with the passed command to the process. */
+		void SendNotification(boost::shared_ptr<Process> process, unsigned char command);
+
 		/** \brief Mutex that is used to prevent multiple simultaneous access to the queue. */
 		boost::shared_ptr<boost::mutex> SingleAccessMutex;
+
+		boost::thread IoServiceThread; /*!< Thread in which the IoService object runs it's run method. It is started after all other members have been initialised. */
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,91 @@
+// STL includes
+#include <alloca.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#if defined __linux__
+#include <malloc.h>
+#endif
+
+// Boost includes
+#include <boost/thread.hpp>
+
+// Own header files
+#include "RealTime.hpp"
+
+bool setThreadScheduling(pthread_t thread, int realTimePriority, int cpu){
+	bool success=true;
+	if(realTimePriority>0){
+		struct sched_param parameters;
+		parameters.sched_priority=realTimePriority;
+		success&=(pthread_setschedparam(thread, SCHED_FIFO, &parameters)==0);
+	};
+	#if defined __linux__
+	if(cpu>=0){
+		cpu_set_t cpuSet;
+		CPU_ZERO(&cpuSet);
+		CPU_SET(cpu, &cpuSet);
+		success&=(pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuSet)==0);
+	};
+	#endif
+	return success;
+}
+
+bool lockMemory(){
+	#if defined __linux__
+	mallopt(M_TRIM_THRESHOLD, -1); // Never return freed memory to the system.
+	mallopt(M_MMAP_MAX, 0); // Serve large allocations from the heap instead of mapping new pages.
+	#endif
+	return mlockall(MCL_CURRENT | MCL_FUTURE)==0;
+}
+
+void prefaultHeap(size_t numOfBytes){
+	long pageSize=sysconf(_SC_PAGESIZE);
+	char* block=static_cast<char*>(malloc(numOfBytes));
+	if(!block){
+		return;
+	};
+	for(size_t i=0; i<numOfBytes; i+=pageSize){
+		static_cast<volatile char*>(block)[i]=0;
+	};
+	free(block);
+}
+
+void prefaultStack(size_t numOfBytes){
+	long pageSize=sysconf(_SC_PAGESIZE);
+	volatile char* stack=static_cast<volatile char*>(alloca(numOfBytes));
+	for(size_t i=0; i<numOfBytes; i+=pageSize){
+		stack[i]=0;
+	};
+}
+
+WakeupJitter measureWakeupJitter(int realTimePriority, int cpu, std::chrono::microseconds period, unsigned int numOfWakeups){
+	std::vector<double> lateness;
+	lateness.reserve(numOfWakeups);
+	boost::thread measuringThread([&](){
+		setThreadScheduling(pthread_self(), realTimePriority, cpu); // Applied before the first wakeup, so every measured wakeup uses the scheduling.
+		std::chrono::steady_clock::time_point wakeupTime=std::chrono::steady_clock::now();
+		for(unsigned int i=0; i<numOfWakeups; i++){
+			wakeupTime+=period;
+			std::this_thread::sleep_until(wakeupTime);
+			lateness.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now()-wakeupTime).count());
+		};
+	});
+	measuringThread.join();
+
+	WakeupJitter jitter;
+	jitter.NumOfWakeups=lateness.size();
+	if(lateness.empty()){
+		return jitter;
+	};
+	for(auto it=lateness.begin(); it!=lateness.end(); it++){
+		jitter.MeanLateness+=*it/lateness.size();
+	};
+	std::sort(lateness.begin(), lateness.end());
+	jitter.Percentile99Lateness=lateness[std::min<size_t>(lateness.size()*99/100, lateness.size()-1)];
+	jitter.MaxLateness=lateness.back();
+	return jitter;
+}
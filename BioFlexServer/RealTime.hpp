@@ -0,0 +1,44 @@
+#ifndef REALTIME_HPP
+#define REALTIME_HPP
+
+// STL includes
+#include <stdlib.h>
+#include <pthread.h>
+#include <chrono>
+
+/** \brief Set the scheduling policy and the CPU affinity of a thread.
+ * \param thread The native handle of the thread.
+ * \param realTimePriority If it is larger than 0, the thread is scheduled with SCHED_FIFO and this priority. Otherwise, the policy is not changed.
+ * \param cpu If it is not negative, the thread is pinned to this CPU.
+ * \return True if all settings could be applied. Real-time priorities usually require root privileges or CAP_SYS_NICE.
+ */
+bool setThreadScheduling(pthread_t thread, int realTimePriority, int cpu);
+
+/** \brief Lock all current and future pages of the process into memory and keep freed heap memory in the process.
+ * 	Without this, a page fault (e.g. after a page was swapped out or when the heap grows again after it has been trimmed) may stall a thread for several milliseconds.
+ * \return True if the memory could be locked. This usually requires root privileges or CAP_IPC_LOCK.
+ */
+bool lockMemory();
+
+/** \brief Touch every page of a heap block of the passed size and free it again. After lockMemory, the block stays mapped, so later allocations do not cause page faults. */
+void prefaultHeap(size_t numOfBytes);
+
+/** \brief Touch the passed number of bytes of the stack of the calling thread, so its growth does not cause page faults later. */
+void prefaultStack(size_t numOfBytes);
+
+/** \brief The lateness of the wakeups of a periodic thread. All values are given in microseconds. */
+struct WakeupJitter{
+	unsigned int NumOfWakeups=0;
+	double MeanLateness=0;
+	double Percentile99Lateness=0;
+	double MaxLateness=0;
+};
+
+/** \brief Measure how late a periodic thread with the passed scheduling wakes up.
+ * 	The thread sleeps until absolute wakeup times, so the lateness of one wakeup does not shift the following ones. The measurement blocks for numOfWakeups periods.
+ * \param realTimePriority The priority of the measuring thread (see setThreadScheduling).
+ * \param cpu The CPU the measuring thread is pinned to (see setThreadScheduling).
+ */
+WakeupJitter measureWakeupJitter(int realTimePriority, int cpu, std::chrono::microseconds period, unsigned int numOfWakeups);
+
+#endif
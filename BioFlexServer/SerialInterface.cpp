@@ -1,9 +1,27 @@
 // STL includes
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#if defined __linux__
+#include <linux/serial.h>
+#endif
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <deque>
 #include <iostream>
 #include <iterator>
+#include <map>
+#include <set>
+#include <sstream>
 #include <queue>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 // Boost includes
@@ -11,11 +29,14 @@
 #include <boost/asio/basic_serial_port.hpp>
 #include <boost/asio/deadline_timer.hpp>
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/assign.hpp>
 #include <boost/bind.hpp>
 #include <boost/date_time.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
 #include <boost/function.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/pointer_cast.hpp>
 #include <boost/regex.hpp>
@@ -25,10 +46,28 @@
 
 // Own header files
 #include <BfbMessage.hpp>
+#include "RealTime.hpp"
 #include "SerialInterface.hpp"
 
 static unsigned char line0DeactivationStartId=0x90;
 static unsigned char line1DeactivationStartId=line0DeactivationStartId+0x10;
+static const unsigned char firstClientId=0x10; /*!< The lowest ID a bus client may use. */
+static const unsigned char numOfClientIdRanges=(line0DeactivationStartId-firstClientId)/0x10; /*!< The client IDs are split into ranges of 16 IDs. The bus master forwards exactly one of these ranges per line. */
+static const unsigned int discoveryRepetitions=10; /*!< Each identification request is sent multiple times in order to increase the chance one of them will come through. */
+static const boost::posix_time::time_duration discoveryQuietPeriod=boost::posix_time::milliseconds(20); /*!< A discovery step is completed if no identification reply was received during this period. */
+static const boost::posix_time::time_duration maxDiscoveryStepDuration=boost::posix_time::milliseconds(500); /*!< A discovery step is completed after this period even if identification replies are still coming in. */
+static const std::chrono::steady_clock::duration resendTimingWheelResolution=std::chrono::microseconds(100); /*!< The resolution of the resend deadlines of unanswered requests. */
+static const size_t capacityOfThreadQueues=1024; /*!< The number of messages the lock-free queues between the threads can hold. If a queue is full, its producer waits until the consumer has caught up. */
+static const unsigned int otherMessagesQueue=2; /*!< Index of the send queue for messages that are not addressed to a client on one of the two lines (e.g. messages for the bus master). */
+static const unsigned int maxOutstandingRequestsPerLine=2; /*!< The number of requests per line that may wait for their reply. One request is transmitted on the line while the next one is already buffered in the bus master. If the request window of the clients is larger, a single client may fill its window. */
+static const unsigned int defaultClientWindow=2; /*!< The default number of requests per client that may wait for their reply. */
+static const boost::posix_time::time_duration topologyVerificationPeriod=boost::posix_time::milliseconds(500); /*!< The clients of a cached topology must reply to the verification request within this period. */
+static const std::chrono::steady_clock::duration hotPlugProbePeriod=std::chrono::milliseconds(20); /*!< The period of the hot plug detection. In every period, a few IDs of each line are probed. */
+static const unsigned int numOfProbesPerPeriod=4; /*!< The number of IDs probed per line and period. It must divide 16, so the probes of one period never span two ID ranges. */
+static const std::chrono::steady_clock::duration probeReplyTimeout=std::chrono::milliseconds(5); /*!< A probe that has not been answered within this time is considered missed. */
+static const unsigned int missedProbesForRemoval=3; /*!< A known client is removed from the routing after this number of consecutive missed probes. */
+static const std::chrono::steady_clock::duration maxClientSilence=std::chrono::milliseconds(500); /*!< A known client is only probed if nothing has been received from it for this period or if its last request timed out. */
+static const std::chrono::steady_clock::duration maxCoalescedReadAge=std::chrono::milliseconds(100); /*!< An identical read request is only coalesced with a pending one if the pending one was sent within this period. Older ones are considered lost (including all resends). */
 
 /** \brief This function searches for all serial ports that match the signature of a BioFlex bus master. The names of the available ports are returned as strings. 
  * 	It was written by Thierry Hoinville.
@@ -76,10 +115,85 @@ std::vector<std::string> parseSerialPorts(){
 	}
 	return serialPortNames;
 }
+/** \brief This function reads the bus topologies from a topology cache file. The topologies are returned in a map using the name of the serial port as key.
+ * 	The file contains a "port" line for each serial port followed by a "clients" line for each line of the bus master:
+ * 	port <serialPortName> <configStartIdOnLine0> <configStartIdOnLine1>
+ * 	clients <lineNumber> <clientId> <clientId> ...
+ * 	All numbers are decimal. Lines starting with '#' are ignored. If the file does not exist or is malformed, an empty map is returned.
+ * 	The file is malformed as well if a start ID is neither the start of a client ID range nor the deactivation ID of its line, if a line number is not 0 or 1 
+ * 	or if a client ID is not within the range forwarded to its line. Thus, the routing never contains IDs the bus master does not forward (e.g. those of the bus master itself).
+ */
+std::map<std::string, BusTopology> loadBusTopologyCache(std::string fileName){
+	std::map<std::string, BusTopology> topologies;
+	boost::filesystem::ifstream file(fileName);
+	std::string line;
+	BusTopology* currentTopology=nullptr;
+	auto isValidStartId=[](unsigned int startId, unsigned char deactivationStartId){
+		return startId==deactivationStartId || (startId>=firstClientId && startId<line0DeactivationStartId && startId%0x10==0);
+	};
+	while(std::getline(file, line)){
+		std::istringstream lineStream(line);
+		std::string keyword;
+		if(!(lineStream>>keyword) || keyword[0]=='#'){
+			continue;
+		};
+		bool isMalformed=false;
+		if(keyword=="port"){
+			BusTopology topology;
+			unsigned int startIdOnLine0, startIdOnLine1;
+			isMalformed=!(lineStream>>topology.SerialPortName>>startIdOnLine0>>startIdOnLine1) || !isValidStartId(startIdOnLine0, line0DeactivationStartId) || !isValidStartId(startIdOnLine1, line1DeactivationStartId) || startIdOnLine0==startIdOnLine1;
+			if(!isMalformed){
+				topology.ConfigStartIdOnLine0=startIdOnLine0;
+				topology.ConfigStartIdOnLine1=startIdOnLine1;
+				currentTopology=&(topologies[topology.SerialPortName]=topology);
+			};
+		}else if(keyword=="clients" && currentTopology){
+			unsigned int lineNumber, clientId;
+			isMalformed=!(lineStream>>lineNumber) || lineNumber>1;
+			if(!isMalformed){
+				std::list<unsigned char>& clients=(lineNumber==0 ? currentTopology->ClientsOnLine0 : currentTopology->ClientsOnLine1);
+				unsigned char startId=(lineNumber==0 ? currentTopology->ConfigStartIdOnLine0 : currentTopology->ConfigStartIdOnLine1);
+				while(!isMalformed && lineStream>>clientId){
+					isMalformed=(clientId<firstClientId || clientId>=line0DeactivationStartId || (clientId & 0xF0)!=startId);
+					clients.push_back(clientId);
+				};
+				isMalformed=isMalformed || !lineStream.eof(); // The IDs must not be followed by anything else.
+			};
+		}else{
+			isMalformed=true;
+		};
+		if(isMalformed){
+			std::cout<<"The topology cache file "<<fileName<<" is malformed (\""<<line<<"\"). It will be ignored."<<std::endl;
+			return std::map<std::string, BusTopology>();
+		};
+	};
+	return topologies;
+}
+
+/** \brief This function writes the passed bus topologies to a topology cache file (see loadBusTopologyCache for the format). */
+void saveBusTopologyCache(std::string fileName, const std::list<BusTopology>& topologies){
+	boost::filesystem::ofstream file(fileName);
+	file<<"# Bus topology cache of the BioFlexServer. Delete this file if the bus has changed."<<std::endl;
+	for(auto it=topologies.begin(); it!=topologies.end(); it++){
+		file<<"port "<<it->SerialPortName<<" "<<int(it->ConfigStartIdOnLine0)<<" "<<int(it->ConfigStartIdOnLine1)<<std::endl;
+		file<<"clients 0";
+		for(auto client=it->ClientsOnLine0.begin(); client!=it->ClientsOnLine0.end(); client++){
+			file<<" "<<int(*client);
+		};
+		file<<std::endl<<"clients 1";
+		for(auto client=it->ClientsOnLine1.begin(); client!=it->ClientsOnLine1.end(); client++){
+			file<<" "<<int(*client);
+		};
+		file<<std::endl;
+	};
+	if(!file){
+		std::cout<<"The topology cache file "<<fileName<<" could not be written."<<std::endl;
+	};
+}
+
 /** These are the different states a serial connection may assume. */
 enum serialConnectionInitialisationState_t {	WaitingForBusMasterIdentificationReply, 
-						WaitingForBusClientIdentificationReplyOnLine0, 
-						WaitingForBusClientIdentificationReplyOnLine1, 
+						WaitingForBusClientIdentificationReply, 
 						InitialisationComplete};
 
 
@@ -89,8 +203,194 @@ class ExtendedBfbMessage: public BfbMessage{
 			BfbMessage(message){
 		};
 		mutable unsigned char 		NumOfTransmissions=0;
-		mutable boost::system_time 	TimeOfLastTransmission=boost::posix_time::microsec_clock::local_time();
+		mutable bool			IsAwaitingReply=false; /*!< Set while the message is registered as unanswered request. */
 		mutable std::function<void (boost::shared_ptr<const BfbMessage>)> CallBackFunction=nullptr;
+		std::vector<boost::shared_ptr<const BfbMessage>> PrecedingFragments; /*!< If the message is the last fragment of a large message, these are the fragments sent before it. They are resent together with it. */
+		mutable std::chrono::steady_clock::time_point ExtendedDeadline; /*!< Set while the fragments of a large reply arrive. The request is not resent before this time, even if its deadline in the timing wheel expired. */
+		mutable std::chrono::steady_clock::time_point TimeOfLastTransmission; /*!< The round-trip latency is measured from this time to the receipt of the reply. */
+};
+
+/** \brief Create the key under which an unanswered request is stored. The key is built from the values a reply must have: the client ID as source, the protocol and the command of the request plus one. */
+static inline unsigned long unansweredRequestKey(unsigned char clientId, unsigned char protocol, unsigned char replyCommand){
+	return (static_cast<unsigned long>(clientId)<<16) | (static_cast<unsigned long>(protocol)<<8) | replyCommand;
+}
+
+/** \brief Create the key of the reply the passed request is waiting for. The last fragment of a large message waits for the reply to the reassembled message. */
+static inline unsigned long expectedReplyKey(const BfbMessage& request){
+	if(BfbFunctions::isFragment(request)){
+		std::vector<unsigned char> payload=request.GetPayload();
+		return unansweredRequestKey(request.GetDestination(), payload[BfbConstants::fragmentOriginalProtocolPos], payload[BfbConstants::fragmentOriginalCommandPos]+1);
+	};
+	return unansweredRequestKey(request.GetDestination(), request.GetProtocol(), request.GetCommand()+1);
+}
+
+/** \brief Find the request the passed reply answers among the unanswered requests with the same reply key.
+ * Several requests with the same key may be outstanding if different senders (e.g. TCP clients) use the same command or if a client has several requests in its window.
+ * The reply is addressed to the sender of its request, so the oldest request of this sender is chosen. A client answers the requests of a sender in the order it received them.
+ * If no request of this sender is found (e.g. if the reply is addressed to a broadcast ID), the oldest request is chosen.
+ */
+static inline std::deque<boost::shared_ptr<const ExtendedBfbMessage>>::iterator findAnsweredRequest(std::deque<boost::shared_ptr<const ExtendedBfbMessage>>& requests, const BfbMessage& reply){
+	for(auto it=requests.begin(); it!=requests.end(); it++){
+		if((*it)->GetSource()==reply.GetDestination()){
+			return it;
+		};
+	};
+	return requests.begin();
+}
+
+/** \brief Get the client ID, the protocol and the command of the request from the key of its expected reply. */
+static inline void decodeReplyKey(unsigned long replyKey, unsigned char& clientId, unsigned char& protocol, unsigned char& command){
+	clientId=(replyKey>>16) & 0xFF;
+	protocol=(replyKey>>8) & 0xFF;
+	command=(replyKey & 0xFF)-1;
+}
+
+
+/** \brief A hierarchical timing wheel storing the resend deadlines of the unanswered requests. 
+ * The wheel has two levels with 64 slots each. A slot of the first level covers one tick, a slot of the second level covers 64 ticks. 
+ * Inserting a deadline and removing an expired one are O(1). Deadlines further away than the second level can cover are parked in its last slot and are reinserted when this slot is cascaded.
+ * Entries are never removed before their deadline. Instead, an entry stores the transmission it belongs to, and expired entries of answered or resent requests are ignored by the caller.
+ */
+class ResendTimingWheel{
+	public:
+		typedef std::chrono::steady_clock Clock;
+		
+		/** \brief An entry of the wheel. */
+		struct Entry{
+			boost::shared_ptr<const ExtendedBfbMessage> Request; /*!< The request whose reply is awaited. */
+			unsigned char Transmission; /*!< The value of NumOfTransmissions of the request when the deadline was set. */
+			unsigned long long DeadlineTick; /*!< The tick at which the deadline expires. */
+		};
+		
+		/** \param tickDuration The resolution of the wheel. */
+		ResendTimingWheel(Clock::duration tickDuration):
+				TickDuration(tickDuration),
+				StartTime(Clock::now()){
+		};
+		
+		/** \brief Add a deadline to the wheel. */
+		void Insert(boost::shared_ptr<const ExtendedBfbMessage> request, Clock::time_point deadline){
+			if(NumOfEntries==0){ // Nothing is waiting. Therefore, the wheel can skip all ticks in the past.
+				CurrentTick=std::max(CurrentTick, TickOf(Clock::now()));
+			};
+			Entry entry={request, request->NumOfTransmissions, TickOf(deadline+TickDuration-Clock::duration(1))}; // Round up to the next tick in order not to resend too early.
+			Place(entry);
+			NumOfEntries++;
+		};
+		
+		/** \brief Move all entries whose deadlines are not later than the passed time to the passed vector. */
+		void Advance(Clock::time_point now, std::vector<Entry>& expiredEntries){
+			unsigned long long nowTick=TickOf(now);
+			while(CurrentTick<=nowTick && NumOfEntries>0){
+				if((CurrentTick & slotMask)==0){
+					Cascade();
+				};
+				std::vector<Entry>& slot=Level0[CurrentTick & slotMask];
+				for(auto it=slot.begin(); it!=slot.end(); it++){
+					expiredEntries.push_back(*it);
+				};
+				NumOfEntries-=slot.size();
+				slot.clear();
+				CurrentTick++;
+			};
+			if(NumOfEntries==0){
+				CurrentTick=std::max(CurrentTick, nowTick+1);
+			};
+		};
+		
+		bool IsEmpty() const{
+			return NumOfEntries==0;
+		};
+		
+		/** \brief The time at which Advance has to be called next. This is either the tick of the next occupied slot of the first level or the next cascade of the second level, whichever comes first. */
+		Clock::time_point NextDueTime() const{
+			if((CurrentTick & slotMask)==0 && !Level1[(CurrentTick>>numOfSlotBits) & slotMask].empty()){ // The current tick still has to cascade the second level.
+				return TimeOf(CurrentTick);
+			};
+			unsigned long long nextCascadeTick=(CurrentTick | slotMask)+1;
+			for(unsigned long long tick=CurrentTick; tick<nextCascadeTick; tick++){
+				if(!Level0[tick & slotMask].empty()){
+					return TimeOf(tick);
+				};
+			};
+			return TimeOf(nextCascadeTick);
+		};
+	private:
+		static const unsigned int numOfSlotBits=6;
+		static const unsigned long long numOfSlots=1<<numOfSlotBits;
+		static const unsigned long long slotMask=numOfSlots-1;
+		
+		Clock::duration TickDuration; /*!< The resolution of the wheel. */
+		Clock::time_point StartTime; /*!< The time of tick 0. */
+		unsigned long long CurrentTick=0; /*!< All ticks before this one have been processed. */
+		size_t NumOfEntries=0; /*!< Total number of entries in both levels. */
+		std::array<std::vector<Entry>, numOfSlots> Level0; /*!< Slots covering one tick each. */
+		std::array<std::vector<Entry>, numOfSlots> Level1; /*!< Slots covering numOfSlots ticks each. */
+		
+		unsigned long long TickOf(Clock::time_point time) const{
+			return time<StartTime ? 0 : (time-StartTime)/TickDuration;
+		};
+		Clock::time_point TimeOf(unsigned long long tick) const{
+			return StartTime+tick*TickDuration;
+		};
+		void Place(const Entry& entry){
+			unsigned long long deadlineTick=std::max(entry.DeadlineTick, CurrentTick);
+			if(deadlineTick-CurrentTick<numOfSlots){
+				Level0[deadlineTick & slotMask].push_back(entry);
+			}else if(deadlineTick-CurrentTick<numOfSlots*numOfSlots){
+				Level1[(deadlineTick>>numOfSlotBits) & slotMask].push_back(entry);
+			}else{ // Too far away; park it in the last slot that will be cascaded.
+				Level1[((CurrentTick>>numOfSlotBits)+numOfSlots-1) & slotMask].push_back(entry);
+			};
+		};
+		/** \brief Distribute the entries of the second level slot that starts at the current tick to the first level. */
+		void Cascade(){
+			std::vector<Entry> slot;
+			slot.swap(Level1[(CurrentTick>>numOfSlotBits) & slotMask]);
+			for(auto it=slot.begin(); it!=slot.end(); it++){
+				Place(*it);
+			};
+		};
+};
+
+/** \brief A ring buffer for the bytes received from a serial port.
+ * The serial port reads as many bytes as are available directly into the free space of the ring, so a single wakeup may deliver several messages.
+ * The messages are extracted from the front. Since a message is never longer than MaxLength bytes and the complete messages are always extracted, the ring can not overflow.
+ */
+class ReceiveRingBuffer{
+	public:
+		static const size_t Capacity=4096; /*!< The size of the ring. It must be a power of two. */
+		
+		/** \brief The free space of the ring. If it wraps around the end of the storage, it consists of two regions. */
+		std::array<boost::asio::mutable_buffer, 2> FreeRegions(){
+			size_t tail=Tail & indexMask;
+			size_t free=Capacity-Size();
+			size_t firstRegion=std::min(free, Capacity-tail);
+			return {{boost::asio::buffer(Storage.data()+tail, firstRegion), boost::asio::buffer(Storage.data(), free-firstRegion)}};
+		};
+		/** \brief Append the passed number of bytes that have been written into the free regions. */
+		void Commit(size_t numOfBytes){
+			Tail+=numOfBytes;
+		};
+		size_t Size() const{
+			return Tail-Head;
+		};
+		/** \brief Copy bytes starting at the passed offset from the front of the ring into the passed vector without removing them. */
+		void Peek(size_t offset, size_t numOfBytes, std::vector<unsigned char>& data) const{
+			data.resize(numOfBytes);
+			for(size_t i=0; i<numOfBytes; i++){
+				data[i]=Storage[(Head+offset+i) & indexMask];
+			};
+		};
+		/** \brief Remove the first bytes of the ring. */
+		void Drop(size_t numOfBytes){
+			Head+=numOfBytes;
+		};
+	private:
+		static const size_t indexMask=Capacity-1;
+		std::array<unsigned char, Capacity> Storage;
+		size_t Head=0; /*!< The total number of bytes removed so far. The index of the first byte is Head & indexMask. */
+		size_t Tail=0; /*!< The total number of bytes received so far. */
 };
 
 
@@ -103,13 +403,28 @@ class SerialConnection
 		 * \param incomingMessageSignal This is used for the signaling of received messages. Modules that should be informed about a received message must be connected to this signal.
 		 * \param registerClientFunction A function that will be called if a client devise was found (an actuator, a sensor, in general a devise that understands the BioFlex protocol).
 		 */ 
-		SerialConnection(boost::shared_ptr<boost::asio::io_service> ioService, std::string serialPortName, boost::function<void (boost::shared_ptr<const BfbMessage>)> incomingMessageSignal);
+		SerialConnection(std::string serialPortName, boost::function<void (boost::shared_ptr<const BfbMessage>)> incomingMessageSignal);
+		
+		/** \brief This constructor skips the discovery of the bus master and its clients. Instead, the passed topology is used to configure the bus master right away. 
+		 * Afterwards, the topology is verified in the background. If a client of the topology does not reply or an unknown client replies, the topology is corrected and the corrected topology is reported via the passed function.
+		 * \param cachedTopology The topology of the bus connected to this serial port, usually read from the topology cache file.
+		 * \param topologyMismatchFunction Function that is called with the corrected topology if the cached topology does not match the connected clients.
+		 */
+		SerialConnection(std::string serialPortName, boost::function<void (boost::shared_ptr<const BfbMessage>)> incomingMessageSignal, const BusTopology& cachedTopology, std::function<void (const BusTopology&)> topologyMismatchFunction);
 		~SerialConnection();
 		/** \brief Method responsible for sending messages via the serial port that was assigned to the respective instance of this class.
+		 * It may be called from any thread. The message is handed over to the I/O thread of the serial port via a lock-free queue.
 		 * \param message The message that should be send.
 		 */
 		void SendMessage(boost::shared_ptr<const BfbMessage> Message);
 		
+		/** \brief Let the driver of the serial port pass received bytes on immediately instead of collecting them (ASYNC_LOW_LATENCY).
+		 * \return False if the driver does not support this setting.
+		 */
+		bool SetLowLatency();
+		/** \brief Set the scheduling of the I/O thread of the serial port (see setThreadScheduling). */
+		bool SetIoThreadScheduling(int realTimePriority, int cpu);
+		
 		/** \brief This method blocks until the initialisation of the serial port and the identification of the connected clients is completed. */
 		void WaitUntilInitialised();
 		
@@ -118,38 +433,85 @@ class SerialConnection
 		 */
 		std::list<unsigned char> GetConnectedClients();
 		
+		/** \brief The method returns the topology of the bus connected to the serial port. It should be called after the initialisation is completed. */
+		BusTopology GetTopology();
+		
+		/** \brief Start to detect clients that are plugged in or out during operation (see HandleExpiredProbeTimer). It may be called from any thread after the initialisation.
+		 * \param topologyChangeFunction Function that is called with the new topology whenever a client has been added or removed. It is called from the I/O thread of the serial port.
+		 */
+		void StartHotPlugDetection(std::function<void (const BusTopology&)> topologyChangeFunction);
+		
+		/** \brief Play the setpoints of the drives of the trajectory that are connected to this serial port (see HandleExpiredPlaybackTimer). A running playback is replaced. If none of the drives is connected to this port, the playback is stopped. It may be called from any thread.
+		 * \param startTime The time of the first sample. It is the same for all serial ports.
+		 */
+		void PlayTrajectory(boost::shared_ptr<const Trajectory> trajectory, std::chrono::steady_clock::time_point startTime);
+		/** \brief The state of the playback of this serial port. It may be called from any thread. */
+		TrajectoryStatus GetTrajectoryStatus() const;
+		
+		/** \brief False if no bus master was found on the serial port or the connection has been closed. */
+		bool IsOpen() const;
+		
 		void SetNumOfTransmissionAttempts(unsigned int numOfTransmissionAttempts);
+		/** \brief Set the number of requests per client that may wait for their replies (see SerialInterface::SetClientWindow). */
+		void SetClientWindow(unsigned int clientWindow);
 		
 		std::string GetSerialPortName();
 		
+		/** \brief The number of received bytes that were dropped because they did not belong to a valid message. */
+		unsigned long GetNumOfDroppedBytes() const;
+		/** \brief The number of times the reception had to search for the next valid header. */
+		unsigned long GetNumOfResynchronisations() const;
+		/** \brief The round-trip statistics of all request types sent to the passed client. This may be called from any thread. */
+		std::vector<LatencySummary> GetLatencySummaries(unsigned char clientId) const;
+		
 		void CloseConnection();
 		
 	private:
+		/** \brief Initialise the members and the state shared by both public constructors. The I/O thread is started by the delegating constructors. */
+		SerialConnection(std::string serialPortName, boost::function<void (boost::shared_ptr<const BfbMessage>)> incomingMessageSignal, std::function<void (const BusTopology&)> topologyMismatchFunction);
+		
+		/** \brief Put the message into the send queue of its line. A payload that does not fit into a long packet is split into fragments that are queued back to back. This must only be called from the I/O thread. */
+		void QueueMessage(boost::shared_ptr<const BfbMessage> message);
+		/** \brief Move all messages handed over by other threads into the send queues. This is executed in the I/O thread. */
+		void QueueMessagesFromOtherThreads();
+		boost::lockfree::spsc_queue<boost::shared_ptr<const BfbMessage>> MessagesFromOtherThreads; /*!< The messages passed to SendMessage that have not been moved to the send queues yet. The I/O thread is its only consumer. */
+		boost::mutex SendMessageMutex; /*!< Several threads may call SendMessage (e.g. the TCP server and the poller). They take turns pushing into the single-producer queue, so the I/O thread never waits for a lock. */
+		std::atomic<bool> IsQueueingOfMessagesScheduled; /*!< True if QueueMessagesFromOtherThreads has been posted to the I/O thread and has not started yet. */
+		
 		/** \brief Method that must be called in order to start the receiving automatism.
-		 * This is done in the constructor once. It is then called whenever one message has been received completely and a new message should be received.
+		 * This is done in the constructor once. It is then called whenever received bytes have been processed. It reads all bytes that are available into the free space of the receive ring.
 		 */ 
 		void TryToReceiveMessages();
 		
-		/**  \brief This method should be called by the asynchronous IO-Handler whenever the first eight bytes of a message have been received. Dependend on whether the received bytes represent a complete short message or only the first part of a long message, the message-receipt will be signaled and the message receival automatism will be restarted or - for the latter case - the asynchronous communication framework will be configured in order to receive the number of bytes that is missing to construct a long message. */
-		void HandleReceivedShortMessageOrLongHeader(const boost::system::error_code& error,
+		/** \brief This method is called by the asynchronous IO-Handler whenever bytes have been received. It extracts all complete messages from the receive ring and restarts the receival automatism. */
+		void HandleReceivedData(const boost::system::error_code& error,
 			size_t bytes_transferred);
 		
-		/** \brief The "HandleReceivedShortMessageOrLongHeader" configures the asynchronous interface such that the missing number of bytes will be received in case only the header of a long package was received. After they were received, this function must be called. It signals the receipt of a message to the connected receivers and restarts the receival automatism. */
-		void HandleReceivedLongMessage(const boost::system::error_code& error,
-			size_t bytes_transferred);
+		/** \brief Extract all complete messages from the receive ring and handle them.
+		 * Bytes that do not start a valid message (e.g. because a byte of a previous message was lost on the line) are dropped one by one until the next valid header is found. In this way, the reception recovers from framing errors by itself.
+		 * Since the checksums of the protocol are constant, payload bytes may look like a valid message. Therefore, the first message found while resynchronising is only accepted if it ends with the received data or is followed by another valid header.
+		 */
+		void ExtractReceivedMessages();
+		/** \brief Check whether a valid short message or long message header starts at the passed offset of the receive ring. At least eight bytes must be available from there. */
+		bool IsValidHeaderAt(size_t offset);
 		
 		/** \brief This is not one of the handling methods that are called directly from the IOService object upon asynchronous receipt of a certain number of bytes. It must be called from one of the asynchronous methods if a message has been received completely. This method then deals with the message. */
 		void HandleReceivedMessage(boost::shared_ptr<BfbMessage> incomingMessage);
 		
-		/** \brief The "SendMessage" method does not send the messages directly. It merely pushes them into a queue. Afterwards, it will call this method that is responsible for configuring the asynchronous interface such that after the topmost message has been sent, the corresponding handler ("HandleSentMessage") will be called that calls this function again to prepare the next message for sending. In this way, all messages that are in the queue will be sent one after another.*/
+		/** \brief The "SendMessage" method does not send the messages directly. It merely pushes them into the queue of the line the destination is connected to. Afterwards, it will call this method that is responsible for configuring the asynchronous interface such that after the next message has been sent, the corresponding handler ("HandleSentMessage") will be called that calls this function again to prepare the next message for sending. 
+		 * The queues of the lines are served in turns. A line is skipped as long as maxOutstandingRequestsPerLine requests are waiting for their replies. In this way, a slow line does not hold back the other one and both lines are kept busy.*/
 		void SendNextMessage();
 		
 		/** \brief This method will be called whenever a message has been sent. It will then call the "SendNextMessage" method in order to prepare the next message for sending.*/
 		void HandleSentMessage(boost::shared_ptr<const BfbMessage> message, const boost::system::error_code& error);
+		/** \brief This method is called whenever a probe of the hot plug detection has been sent. The probe is not registered as unanswered request, so it is never resent. */
+		void HandleSentProbe(unsigned char clientId, const boost::system::error_code& error);
 		
 		bool IsActive=true; /*!< This variable represents the status of the serial connection. If it is true, messages can be send and received. If it is false, the connection has been closed (probably because no bus master was connected or because the bus master was unplugged during operation) and therefore no communication is possible. */ 
 		
-		boost::shared_ptr<boost::asio::io_service> IoService; /*!< Asynchronous communication handler used by the instance to connect to the socket and to call the handler methods. */
+		boost::shared_ptr<boost::asio::io_service> IoService=boost::make_shared<boost::asio::io_service>(); /*!< Asynchronous communication handler used by the instance to connect to the socket and to call the handler methods. Every serial port has its own one. */
+		boost::asio::io_service::work Work; /*!< The worker keeps the IoService object busy while no asynchronous operation is pending. */
+		boost::thread IoServiceThread; /*!< The I/O thread of the serial port. All handler methods and all members except for the message hand-over queue are used exclusively by this thread. */
 
 		std::string SerialPortName; /*!< Name of the serial port. */
 		boost::asio::serial_port SerialPort; /*!< Serial port handle. */
@@ -157,67 +519,194 @@ class SerialConnection
 		
 		std::function<void (boost::shared_ptr<const BfbMessage>)> IncomingMessageCallbackFunction; /*!> In this variable, the reference to the signaling function is saved. The corresponding signla will be called every time a message was received. */
 		
-		std::queue<boost::shared_ptr<const BfbMessage>> MessagesToBeSend; /*!< Queue in which all messages are teporarily saved before they are sent.*/
+		std::array<std::deque<boost::shared_ptr<const BfbMessage>>, 256> MessagesOfId; /*!< Queues in which all messages are teporarily saved before they are sent. There's one queue per destination ID, so the messages of a client keep their order while the clients of a line may overtake each other. */
+		std::array<std::deque<unsigned char>, otherMessagesQueue+1> IdsWithMessages; /*!< The destination IDs whose queues are not empty. There's one list per line of the bus master and one for all other IDs. The IDs of a list are served in turns. */
+		std::array<unsigned int, otherMessagesQueue+1> NumOfOutstandingRequests={{0, 0, 0}}; /*!< The number of requests sent to each line that are waiting for their replies. */
+		std::array<unsigned int, 256> NumOfOutstandingRequestsOfId; /*!< The number of requests sent to each client that are waiting for their replies. */
+		unsigned int ClientWindow=defaultClientWindow; /*!< The number of requests per client that may wait for their replies. */
+		unsigned int LastServedQueue=0; /*!< The queue the last message was taken from. */
+		std::array<unsigned char, 256> QueueOfId; /*!< The index of the send queue for each destination ID. */
+		/** \brief Assign the IDs in ClientsOnLine0 and ClientsOnLine1 to the queues of their lines. All other IDs are assigned to the otherMessagesQueue. The lists of the IDs with queued messages are rebuilt accordingly. */
+		void UpdateQueueOfId();
+		/** \brief Check whether the passed message will be registered as unanswered request after it has been sent. */
+		bool IsRequestExpectingReply(const BfbMessage& message) const;
+		/** \brief Decrease the number of outstanding requests of the line the passed request was sent to. If the line was blocked, the sending is resumed. */
+		void ReleaseOutstandingRequest(const BfbMessage& request);
 		bool IsSendPending; /*!< Status variable signaling whether a message is waiting to be sent completely.*/
 		bool BusMasterDetected=false; /*!< Status variable that signals whether a bus master has been found on this serial port so far. */
-		boost::shared_ptr<boost::recursive_mutex> ExclusiveAccessMutex; /*!< This mutex is used to make sure only one thread accesses the send methods at the same time. */
 		boost::shared_ptr<boost::mutex> InitialisationMutex; /*!< This mutex is used to make sure the initialisation is finished before a member method is called. */
 		
 		static const unsigned int MaxMessageLength=256; /*!< This variable defines the maximum size a message can have that is supposed to be received using this module.*/
-		std::vector<unsigned char> IncomingData; /*!< This variable holds the received bytes until a complete message has been received and it can be converted into an appropriate object. It should only be used in the handler methods! If the bytes are modified inbetween, the message will be undecipherable! */
+		ReceiveRingBuffer IncomingData; /*!< This variable holds the received bytes until a complete message has been received and it can be converted into an appropriate object. It should only be used in the handler methods! */
+		std::vector<unsigned char> IncomingMessageData; /*!< The bytes of the message that is currently checked. It is reused for every message in order to avoid allocations. */
+		std::atomic<unsigned long> NumOfDroppedBytes; /*!< The number of received bytes that did not belong to a valid message. */
+		std::atomic<unsigned long> NumOfResynchronisations; /*!< The number of times the reception lost the message boundaries and had to search for the next valid header. */
+		bool IsSynchronised=true; /*!< False while bytes are dropped in search of the next valid header. */
+		LatencyStatistics Latencies; /*!< The round-trip latencies, retries and timeouts of the requests sent via this port. */
+		/** \brief Record a resend or a timeout of the passed request in the latency statistics. */
+		void RecordUnansweredTransmission(const ExtendedBfbMessage& request);
 		std::vector<unsigned char> OutgoingData; /*!< This variable holds the to-be-send bytes. Again: Do not modify the contents except for within the corresponding handler methods! */
+		BfbFragmentAssembler IncomingFragments; /*!< Reassembles the large replies the clients send as fragments. */
+		unsigned char NextFragmentTransferId=0; /*!< The transfer ID of the next message that is split into fragments. */
 		
 		boost::asio::deadline_timer InitialisationTimer; /*!< Timer that is used during the initialisation of the instance. It sets an upper boundary for the time a certain step of the initialisation may last. */
 		
 		/** \brief The method handles the expiration of the initialisation timer. The effect of the expiration depends on the state of the instance (see definition). */
 		void HandleExpiredInitialisationTimer(const boost::system::error_code& error);
+		
+		/** \brief Configure both lines of the bus master for the ID ranges of the passed discovery step and send the identification requests for these ranges. 
+		 * In every step, both lines are probed at the same time using different ID ranges. After numOfClientIdRanges steps, every range has been probed on both lines.
+		 */
+		void StartDiscoveryStep(unsigned int discoveryStep);
+		/** \brief This method is called after the requests of a discovery step have been written. It starts the timer that detects the end of the identification replies. */
+		void HandleWrittenDiscoveryRequests(const boost::system::error_code& error);
+		/** \brief Configure the bus master such that all found clients are reachable and complete the initialisation. */
+		void FinishDiscovery();
+		
+		unsigned int DiscoveryStep=0; /*!< The current step of the client discovery. */
+		std::vector<unsigned char> DiscoveryData; /*!< The raw data of the requests of the current discovery step. It must stay untouched until it has been written completely. */
+		unsigned int NumOfDiscoveryReplies=0; /*!< The number of identification replies received so far. */
+		unsigned int NumOfDiscoveryRepliesAtLastCheck=0; /*!< The number of identification replies at the last expiration of the initialisation timer. If it did not change, no more replies are expected. */
+		boost::posix_time::ptime DiscoveryStepDeadline; /*!< The time at which the current discovery step is completed even if replies are still coming in. */
+		std::vector<unsigned char> LineOfClientIdRange=std::vector<unsigned char>(numOfClientIdRanges, 0); /*!< The line of the bus master each ID range was forwarded to when it was probed most recently. It is used to assign the identification replies to the lines. */
 				
 		std::list<unsigned char> ClientsOnLine0; /*!< In this list, all client IDs are saved that are found on line 0 of the bus master. This information is only neccessary during initialisation. */
 		std::list<unsigned char> ClientsOnLine1; /*!< In this list, all client IDs are saved that are found on line 1 of the bus master. This information is only neccessary during initialisation. */
+		unsigned char ConfigStartIdOnLine0=line0DeactivationStartId; /*!< The start of the ID range the bus master forwards to line 0 after the initialisation. */
+		unsigned char ConfigStartIdOnLine1=line1DeactivationStartId; /*!< The start of the ID range the bus master forwards to line 1 after the initialisation. */
+		
+		/** \brief Write the configuration for both lines (ConfigStartIdOnLine0/1) to the bus master. */
+		void WriteBusMasterConfiguration();
+		
+		/** \brief Send an identification request to every client of a cached topology. The other IDs of the forwarded ranges are probed as well, so clients that have been added since the topology was cached are found. */
+		void StartTopologyVerification();
+		/** \brief The method handles the expiration of the verification timer. All clients that did not reply until then are removed and all unknown clients that replied are added. The corrected topology is reported via TopologyMismatchFunction. */
+		void HandleExpiredVerificationTimer(const boost::system::error_code& error);
+		bool IsTopologyBeingVerified=false; /*!< True until the verification timer of a cached topology has expired. */
+		std::set<unsigned char> UnverifiedClients; /*!< The clients of a cached topology that did not reply to the verification request so far. */
+		std::set<unsigned char> UnexpectedClients; /*!< The clients that replied during the verification of a cached topology but are not part of it. */
+		boost::asio::deadline_timer VerificationTimer; /*!< Timer that sets an upper boundary for the time the verification of a cached topology may take. */
+		std::function<void (const BusTopology&)> TopologyMismatchFunction; /*!< Function that is called with the corrected topology if the cached topology turned out to be outdated. */
 		
 		/** \brief The method handles the expiration of the resend timer. This typically means that a reply was not received although one was expected. */
 		void HandleExpiredResendTimer(const boost::system::error_code& error);
-		std::list<boost::shared_ptr<const ExtendedBfbMessage>> UnansweredRequests; /*!< List storing all sent messages for which no answer has been received so far. If an answer is received, the corresponding request will be deleted from this list.*/
-		boost::asio::deadline_timer ResendTimer; /*!< Timer instance is used to make sure that an answer was received within a certain time. If this time is exceeded, the request will be resent.*/
+		/** \brief Let the resend timer expire at the next due time of the resend timing wheel. */
+		void ScheduleResendTimer();
+		/** \brief Remove the passed request from the unanswered requests. */
+		void RemoveUnansweredRequest(boost::shared_ptr<const ExtendedBfbMessage> request);
+		std::unordered_map<unsigned long, std::deque<boost::shared_ptr<const ExtendedBfbMessage>>> UnansweredRequests; /*!< Map storing all sent messages for which no answer has been received so far. The key is built by unansweredRequestKey from the values of the expected reply; requests with the same key are stored in the order they were sent. If an answer is received, the corresponding request will be deleted from this map.*/
+		ResendTimingWheel ResendDeadlines; /*!< The deadlines after which the unanswered requests are resent. */
+		boost::asio::steady_timer ResendTimer; /*!< Timer instance is used to make sure that an answer was received within a certain time. If this time is exceeded, the request will be resent.*/
 		bool IsResendTimerActive=false; /*!< Flag that is used to tell whether an asynchronous wait has been configured for the ResendTimer.*/
-		boost::posix_time::time_duration TimeToWaitForResponse=boost::posix_time::milliseconds(2); /*!> The maximum time between a request and the corresponding reply before the request is resent.*/
+		std::chrono::steady_clock::time_point ResendTimerExpiry; /*!< The time the ResendTimer is set to if it is active. */
+		std::chrono::steady_clock::duration TimeToWaitForResponse=std::chrono::milliseconds(2); /*!> The maximum time between a request and the corresponding reply before the request is resent.*/
 		
 		unsigned int NumOfTransmissionAttempts=3;
-	
+		
+		/** \brief The method handles the expiration of the probe timer. The probes of the previous periods that have not been answered in time are evaluated and the next IDs of both lines are queued for probing.
+		 * The probes are identification requests that are only sent if no other message can be sent. A line with clients probes the IDs of the range it forwards. The known clients of this range are skipped unless they have been silent for a while or their last request timed out.
+		 * A line without clients probes all ID ranges one after another except for the range of the other line. It is reconfigured whenever the next range is reached. Since no messages are routed to this line, the traffic of the other line is not interrupted.
+		 */
+		void HandleExpiredProbeTimer(const boost::system::error_code& error);
+		/** \brief Queue the next probes of the passed line. */
+		void QueueProbesOfLine(unsigned int line);
+		/** \brief Add a client that answered a probe to the passed line and report the changed topology. */
+		void AddClient(unsigned char clientId, unsigned int line);
+		/** \brief Remove a client that missed too many probes and report the changed topology. Its queued messages are discarded. */
+		void RemoveClient(unsigned char clientId);
+		boost::asio::steady_timer ProbeTimer; /*!< Timer that triggers the periods of the hot plug detection. */
+		std::function<void (const BusTopology&)> TopologyChangeFunction; /*!< Function that is called if a client has been added or removed. It is empty as long as the hot plug detection is not started. */
+		std::deque<unsigned char> ProbesToBeSent; /*!< The IDs that are probed as soon as no other message can be sent. */
+		std::deque<std::pair<unsigned char, std::chrono::steady_clock::time_point>> SentProbes; /*!< The IDs that have been probed and the times of the probes, in the order they were sent. */
+		std::bitset<256> UnansweredProbes; /*!< The IDs of SentProbes whose probe has not been answered so far. */
+		std::bitset<256> UnresponsiveClients; /*!< Known clients whose last request timed out. They are probed in the next period. */
+		std::array<unsigned char, 256> NumOfMissedProbesOfId; /*!< The number of consecutive probes each ID did not answer. */
+		std::array<std::chrono::steady_clock::time_point, 256> TimeOfLastMessageOfId; /*!< The time a message was received from each ID most recently. */
+		std::array<unsigned char, 2> NextProbedId={{firstClientId, firstClientId}}; /*!< The ID each line continues to probe with. */
+		
+		/** \brief The method handles the expiration of the playback timer. The setpoints of all drives of the player are interpolated for the expiry of the timer and queued as messages without reply, so they are never resent.
+		 * 	If the previous setpoint of a drive has not been sent yet or the driver of the serial port still holds the setpoints of a whole period, the new one is skipped. In this way, a line that cannot keep up with the period does not accumulate a growing backlog of outdated setpoints.
+		 * 	Other messages queued for a drive (e.g. the reads of the cyclic poller) do not cause a setpoint to be skipped. If the driver of the serial port cannot report its unsent bytes, the line is considered busy.
+		 * \param player The player the timer was started for. If it has been replaced in the meantime, the expiration is ignored.
+		 */
+		void HandleExpiredPlaybackTimer(boost::shared_ptr<TrajectoryPlayer> player, const boost::system::error_code& error);
+		boost::shared_ptr<TrajectoryPlayer> Player; /*!< The player of the current trajectory. It is empty if no trajectory is played. */
+		boost::asio::steady_timer PlaybackTimer; /*!< Timer that triggers the setpoints of the current trajectory. It is advanced by the period of the trajectory, so the setpoints do not drift. */
+		std::vector<double> Setpoints; /*!< The interpolated setpoints of the drives of the player. It is reused for every period in order to avoid allocations. */
+		std::array<boost::shared_ptr<const BfbMessage>, 256> UnsentSetpointOfId; /*!< The setpoint queued most recently for each drive as long as it has not been sent. It is reset by SendNextMessage when the setpoint is sent. */
+		bool HasOutputQueueErrorBeenReported=false; /*!< True if the failure to read the unsent bytes of the serial port has been reported during the current playback. */
+		std::atomic<bool> IsTrajectoryPlaying; /*!< True while the player sends setpoints. */
+		std::atomic<unsigned long> NumOfPlayedSetpoints; /*!< The number of setpoints sent since the current playback was started. */
+		std::atomic<unsigned long> NumOfSkippedSetpoints; /*!< The number of setpoints skipped since the current playback was started. */
 };
 
 
-SerialInterface::SerialInterface():
+SerialInterface::SerialInterface(std::string topologyCacheFile, std::vector<std::string> serialPortNames):
 		Work(*IoService),
 		IoServiceThread(boost::bind(&boost::asio::io_service::run,IoService)),
+		IncomingMessages(),
+		IsForwardingOfIncomingMessagesScheduled(false),
 		SerialConnections(std::vector<boost::shared_ptr<SerialConnection>>()),
-		Clients(std::map<unsigned char, boost::shared_ptr<SerialConnection>>()){
+		Clients(std::map<unsigned char, boost::shared_ptr<SerialConnection>>()),
+		TopologyCacheFile(topologyCacheFile){
 	
-	std::vector<std::string> serialPortNames=parseSerialPorts(); // Get the names of the serial ports.
+	if(serialPortNames.empty()){
+		serialPortNames=parseSerialPorts(); // Get the names of the serial ports.
+	};
+	std::map<std::string, BusTopology> cachedTopologies;
+	if(!TopologyCacheFile.empty()){
+		cachedTopologies=loadBusTopologyCache(TopologyCacheFile);
+	};
 	std::vector<boost::shared_ptr<SerialConnection>> tempSerialConnections=std::vector<boost::shared_ptr<SerialConnection>>();
-	std::function<void(boost::shared_ptr<const BfbMessage> message)> tempFunction= boost::bind(&SerialInterface::ForwardIncomingMessage, this,_1);
+	for(unsigned int i=0;i<serialPortNames.size();i++){ // The queues must exist before the first I/O thread is started since the forwarding thread reads all of them.
+		IncomingMessages.push_back(boost::make_shared<MessageQueue>(capacityOfThreadQueues));
+	};
 	for(unsigned int i=0;i<serialPortNames.size();i++){
-			auto temp=boost::make_shared<SerialConnection>(IoService, serialPortNames[i], tempFunction);
+			std::function<void(boost::shared_ptr<const BfbMessage> message)> tempFunction= boost::bind(&SerialInterface::QueueIncomingMessage, this, IncomingMessages[i].get(), _1);
+			boost::shared_ptr<SerialConnection> temp;
+			auto cachedTopology=cachedTopologies.find(serialPortNames[i]);
+			if(cachedTopology!=cachedTopologies.end()){ // The topology of this port is known. Therefore, the discovery can be skipped.
+				temp=boost::make_shared<SerialConnection>(serialPortNames[i], tempFunction, cachedTopology->second, boost::bind(&SerialInterface::HandleChangedTopology, this, _1));
+			}else{
+				temp=boost::make_shared<SerialConnection>(serialPortNames[i], tempFunction);
+			};
 			temp->SetNumOfTransmissionAttempts(NumOfTransmissionAttempts);
 			tempSerialConnections.push_back(temp); // Create a new instance of the serial connection class for every serial port that is available. 
 	};
 	//std::cout<<"Started all "<< int(SerialConnections.size()) << " serial connections."<<std::endl;
 	// Now, all the serial connection instances are trying to identify clients. In order to send messages to them, their IDs must be connected to the corresponding serial connection. Therefore, one must wait until the serial connection has been initialised before the client IDs can be read.
+	std::list<BusTopology> topologies;
 	for(unsigned int i=0;i<tempSerialConnections.size();i++){
 		tempSerialConnections[i]->WaitUntilInitialised();
+		if(!tempSerialConnections[i]->IsOpen()){
+			continue;
+		};
+		// A bus master without clients is kept since clients may be plugged in later (see StartHotPlugDetection).
+		boost::lock_guard<boost::mutex> lock(ClientsMutex); // The verification of a cached topology may already report a corrected topology.
+		SerialConnections.push_back(tempSerialConnections[i]);
+		Topologies[tempSerialConnections[i]->GetSerialPortName()]=tempSerialConnections[i]->GetTopology();
 		auto tempList=tempSerialConnections[i]->GetConnectedClients();
 		if(tempList.size()>0){
-			SerialConnections.push_back(tempSerialConnections[i]);
 			for(auto it=tempList.begin();it!=tempList.end();it++){
 				Clients[*it]=tempSerialConnections[i];
 			};
+			topologies.push_back(tempSerialConnections[i]->GetTopology());
 		};
 		//std::cout<<"Serial connection Nr. " << int(i) << " is ready for operation."<<std::endl;
 	};
-	
+	if(!TopologyCacheFile.empty()){
+		saveBusTopologyCache(TopologyCacheFile, topologies);
+	};
 }
 
 SerialInterface::~SerialInterface(){
+	std::vector<boost::shared_ptr<SerialConnection>> serialConnections;
+	{
+		boost::lock_guard<boost::mutex> lock(ClientsMutex); // The I/O threads may still report changed topologies.
+		serialConnections.swap(SerialConnections);
+	}
+	serialConnections.clear(); // Stop the I/O threads of the serial ports first. Afterwards, no more messages are queued.
+	Clients.clear();
 	IoService->stop();
 	IoServiceThread.join();
 };
@@ -229,8 +718,73 @@ void SerialInterface::SetNumOfTransmissionAttempts(unsigned int numOfTransmissio
 	};
 }
 
+void SerialInterface::SetClientWindow(unsigned int clientWindow){
+	for(auto it=SerialConnections.begin(); it!=SerialConnections.end(); it++){
+		(*it)->SetClientWindow(clientWindow);
+	};
+}
+
+
+void SerialInterface::StartHotPlugDetection(){
+	for(auto it=SerialConnections.begin(); it!=SerialConnections.end(); it++){
+		(*it)->StartHotPlugDetection(boost::bind(&SerialInterface::HandleChangedTopology, this, _1));
+	};
+}
+
+void SerialInterface::NotifyOfClientChanges(std::function<void (std::list<unsigned char>)> notificationFunction){
+	ClientChangeNotificationFunctions.push_back(notificationFunction);
+}
+
+void SerialInterface::HandleChangedTopology(const BusTopology& topology){
+	std::list<unsigned char> clients;
+	std::list<BusTopology> topologies;
+	{
+		boost::lock_guard<boost::mutex> lock(ClientsMutex);
+		boost::shared_ptr<SerialConnection> connection;
+		for(auto it=SerialConnections.begin(); it!=SerialConnections.end(); it++){
+			if((*it)->GetSerialPortName()==topology.SerialPortName){
+				connection=*it;
+			};
+		};
+		if(!connection){ // The constructor has not reached this serial connection yet. It will read the current topology itself.
+			return;
+		};
+		for(auto it=Clients.begin(); it!=Clients.end();){
+			if(it->second==connection){
+				it=Clients.erase(it);
+			}else{
+				it++;
+			};
+		};
+		for(auto it=topology.ClientsOnLine0.begin(); it!=topology.ClientsOnLine0.end(); it++){
+			Clients[*it]=connection;
+		};
+		for(auto it=topology.ClientsOnLine1.begin(); it!=topology.ClientsOnLine1.end(); it++){
+			Clients[*it]=connection;
+		};
+		Topologies[topology.SerialPortName]=topology;
+		for(auto it=Clients.begin(); it!=Clients.end(); it++){
+			clients.push_back(it->first);
+		};
+		for(auto it=Topologies.begin(); it!=Topologies.end(); it++){
+			if(!it->second.ClientsOnLine0.empty() || !it->second.ClientsOnLine1.empty()){
+				topologies.push_back(it->second);
+			};
+		};
+	}
+	// The file is written and the notifications are sent by the forwarding thread, so the I/O thread of the serial port is not blocked.
+	IoService->post([this, clients, topologies](){
+		if(!TopologyCacheFile.empty()){
+			saveBusTopologyCache(TopologyCacheFile, topologies);
+		};
+		for(auto it=ClientChangeNotificationFunctions.begin(); it!=ClientChangeNotificationFunctions.end(); it++){
+			(*it)(clients);
+		};
+	});
+}
 
 std::list<unsigned char> SerialInterface::GetConnectedClients(){
+	boost::lock_guard<boost::mutex> lock(ClientsMutex);
 	std::list<unsigned char> tempList;
 	for(auto it=Clients.begin();it!=Clients.end();it++){
 		tempList.push_back(it->first);
@@ -249,6 +803,54 @@ std::list< std::string > SerialInterface::GetSerialPortNames(){
 }
 
 
+void SerialInterface::PrintStatistics(){
+	for(auto it=SerialConnections.begin();it!=SerialConnections.end();it++){
+		std::cout<<std::dec<<"Serial port "<<(*it)->GetSerialPortName()<<": "<<(*it)->GetNumOfDroppedBytes()<<" dropped bytes in "<<(*it)->GetNumOfResynchronisations()<<" resynchronisations"<<std::endl;
+	};
+	std::cout<<"Round trips of the requests sent to the serial clients:"<<std::endl;
+	boost::lock_guard<boost::mutex> lock(ClientsMutex);
+	for(auto it=Clients.begin();it!=Clients.end();it++){
+		printLatencySummaries(std::cout, it->second->GetLatencySummaries(it->first));
+	};
+}
+
+std::vector<LatencySummary> SerialInterface::GetLatencySummaries(unsigned char clientId){
+	boost::shared_ptr<SerialConnection> connection;
+	{
+		boost::lock_guard<boost::mutex> lock(ClientsMutex);
+		auto client=Clients.find(clientId);
+		if(client==Clients.end()){
+			return std::vector<LatencySummary>();
+		};
+		connection=client->second;
+	}
+	return connection->GetLatencySummaries(clientId);
+}
+
+unsigned int SerialInterface::PlayTrajectory(boost::shared_ptr<const Trajectory> trajectory){
+	std::chrono::steady_clock::time_point startTime=std::chrono::steady_clock::now()+trajectory->StartDelay;
+	for(auto it=SerialConnections.begin(); it!=SerialConnections.end(); it++){
+		(*it)->PlayTrajectory(trajectory, startTime);
+	};
+	unsigned int numOfConnectedDrives=0;
+	boost::lock_guard<boost::mutex> lock(ClientsMutex);
+	for(auto it=trajectory->DriveIds.begin(); it!=trajectory->DriveIds.end(); it++){
+		numOfConnectedDrives+=Clients.count(*it);
+	};
+	return numOfConnectedDrives;
+}
+
+TrajectoryStatus SerialInterface::GetTrajectoryStatus(){
+	TrajectoryStatus status;
+	for(auto it=SerialConnections.begin(); it!=SerialConnections.end(); it++){
+		TrajectoryStatus connectionStatus=(*it)->GetTrajectoryStatus();
+		status.IsPlaying|=connectionStatus.IsPlaying;
+		status.NumOfSetpoints+=connectionStatus.NumOfSetpoints;
+		status.NumOfSkippedSetpoints+=connectionStatus.NumOfSkippedSetpoints;
+	};
+	return status;
+}
+
 boost::function<void (boost::shared_ptr<const BfbMessage>)> SerialInterface::GetSendMessageHandle(){
 	return [&, this](boost::shared_ptr<const BfbMessage> outputMessage)->void{
 		if(this){
@@ -259,12 +861,125 @@ boost::function<void (boost::shared_ptr<const BfbMessage>)> SerialInterface::Get
 
 
 void SerialInterface::SendMessage(boost::shared_ptr<const BfbMessage> message){
-	auto it=Clients.find(message->GetDestination());
-	if(it!=Clients.end()){
-		it->second->SendMessage(message);
+	boost::shared_ptr<SerialConnection> connection;
+	{
+		boost::lock_guard<boost::mutex> lock(ClientsMutex);
+		auto it=Clients.find(message->GetDestination());
+		if(it==Clients.end()){
+			return;
+		};
+		connection=it->second;
+	}
+	if(RegisterPendingRead(message)){
+		connection->SendMessage(message);
 	};
 };
 
+/** \brief The read commands of the protocols of the bus clients, by protocol ID. 
+ * 	A property with the request ID n is read with the command n and written with the command n+2 (see BioFlexBusProtocolXmls). Only the read commands are listed, since a write must always reach its client. 
+ * 	Note: The list must be updated if a property is added to the protocol definitions.
+ */
+static const std::map<unsigned char, std::set<unsigned char>> readCommands={
+	{1, {0}},												// BIOFLEX_1_PROT
+	{13, {4, 30, 34, 40, 44, 48, 50, 60, 70, 72, 100, 102}},						// BIOFLEX_ROTATORY_1_PROT
+	{15, {0, 40, 48, 70, 80, 82, 86, 88, 92, 94, 98, 100, 104, 106, 110, 112, 116, 118, 122, 124, 128, 130, 134, 136, 140, 142, 146, 148, 152, 154, 158, 160}},	// BIOFLEX_ROTATORY_ERROR_PROT
+	{16, {80, 84, 160, 164}},										// BIOFLEX_ROTATORY_CONTROL_1_PROT
+	{17, {4, 10, 64}},											// PRESSURE_SENSOR_PROT
+	{18, {20, 40, 94, 96}}											// IMU_PROT
+};
+
+/** \brief A request is a read request if a reply is expected and its command reads a property of the protocol. The payload is not taken into account: a write of the value 0 is still a write. */
+static bool isReadRequest(const BfbMessage& message){
+	if(!message.GetBusAllocation()){
+		return false;
+	};
+	auto protocol=readCommands.find(message.GetProtocol());
+	return protocol!=readCommands.end() && protocol->second.count(message.GetCommand())==1;
+}
+
+bool SerialInterface::RegisterPendingRead(boost::shared_ptr<const BfbMessage> request){
+	if(!isReadRequest(*request)){
+		return true;
+	};
+	unsigned long key=unansweredRequestKey(request->GetDestination(), request->GetProtocol(), request->GetCommand()+1);
+	std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now();
+	boost::lock_guard<boost::mutex> lock(PendingReadsMutex);
+	auto read=PendingReads.find(key);
+	if(read!=PendingReads.end() && now-read->second.TimeOfRequest<maxCoalescedReadAge){
+		read->second.AdditionalRequesters.push_back(request->GetSource());
+		return false;
+	};
+	CoalescedRead& newRead=PendingReads[key];
+	newRead.Requester=request->GetSource();
+	newRead.AdditionalRequesters.clear();
+	newRead.TimeOfRequest=now;
+	return true;
+}
+
+void SerialInterface::ForwardReplyToAdditionalRequesters(boost::shared_ptr<const BfbMessage> reply){
+	if(reply->GetBusAllocation()){
+		return;
+	};
+	std::vector<unsigned char> additionalRequesters;
+	{
+		boost::lock_guard<boost::mutex> lock(PendingReadsMutex);
+		auto read=PendingReads.find(unansweredRequestKey(reply->GetSource(), reply->GetProtocol(), reply->GetCommand()));
+		if(read==PendingReads.end() || read->second.Requester!=reply->GetDestination()){
+			return;
+		};
+		additionalRequesters.swap(read->second.AdditionalRequesters);
+		PendingReads.erase(read);
+	};
+	for(auto it=additionalRequesters.begin(); it!=additionalRequesters.end(); it++){
+		auto copy=boost::make_shared<BfbMessage>(*reply);
+		copy->SetDestination(*it);
+		ForwardIncomingMessage(copy);
+	};
+}
+
+bool SerialInterface::SetSerialThreadScheduling(int realTimePriority, int firstCpu){
+	bool success=true;
+	for(unsigned int i=0;i<SerialConnections.size();i++){
+		success&=SerialConnections[i]->SetIoThreadScheduling(realTimePriority, firstCpu<0 ? -1 : firstCpu+i);
+	};
+	return success;
+}
+
+bool SerialInterface::SetForwardingThreadScheduling(int realTimePriority, int cpu){
+	return setThreadScheduling(IoServiceThread.native_handle(), realTimePriority, cpu);
+}
+
+bool SerialInterface::SetSerialLowLatency(){
+	bool success=true;
+	for(auto it=SerialConnections.begin();it!=SerialConnections.end();it++){
+		success&=(*it)->SetLowLatency();
+	};
+	return success;
+}
+
+void SerialInterface::QueueIncomingMessage(MessageQueue* queue, boost::shared_ptr<const BfbMessage> message){
+	while(!queue->push(message)){ // The forwarding thread is a whole queue behind. It is woken up below at the latest.
+		if(!IsForwardingOfIncomingMessagesScheduled.exchange(true)){
+			IoService->post(boost::bind(&SerialInterface::ForwardQueuedIncomingMessages, this));
+		};
+		boost::this_thread::yield();
+	};
+	if(!IsForwardingOfIncomingMessagesScheduled.exchange(true)){ // Wake up the forwarding thread only once for all messages queued until it starts to process them.
+		IoService->post(boost::bind(&SerialInterface::ForwardQueuedIncomingMessages, this));
+	};
+}
+
+void SerialInterface::ForwardQueuedIncomingMessages(){
+	IsForwardingOfIncomingMessagesScheduled=false; // Reset the flag before the queue is emptied. Otherwise, a message pushed in between might not be forwarded.
+	boost::shared_ptr<const BfbMessage> message;
+	for(auto queue=IncomingMessages.begin(); queue!=IncomingMessages.end(); queue++){
+		while((*queue)->pop(message)){
+			ForwardIncomingMessage(message);
+			ForwardReplyToAdditionalRequesters(message);
+		};
+	};
+}
+
 void SerialInterface::ForwardIncomingMessage(boost::shared_ptr< const BfbMessage > message){
 	for(auto it=InputMessagesRouteList.begin(); it!=InputMessagesRouteList.end(); it++){
 		(*it)(message);
@@ -290,27 +1005,51 @@ BfbMessage createIdentificationRequestMessageForId(unsigned char destinationId){
 
 ////////////////////////////////////////////////////////////////////////////////
 
-SerialConnection::SerialConnection(boost::shared_ptr<boost::asio::io_service> ioService, const std::string serialPortName, boost::function<void (boost::shared_ptr<const BfbMessage>)> incomingMessageSignal):
-			IoService(ioService),
+SerialConnection::SerialConnection(const std::string serialPortName, boost::function<void (boost::shared_ptr<const BfbMessage>)> incomingMessageSignal, std::function<void (const BusTopology&)> topologyMismatchFunction):
+			MessagesFromOtherThreads(capacityOfThreadQueues),
+			SendMessageMutex(),
+			IsQueueingOfMessagesScheduled(false),
+			Work(*IoService),
+			IoServiceThread(),
 			SerialPortName(serialPortName),
-			SerialPort(*ioService, serialPortName),
+			SerialPort(*IoService, serialPortName),
 			InitialisationState(WaitingForBusMasterIdentificationReply),
 			IncomingMessageCallbackFunction(incomingMessageSignal),
-			MessagesToBeSend(std::queue<boost::shared_ptr<const BfbMessage>>()),
+			MessagesOfId(),
+			IdsWithMessages(),
 			IsSendPending(false),
-			ExclusiveAccessMutex(new boost::recursive_mutex),
 			InitialisationMutex(new boost::mutex),
-			IncomingData(std::vector<unsigned char>(0)),
+			IncomingData(),
+			IncomingMessageData(),
+			NumOfDroppedBytes(0),
+			NumOfResynchronisations(0),
 			OutgoingData(std::vector<unsigned char>(0)),
-			InitialisationTimer(*ioService),
+			InitialisationTimer(*IoService),
 			ClientsOnLine0(std::list<unsigned char>()),
 			ClientsOnLine1(std::list<unsigned char>()),
-			UnansweredRequests(std::list<boost::shared_ptr<const ExtendedBfbMessage>>()),
-			ResendTimer(*ioService){
+			UnverifiedClients(),
+			UnexpectedClients(),
+			VerificationTimer(*IoService),
+			TopologyMismatchFunction(topologyMismatchFunction),
+			UnansweredRequests(),
+			ResendDeadlines(resendTimingWheelResolution),
+			ResendTimer(*IoService),
+			ProbeTimer(*IoService),
+			PlaybackTimer(*IoService),
+			IsTrajectoryPlaying(false),
+			NumOfPlayedSetpoints(0),
+			NumOfSkippedSetpoints(0){
 
 	InitialisationMutex->lock();
-	IncomingData.reserve(MaxMessageLength);
+	IncomingMessageData.reserve(MaxMessageLength);
 	OutgoingData.reserve(MaxMessageLength);
+	QueueOfId.fill(otherMessagesQueue);
+	NumOfOutstandingRequestsOfId.fill(0);
+	NumOfMissedProbesOfId.fill(0);
+}
+
+SerialConnection::SerialConnection(const std::string serialPortName, boost::function<void (boost::shared_ptr<const BfbMessage>)> incomingMessageSignal):
+			SerialConnection(serialPortName, incomingMessageSignal, std::function<void (const BusTopology&)>()){
 	auto rawData=createIdentificationRequestMessageForId(1).GetRawData();
 	for(int i=0;i<3;i++){
 		boost::asio::write(SerialPort, boost::asio::buffer(rawData, rawData.size()));
@@ -320,8 +1059,30 @@ SerialConnection::SerialConnection(boost::shared_ptr<boost::asio::io_service> io
 	InitialisationTimer.expires_from_now(boost::posix_time::seconds(1));	
 	InitialisationTimer.async_wait(boost::bind(&SerialConnection::HandleExpiredInitialisationTimer, this, boost::asio::placeholders::error));
 	TryToReceiveMessages();
+	IoServiceThread=boost::thread(boost::bind(&boost::asio::io_service::run, IoService)); // The handlers must not run before the construction is completed.
 }
+
+SerialConnection::SerialConnection(const std::string serialPortName, boost::function<void (boost::shared_ptr<const BfbMessage>)> incomingMessageSignal, const BusTopology& cachedTopology, std::function<void (const BusTopology&)> topologyMismatchFunction):
+			SerialConnection(serialPortName, incomingMessageSignal, topologyMismatchFunction){
+	BusMasterDetected=true;
+	ClientsOnLine0=cachedTopology.ClientsOnLine0;
+	ClientsOnLine1=cachedTopology.ClientsOnLine1;
+	ConfigStartIdOnLine0=cachedTopology.ConfigStartIdOnLine0;
+	ConfigStartIdOnLine1=cachedTopology.ConfigStartIdOnLine1;
+	UpdateQueueOfId();
+	WriteBusMasterConfiguration();
+	InitialisationState=InitialisationComplete; // The topology is known. Therefore, the initalisation is already complete.
+	InitialisationMutex->unlock();
+	TryToReceiveMessages();
+	IoService->post(boost::bind(&SerialConnection::StartTopologyVerification, this));
+	IoServiceThread=boost::thread(boost::bind(&boost::asio::io_service::run, IoService)); // The handlers must not run before the construction is completed.
+}
+
 SerialConnection::~SerialConnection(){
+	IoService->stop();
+	if(IoServiceThread.joinable()){ // The thread has not been started if the body of a delegating constructor failed.
+		IoServiceThread.join();
+	};
 	CloseConnection();
 };
 
@@ -340,20 +1101,82 @@ std::string SerialConnection::GetSerialPortName(){
 	return SerialPortName;
 }
 
+unsigned long SerialConnection::GetNumOfDroppedBytes() const{
+	return NumOfDroppedBytes;
+}
+
+unsigned long SerialConnection::GetNumOfResynchronisations() const{
+	return NumOfResynchronisations;
+}
+
+std::vector<LatencySummary> SerialConnection::GetLatencySummaries(unsigned char clientId) const{
+	return Latencies.GetSummaries(clientId);
+}
+
+void SerialConnection::RecordUnansweredTransmission(const ExtendedBfbMessage& request){
+	unsigned char clientId, protocol, command;
+	decodeReplyKey(expectedReplyKey(request), clientId, protocol, command);
+	if(request.NumOfTransmissions<NumOfTransmissionAttempts){
+		Latencies.RecordRetry(clientId, protocol, command);
+	}else{
+		Latencies.RecordTimeout(clientId, protocol, command);
+	};
+}
+
+
+void SerialConnection::SetClientWindow(unsigned int clientWindow){
+	IoService->post([this, clientWindow](){
+		ClientWindow=std::max(clientWindow, 1u);
+	});
+}
 
 void SerialConnection::SetNumOfTransmissionAttempts(unsigned int numOfTransmissionAttempts){
-	NumOfTransmissionAttempts=numOfTransmissionAttempts;
+	IoService->post([this, numOfTransmissionAttempts](){
+		NumOfTransmissionAttempts=numOfTransmissionAttempts;
+	});
+}
+
+bool SerialConnection::SetIoThreadScheduling(int realTimePriority, int cpu){
+	return setThreadScheduling(IoServiceThread.native_handle(), realTimePriority, cpu);
 }
 
+bool SerialConnection::SetLowLatency(){
+	#if defined __linux__
+	struct serial_struct serialInfo;
+	if(ioctl(SerialPort.native_handle(), TIOCGSERIAL, &serialInfo)!=0){ // Pseudo-terminals and some USB adapters do not support this.
+		return false;
+	};
+	serialInfo.flags|=ASYNC_LOW_LATENCY;
+	return ioctl(SerialPort.native_handle(), TIOCSSERIAL, &serialInfo)==0;
+	#else
+	return false;
+	#endif
+}
+
+
+bool SerialConnection::IsOpen() const{
+	return IsActive;
+}
 
 void SerialConnection::WaitUntilInitialised(){
 	boost::lock_guard<boost::mutex> lock(*InitialisationMutex); // The mutex gets unlocked as soon as the initialization has been completed.
 	return;
 }
 
+BusTopology SerialConnection::GetTopology(){
+	BusTopology topology;
+	topology.SerialPortName=SerialPortName;
+	// A line without clients may currently forward the ID range it probes. It is stored as deactivated.
+	topology.ConfigStartIdOnLine0=(ClientsOnLine0.empty() ? line0DeactivationStartId : ConfigStartIdOnLine0);
+	topology.ConfigStartIdOnLine1=(ClientsOnLine1.empty() ? line1DeactivationStartId : ConfigStartIdOnLine1);
+	topology.ClientsOnLine0=ClientsOnLine0;
+	topology.ClientsOnLine1=ClientsOnLine1;
+	return topology;
+}
+
 std::list<unsigned char> SerialConnection::GetConnectedClients(){
 	std::list<unsigned char> tempList=ClientsOnLine0;
-	tempList.merge(ClientsOnLine1);	
+	tempList.insert(tempList.end(), ClientsOnLine1.begin(), ClientsOnLine1.end()); // Don't use merge since it would empty ClientsOnLine1.
 	tempList.sort();
 	tempList.unique();
 	return tempList;
@@ -381,104 +1204,40 @@ BfbMessage createBusMasterConfigurationMessage(bool isLine1, unsigned char start
 /** \brief This method handles the initalisation routine of a serial connection instance.
  * During the initialisation, different tasks must be concluded:
  *  - Find out if a bus master connected?
- *  - Find out which clients are connected to line 0 of the bus master?
- *  - Find out which clients are connected to line 1 of the bus master?
+ *  - Find out which clients are connected to line 0 and line 1 of the bus master? Both lines are probed at the same time (see StartDiscoveryStep).
  *  - Configure the bus master such that all clients will be available. 
  * Since the tasks use asynchronous communication, it is convenient to always use a timer object to set an upper boundary for the time a task may take up. If a task can be completed before this time is over, the timer can be interrupted. 
+ * All the writes are asynchronous. Therefore, all serial connections are initialised concurrently.
  */
 void SerialConnection::HandleExpiredInitialisationTimer(const boost::system::error_code& error)
 {
-	//std::cout<<"HandleExpiredInitialisationTimer"<<std::endl;
-	std::vector<unsigned char>  tempRawData(2,0);
-	std::vector<unsigned char>  busMasterConfigurationRawData;	
-	
 	switch(InitialisationState){
 		case WaitingForBusMasterIdentificationReply: // In the constructor method, an identification request has been sent to the bus master. Afterwards, the timer was set. If the timer ran out without having received a reply from the bus master, it must be assumed that no bus master is connected. 
-			//std::cout<<"WaitingForBusMasterIdentificationReply"<<std::endl;
 			if (!error || !BusMasterDetected){ // Identification was not received and therefore this timeout was not canceled. This means that no Bioflex Bus Master is connected on this serial port.
 				CloseConnection(); 
 				InitialisationMutex->unlock(); // The initalisation has been completed prematurely.
 				return;
 			}
-			// If we came to this point, a bus master is connected to this serial port. Now, the connected clients must be identified. First on line 0.
-
-		// Attention: Do not put a "break" here! The following code can be reused by the second initalisation stage. 	
-		case WaitingForBusClientIdentificationReplyOnLine0:
-			//std::cout<<"WaitingForBusClientIdentificationReplyOnLine0"<<std::endl;
-			{ //Case
-			// Change the status 
-			if(InitialisationState==WaitingForBusMasterIdentificationReply){
-				InitialisationState=WaitingForBusClientIdentificationReplyOnLine0;
-			}else if(InitialisationState==WaitingForBusClientIdentificationReplyOnLine0){
-				InitialisationState=WaitingForBusClientIdentificationReplyOnLine1;
-			}
-			//Configure the bus master such that the "other line" is basically not sending any messages
-			if(InitialisationState==WaitingForBusClientIdentificationReplyOnLine0){
-				busMasterConfigurationRawData=createBusMasterConfigurationMessage(1,line1DeactivationStartId).GetRawData();
-			}else if(InitialisationState==WaitingForBusClientIdentificationReplyOnLine1){
-				busMasterConfigurationRawData=createBusMasterConfigurationMessage(0,line0DeactivationStartId).GetRawData();
-			};
-			boost::asio::write(SerialPort, boost::asio::buffer(busMasterConfigurationRawData, busMasterConfigurationRawData.size()));
-				
-
-			
-			//Checking Clients on the currently interesting line
-			BfbMessage identificationRequest = createIdentificationRequestMessageForId(0x00);
-			unsigned char confStartId;
-			for(unsigned int repetition=0;repetition<10;repetition++){//Send each identification request multiple times in order to increase the chance one of them will come through
-				confStartId=0x00;
-				for(unsigned char destId=0x10;destId<line0DeactivationStartId;destId++){
-					if((confStartId+0x0f)<destId){
-						//Configure the bus master such that the currently interesting line is able to send messages in the desired ID range
-						confStartId+=0x10;
-						if(InitialisationState==WaitingForBusClientIdentificationReplyOnLine0){
-							busMasterConfigurationRawData=createBusMasterConfigurationMessage(0,confStartId).GetRawData();
-						}else if(InitialisationState==WaitingForBusClientIdentificationReplyOnLine1){
-							busMasterConfigurationRawData=createBusMasterConfigurationMessage(1,confStartId).GetRawData();
-						};
-						boost::asio::write(SerialPort, boost::asio::buffer(busMasterConfigurationRawData, busMasterConfigurationRawData.size()));
-					};
-					identificationRequest.SetDestination(destId);
-					tempRawData=identificationRequest.GetRawData();
-					boost::asio::write(SerialPort, boost::asio::buffer(tempRawData, tempRawData.size()));
-				};
-			};
-			InitialisationTimer.expires_from_now(boost::posix_time::milliseconds(500));
-			InitialisationTimer.async_wait(boost::bind(&SerialConnection::HandleExpiredInitialisationTimer, this, boost::asio::placeholders::error));
-			};//End of case
+			// If we came to this point, a bus master is connected to this serial port. Now, the connected clients must be identified.
+			InitialisationState=WaitingForBusClientIdentificationReply;
+			StartDiscoveryStep(0);
 		break;
-		case WaitingForBusClientIdentificationReplyOnLine1: // Both lines have been tested. Basically, all initalisation steps are completed. However, some housekeeping must be carried out. 
-			//std::cout<<"WaitingForBusClientIdentificationReplyOnLine1"<<std::endl;
-			//Sort the client lists
-			ClientsOnLine0.sort();
-			ClientsOnLine0.unique();
-			ClientsOnLine1.sort();
-			ClientsOnLine1.unique();
-			
-			if(ClientsOnLine0.size()>0 && ClientsOnLine1.size()>0 && !(ClientsOnLine0.back()<ClientsOnLine1.front() || ClientsOnLine1.back()<ClientsOnLine0.front())){
-				std::cout<<"The client ID ranges for the two lines of the bus master connected to port "<< SerialPortName <<"  are intersecting. The bus master will be shut down."<<std::endl;
-				CloseConnection();
-				InitialisationMutex->unlock();
+		case WaitingForBusClientIdentificationReply:
+			if(error || !IsActive){
 				return;
-			}
-			
-			//Configure the bus master in order to forward the messages to the correct lines
-			if(ClientsOnLine0.size()>0){
-				busMasterConfigurationRawData=createBusMasterConfigurationMessage(0,(ClientsOnLine0.front()/16)*16).GetRawData();
-			}else{
-				busMasterConfigurationRawData=createBusMasterConfigurationMessage(0,line0DeactivationStartId).GetRawData();
-			}
-			boost::asio::write(SerialPort, boost::asio::buffer(busMasterConfigurationRawData, busMasterConfigurationRawData.size()));
-			
-			if(ClientsOnLine1.size()>0){
-				busMasterConfigurationRawData=createBusMasterConfigurationMessage(1,(ClientsOnLine1.front()/16)*16).GetRawData();
+			};
+			// As long as identification replies are coming in, the step is not completed (unless it takes too long).
+			if(NumOfDiscoveryReplies!=NumOfDiscoveryRepliesAtLastCheck && boost::posix_time::microsec_clock::local_time()<DiscoveryStepDeadline){
+				NumOfDiscoveryRepliesAtLastCheck=NumOfDiscoveryReplies;
+				InitialisationTimer.expires_from_now(discoveryQuietPeriod);
+				InitialisationTimer.async_wait(boost::bind(&SerialConnection::HandleExpiredInitialisationTimer, this, boost::asio::placeholders::error));
+				return;
+			};
+			if(DiscoveryStep+1<numOfClientIdRanges){
+				StartDiscoveryStep(DiscoveryStep+1);
 			}else{
-				busMasterConfigurationRawData=createBusMasterConfigurationMessage(1,line1DeactivationStartId).GetRawData();
-			}
-			boost::asio::write(SerialPort, boost::asio::buffer(busMasterConfigurationRawData, busMasterConfigurationRawData.size()));
-			
-			InitialisationState=InitialisationComplete; // Now, the initalisation is complete.
-			InitialisationMutex->unlock();
+				FinishDiscovery();
+			};
 		break;
 		case InitialisationComplete: // This case should not happen because the timer should not be set after the prior step, however, since the compiler constantly complains about the missing case, here it is.
 			break;
@@ -486,10 +1245,178 @@ void SerialConnection::HandleExpiredInitialisationTimer(const boost::system::err
     return;
 }
 
+void SerialConnection::StartDiscoveryStep(unsigned int discoveryStep){
+	DiscoveryStep=discoveryStep;
+	// Line 0 probes the ranges in ascending order, line 1 with an offset of half the number of ranges. So the lines never probe the same range at the same time and a range is probed on the other line only several steps later.
+	const unsigned char rangeOnLine0=discoveryStep%numOfClientIdRanges;
+	const unsigned char rangeOnLine1=(discoveryStep+numOfClientIdRanges/2)%numOfClientIdRanges;
+	const unsigned char startIdOnLine0=firstClientId+0x10*rangeOnLine0;
+	const unsigned char startIdOnLine1=firstClientId+0x10*rangeOnLine1;
+	LineOfClientIdRange[rangeOnLine0]=0;
+	LineOfClientIdRange[rangeOnLine1]=1;
+	
+	DiscoveryData.clear();
+	auto appendMessage=[this](const BfbMessage& message){
+		auto rawData=message.GetRawData();
+		DiscoveryData.insert(DiscoveryData.end(), rawData.begin(), rawData.end());
+	};
+	appendMessage(createBusMasterConfigurationMessage(0,startIdOnLine0));
+	appendMessage(createBusMasterConfigurationMessage(1,startIdOnLine1));
+	BfbMessage identificationRequest = createIdentificationRequestMessageForId(0x00);
+	for(unsigned int repetition=0;repetition<discoveryRepetitions;repetition++){
+		for(unsigned char offset=0;offset<0x10;offset++){
+			identificationRequest.SetDestination(startIdOnLine0+offset);
+			appendMessage(identificationRequest);
+			identificationRequest.SetDestination(startIdOnLine1+offset);
+			appendMessage(identificationRequest);
+		};
+	};
+	boost::asio::async_write(SerialPort, boost::asio::buffer(DiscoveryData.data(), DiscoveryData.size()),
+		boost::bind(&SerialConnection::HandleWrittenDiscoveryRequests, this, boost::asio::placeholders::error));
+}
+
+void SerialConnection::HandleWrittenDiscoveryRequests(const boost::system::error_code& error){
+	if(error){
+		CloseConnection();
+		InitialisationMutex->unlock(); // The initalisation has been completed prematurely.
+		return;
+	};
+	NumOfDiscoveryRepliesAtLastCheck=NumOfDiscoveryReplies;
+	DiscoveryStepDeadline=boost::posix_time::microsec_clock::local_time()+maxDiscoveryStepDuration;
+	InitialisationTimer.expires_from_now(discoveryQuietPeriod);
+	InitialisationTimer.async_wait(boost::bind(&SerialConnection::HandleExpiredInitialisationTimer, this, boost::asio::placeholders::error));
+}
+
+void SerialConnection::FinishDiscovery(){
+	//Sort the client lists
+	ClientsOnLine0.sort();
+	ClientsOnLine0.unique();
+	ClientsOnLine1.sort();
+	ClientsOnLine1.unique();
+	
+	if(ClientsOnLine0.size()>0 && ClientsOnLine1.size()>0 && !(ClientsOnLine0.back()<ClientsOnLine1.front() || ClientsOnLine1.back()<ClientsOnLine0.front())){
+		std::cout<<"The client ID ranges for the two lines of the bus master connected to port "<< SerialPortName <<"  are intersecting. The bus master will be shut down."<<std::endl;
+		CloseConnection();
+		InitialisationMutex->unlock();
+		return;
+	}
+	
+	//Configure the bus master in order to forward the messages to the correct lines
+	if(ClientsOnLine0.size()>0){
+		ConfigStartIdOnLine0=(ClientsOnLine0.front()/16)*16;
+	}else{
+		ConfigStartIdOnLine0=line0DeactivationStartId;
+	}
+	if(ClientsOnLine1.size()>0){
+		ConfigStartIdOnLine1=(ClientsOnLine1.front()/16)*16;
+	}else{
+		ConfigStartIdOnLine1=line1DeactivationStartId;
+	}
+	UpdateQueueOfId();
+	WriteBusMasterConfiguration();
+	
+	InitialisationState=InitialisationComplete; // Now, the initalisation is complete.
+	InitialisationMutex->unlock();
+}
+
+void SerialConnection::UpdateQueueOfId(){
+	QueueOfId.fill(otherMessagesQueue);
+	for(auto it=ClientsOnLine0.begin(); it!=ClientsOnLine0.end(); it++){
+		QueueOfId[*it]=0;
+	};
+	for(auto it=ClientsOnLine1.begin(); it!=ClientsOnLine1.end(); it++){
+		QueueOfId[*it]=1;
+	};
+	for(auto it=IdsWithMessages.begin(); it!=IdsWithMessages.end(); it++){
+		it->clear();
+	};
+	for(unsigned int id=0; id<MessagesOfId.size(); id++){
+		if(!MessagesOfId[id].empty()){
+			IdsWithMessages[QueueOfId[id]].push_back(id);
+		};
+	};
+}
+
+void SerialConnection::WriteBusMasterConfiguration(){
+	std::vector<unsigned char> busMasterConfigurationRawData=createBusMasterConfigurationMessage(0,ConfigStartIdOnLine0).GetRawData();
+	boost::asio::write(SerialPort, boost::asio::buffer(busMasterConfigurationRawData, busMasterConfigurationRawData.size()));
+	busMasterConfigurationRawData=createBusMasterConfigurationMessage(1,ConfigStartIdOnLine1).GetRawData();
+	boost::asio::write(SerialPort, boost::asio::buffer(busMasterConfigurationRawData, busMasterConfigurationRawData.size()));
+}
+
+void SerialConnection::StartTopologyVerification(){
+	std::set<unsigned char> clients(ClientsOnLine0.begin(), ClientsOnLine0.end());
+	clients.insert(ClientsOnLine1.begin(), ClientsOnLine1.end());
+	IsTopologyBeingVerified=true;
+	UnverifiedClients=clients;
+	UnexpectedClients.clear();
+	for(auto it=clients.begin(); it!=clients.end(); it++){
+		QueueMessage(boost::make_shared<const BfbMessage>(createIdentificationRequestMessageForId(*it)));
+	};
+	// The unused IDs of the forwarded ranges are probed in the idle slots. The probes are not resent, so they do not delay the known clients.
+	for(unsigned char configStartId : {ConfigStartIdOnLine0, ConfigStartIdOnLine1}){
+		if(configStartId<firstClientId || configStartId>=line0DeactivationStartId){
+			continue;
+		};
+		for(unsigned int id=configStartId; id<configStartId+0x10u; id++){
+			if(QueueOfId[id]==otherMessagesQueue){
+				ProbesToBeSent.push_back(id);
+			};
+		};
+	};
+	if(!IsSendPending){
+		SendNextMessage();
+	};
+	VerificationTimer.expires_from_now(topologyVerificationPeriod);
+	VerificationTimer.async_wait(boost::bind(&SerialConnection::HandleExpiredVerificationTimer, this, boost::asio::placeholders::error));
+}
+
+void SerialConnection::HandleExpiredVerificationTimer(const boost::system::error_code& error){
+	if(error){
+		return;
+	};
+	IsTopologyBeingVerified=false;
+	if(!UnverifiedClients.empty() || !UnexpectedClients.empty()){
+		std::cout<<"The cached topology of the bus master connected to port "<< SerialPortName <<" is outdated."<<std::endl;
+		if(!UnverifiedClients.empty()){
+			std::cout<<"The following clients did not reply:"<<std::endl;
+			for(auto it=UnverifiedClients.begin(); it!=UnverifiedClients.end(); it++){
+				std::cout<<std::dec<<std::right<<std::setw(4)<<int(*it)<<"( "<<std::hex<< std::showbase<<int(*it)<<" ), "<<std::endl;
+			};
+		};
+		if(!UnexpectedClients.empty()){
+			std::cout<<"The following clients replied but are not part of the cached topology:"<<std::endl;
+			for(auto it=UnexpectedClients.begin(); it!=UnexpectedClients.end(); it++){
+				std::cout<<std::dec<<std::right<<std::setw(4)<<int(*it)<<"( "<<std::hex<< std::showbase<<int(*it)<<" ), "<<std::endl;
+			};
+		};
+		std::cout<<std::dec;
+		// The routing is corrected right away. The hot plug detection may already have removed or added some of the clients.
+		for(auto it=UnverifiedClients.begin(); it!=UnverifiedClients.end(); it++){
+			if(QueueOfId[*it]!=otherMessagesQueue){
+				RemoveClient(*it);
+			};
+		};
+		for(auto it=UnexpectedClients.begin(); it!=UnexpectedClients.end(); it++){
+			if(QueueOfId[*it]==otherMessagesQueue){
+				if((*it & 0xF0)==ConfigStartIdOnLine0){
+					AddClient(*it, 0);
+				}else if((*it & 0xF0)==ConfigStartIdOnLine1){
+					AddClient(*it, 1);
+				};
+			};
+		};
+		UnverifiedClients.clear();
+		UnexpectedClients.clear();
+		if(TopologyMismatchFunction){
+			TopologyMismatchFunction(GetTopology());
+		};
+	};
+}
+
 void SerialConnection::TryToReceiveMessages(){
-	IncomingData.resize(8);
-	boost::asio::async_read(SerialPort, boost::asio::buffer(IncomingData, 8),
-		boost::bind(&SerialConnection::HandleReceivedShortMessageOrLongHeader, this,
+	SerialPort.async_read_some(IncomingData.FreeRegions(),
+		boost::bind(&SerialConnection::HandleReceivedData, this,
 			boost::asio::placeholders::error,
 			boost::asio::placeholders::bytes_transferred));
 }
@@ -497,42 +1424,118 @@ void SerialConnection::TryToReceiveMessages(){
 
 void SerialConnection::HandleExpiredResendTimer(const boost::system::error_code& error)
 {
-	if(!error){
-		boost::lock_guard<boost::recursive_mutex> lock(*ExclusiveAccessMutex); 
-		while(UnansweredRequests.size()>=1){
-			boost::posix_time::time_duration deltaT= (boost::posix_time::microsec_clock::local_time()-UnansweredRequests.front()->TimeOfLastTransmission);
-			if( deltaT.total_microseconds() > (TimeToWaitForResponse.total_microseconds()-10) ){
-				SendMessage(UnansweredRequests.front());
-				UnansweredRequests.pop_front();
-			}else{
-				break;
+	if(error){ // The timer was cancelled or set to an earlier time.
+		return;
+	};
+	IsResendTimerActive=false;
+	std::vector<ResendTimingWheel::Entry> expiredEntries;
+	ResendDeadlines.Advance(std::chrono::steady_clock::now(), expiredEntries);
+	for(auto it=expiredEntries.begin(); it!=expiredEntries.end(); it++){
+		// Deadlines of requests that were answered or have been resent in the meantime are outdated.
+		if(it->Request->IsAwaitingReply && it->Request->NumOfTransmissions==it->Transmission){
+			if(it->Request->ExtendedDeadline>std::chrono::steady_clock::now()){ // The reply is being received.
+				ResendDeadlines.Insert(it->Request, it->Request->ExtendedDeadline);
+				continue;
+			};
+			RemoveUnansweredRequest(it->Request);
+			RecordUnansweredTransmission(*(it->Request));
+			if(it->Request->NumOfTransmissions>=NumOfTransmissionAttempts && QueueOfId[it->Request->GetDestination()]!=otherMessagesQueue){ // The client may have been plugged out.
+				UnresponsiveClients.set(it->Request->GetDestination());
+			};
+			if(it->Request->NumOfTransmissions<NumOfTransmissionAttempts){
+				for(auto fragment=it->Request->PrecedingFragments.begin(); fragment!=it->Request->PrecedingFragments.end(); fragment++){ // The client discarded the whole transfer if a fragment was lost.
+					QueueMessage(*fragment);
+				};
+				QueueMessage(it->Request);
 			};
+			ReleaseOutstandingRequest(*(it->Request));
 		};
-		if(!UnansweredRequests.empty()){
-			boost::posix_time::time_duration deltaT= (boost::posix_time::microsec_clock::local_time()-UnansweredRequests.front()->TimeOfLastTransmission);
-			ResendTimer.expires_from_now( TimeToWaitForResponse-deltaT );
-			ResendTimer.async_wait(boost::bind(&SerialConnection::HandleExpiredResendTimer, this, boost::asio::placeholders::error));
-			IsResendTimerActive=true;
-		}else{
-			IsResendTimerActive=false;
+	};
+	ScheduleResendTimer();
+}
+
+void SerialConnection::ScheduleResendTimer(){
+	if(ResendDeadlines.IsEmpty()){
+		return;
+	};
+	std::chrono::steady_clock::time_point nextDueTime=ResendDeadlines.NextDueTime();
+	if(!IsResendTimerActive || nextDueTime<ResendTimerExpiry){
+		ResendTimerExpiry=nextDueTime;
+		ResendTimer.expires_at(nextDueTime);
+		ResendTimer.async_wait(boost::bind(&SerialConnection::HandleExpiredResendTimer, this, boost::asio::placeholders::error));
+		IsResendTimerActive=true;
+	};
+}
+
+void SerialConnection::RemoveUnansweredRequest(boost::shared_ptr<const ExtendedBfbMessage> request){
+	request->IsAwaitingReply=false;
+	auto requests=UnansweredRequests.find(expectedReplyKey(*request));
+	if(requests==UnansweredRequests.end()){
+		return;
+	};
+	for(auto it=requests->second.begin(); it!=requests->second.end(); it++){
+		if(*it==request){
+			requests->second.erase(it);
+			break;
 		};
 	};
-	IsResendTimerActive=false;
+	if(requests->second.empty()){
+		UnansweredRequests.erase(requests);
+	};
 }
 
 void SerialConnection::HandleReceivedMessage(boost::shared_ptr<BfbMessage> incomingMessage){
 	switch(InitialisationState){
 		case InitialisationComplete:
 		{
-			boost::lock_guard<boost::recursive_mutex> lock(*ExclusiveAccessMutex); 
+			if(BfbFunctions::isFragment(*incomingMessage)){ // Large replies are processed after their last fragment has been received.
+				std::vector<unsigned char> payload=incomingMessage->GetPayload();
+				auto requests=UnansweredRequests.find(unansweredRequestKey(incomingMessage->GetSource(), payload[BfbConstants::fragmentOriginalProtocolPos], payload[BfbConstants::fragmentOriginalCommandPos]));
+				if(requests!=UnansweredRequests.end()){ // Do not resend the request while its reply is still arriving.
+					(*findAnsweredRequest(requests->second, *incomingMessage))->ExtendedDeadline=std::chrono::steady_clock::now()+2*TimeToWaitForResponse; // A full fragment occupies the line for almost the response time.
+				};
+				incomingMessage=IncomingFragments.AddFragment(*incomingMessage);
+				if(!incomingMessage){
+					break;
+				};
+			};
 			if(incomingMessage->GetSource()>=0x10 && incomingMessage->GetSource()<line0DeactivationStartId){
-				IncomingMessageCallbackFunction(incomingMessage);	
-				for(auto it=UnansweredRequests.begin();it!=UnansweredRequests.end();it++){
-					if((*it)->GetDestination()==incomingMessage->GetSource() && (*it)->GetProtocol()==incomingMessage->GetProtocol() && (*it)->GetCommand()+1==incomingMessage->GetCommand()){
-						UnansweredRequests.erase(it);
-						break;
+				unsigned char source=incomingMessage->GetSource();
+				TimeOfLastMessageOfId[source]=std::chrono::steady_clock::now();
+				NumOfMissedProbesOfId[source]=0;
+				UnresponsiveClients.reset(source);
+				bool isIdentificationReplyToServer=(incomingMessage->GetDestination()==2 && incomingMessage->GetProtocol()==1 && incomingMessage->GetCommand()==1);
+				if(isIdentificationReplyToServer && IsTopologyBeingVerified && QueueOfId[source]==otherMessagesQueue){ // The client is not part of the cached topology. This is checked before the hot plug detection adds it.
+					UnexpectedClients.insert(source);
+				};
+				if(isIdentificationReplyToServer && TopologyChangeFunction){
+					UnansweredProbes.reset(source);
+					if(QueueOfId[source]==otherMessagesQueue){ // A client has been plugged in. It belongs to the line that forwards its ID range.
+						if((source & 0xF0)==ConfigStartIdOnLine0){
+							AddClient(source, 0);
+						}else if((source & 0xF0)==ConfigStartIdOnLine1){
+							AddClient(source, 1);
+						};
 					};
-				}
+				};
+				// The replies to the verification requests of a cached topology and to the probes are consumed here since no TCP client requested them.
+				if(isIdentificationReplyToServer && (IsTopologyBeingVerified || TopologyChangeFunction)){
+					UnverifiedClients.erase(source);
+				}else{
+					IncomingMessageCallbackFunction(incomingMessage);	
+				};
+				auto requests=UnansweredRequests.find(unansweredRequestKey(incomingMessage->GetSource(), incomingMessage->GetProtocol(), incomingMessage->GetCommand()));
+				if(requests!=UnansweredRequests.end()){
+					auto answeredRequest=findAnsweredRequest(requests->second, *incomingMessage);
+					boost::shared_ptr<const ExtendedBfbMessage> request=*answeredRequest;
+					request->IsAwaitingReply=false;
+					Latencies.RecordReply(incomingMessage->GetSource(), incomingMessage->GetProtocol(), incomingMessage->GetCommand()-1, std::chrono::steady_clock::now()-request->TimeOfLastTransmission);
+					requests->second.erase(answeredRequest);
+					if(requests->second.empty()){
+						UnansweredRequests.erase(requests);
+					};
+					ReleaseOutstandingRequest(*request);
+				};
 			};
 		};
 		break;
@@ -542,83 +1545,188 @@ void SerialConnection::HandleReceivedMessage(boost::shared_ptr<BfbMessage> incom
 				InitialisationTimer.cancel();
 			};
 		break;
-		case WaitingForBusClientIdentificationReplyOnLine0:
-			if(incomingMessage->GetSource()!=1){
-				ClientsOnLine0.push_back(incomingMessage->GetSource());
-			};
-		break;
-		case WaitingForBusClientIdentificationReplyOnLine1:
-			if(incomingMessage->GetSource()!=1){
-				ClientsOnLine1.push_back(incomingMessage->GetSource());
+		case WaitingForBusClientIdentificationReply:
+			if(incomingMessage->GetSource()>=firstClientId && incomingMessage->GetSource()<line0DeactivationStartId){
+				// The reply belongs to the line the ID range of the client was forwarded to.
+				if(LineOfClientIdRange[(incomingMessage->GetSource()-firstClientId)/0x10]==0){
+					ClientsOnLine0.push_back(incomingMessage->GetSource());
+				}else{
+					ClientsOnLine1.push_back(incomingMessage->GetSource());
+				};
+				NumOfDiscoveryReplies++;
 			};
 		break;
 	};
 }
 
 
-void SerialConnection::HandleReceivedShortMessageOrLongHeader(const boost::system::error_code& error, size_t bytesTransferred){
-	//std::cout<<"Received data:"<<std::endl;
+void SerialConnection::HandleReceivedData(const boost::system::error_code& error, size_t bytesTransferred){
 	if (error){
 		CloseConnection();
 		return;
 	}
-	
-	if(BfbFunctions::isValidShortPacket(IncomingData)){//Short packet
-		boost::shared_ptr<BfbMessage> incomingMessage(new BfbMessage(IncomingData));
-		HandleReceivedMessage(incomingMessage);
-		TryToReceiveMessages();
-	}else if(BfbFunctions::isValidLongPacketHeader(IncomingData)){//Long packet
-		unsigned int missingNumOfBytes=BfbFunctions::numOfMissingBytes(IncomingData);
-
-		IncomingData.resize(missingNumOfBytes+bytesTransferred,0);
-		boost::asio::async_read(SerialPort, boost::asio::buffer(IncomingData.data()+bytesTransferred, missingNumOfBytes),
-			boost::bind(&SerialConnection::HandleReceivedLongMessage, this,
-				boost::asio::placeholders::error,
-				boost::asio::placeholders::bytes_transferred));
-		return;
-	}else{
-		//resynchronize
-	};
+	IncomingData.Commit(bytesTransferred);
+	ExtractReceivedMessages();
+	TryToReceiveMessages();
+}
 
+bool SerialConnection::IsValidHeaderAt(size_t offset){
+	IncomingData.Peek(offset, 8, IncomingMessageData);
+	return BfbFunctions::isValidShortPacket(IncomingMessageData) || BfbFunctions::isValidLongPacketHeader(IncomingMessageData);
 }
 
-void SerialConnection::HandleReceivedLongMessage(const boost::system::error_code& error,
-    size_t bytes_transferred){
-	if (error){
-		CloseConnection();
-		return;
+void SerialConnection::ExtractReceivedMessages(){
+	while(IncomingData.Size()>=8){
+		IncomingData.Peek(0, 8, IncomingMessageData);
+		size_t messageLength=0;
+		if(BfbFunctions::isValidShortPacket(IncomingMessageData)){
+			messageLength=8;
+		}else if(BfbFunctions::isValidLongPacketHeader(IncomingMessageData)){
+			messageLength=8+BfbFunctions::numOfMissingBytes(IncomingMessageData);
+		};
+		if(messageLength>0 && IncomingData.Size()<messageLength){ // Wait for the rest of the message.
+			return;
+		};
+		if(messageLength>0 && !IsSynchronised && IncomingData.Size()!=messageLength){ // Confirm the candidate by the header of the following message.
+			if(IncomingData.Size()<messageLength+8){
+				return;
+			};
+			if(!IsValidHeaderAt(messageLength)){
+				messageLength=0;
+			};
+		};
+		if(messageLength>8){
+			IncomingData.Peek(0, messageLength, IncomingMessageData);
+			if(!BfbFunctions::isValidLongPacket(IncomingMessageData)){ // The header was valid by chance or the payload is corrupted.
+				messageLength=0;
+			};
+		}else if(messageLength==8){
+			IncomingData.Peek(0, 8, IncomingMessageData);
+		};
+		if(messageLength==0){ // Skip one byte and search for the next valid header.
+			if(IsSynchronised){
+				IsSynchronised=false;
+				NumOfResynchronisations++;
+			};
+			NumOfDroppedBytes++;
+			IncomingData.Drop(1);
+			continue;
+		};
+		IsSynchronised=true;
+		IncomingData.Drop(messageLength);
+		HandleReceivedMessage(boost::make_shared<BfbMessage>(IncomingMessageData));
+	};
+}
+
+void SerialConnection::SendMessage(boost::shared_ptr<const BfbMessage> message){
+	{
+		boost::lock_guard<boost::mutex> lock(SendMessageMutex);
+		while(!MessagesFromOtherThreads.push(message)){ // The I/O thread is a whole queue behind. It is woken up below at the latest.
+			if(!IsActive){
+				return;
+			};
+			if(!IsQueueingOfMessagesScheduled.exchange(true)){
+				IoService->post(boost::bind(&SerialConnection::QueueMessagesFromOtherThreads, this));
+			};
+			boost::this_thread::yield();
+		};
 	}
+	if(!IsQueueingOfMessagesScheduled.exchange(true)){ // Wake up the I/O thread only once for all messages handed over until it starts to process them.
+		IoService->post(boost::bind(&SerialConnection::QueueMessagesFromOtherThreads, this));
+	};
+};
 
-	if( BfbFunctions::isValidLongPacket(IncomingData) ){//Long packet
-		boost::shared_ptr<BfbMessage> incomingMessage(new BfbMessage(IncomingData));
-		HandleReceivedMessage(incomingMessage);
+void SerialConnection::QueueMessagesFromOtherThreads(){
+	IsQueueingOfMessagesScheduled=false; // Reset the flag before the queue is emptied. Otherwise, a message pushed in between might not be processed.
+	boost::shared_ptr<const BfbMessage> message;
+	while(MessagesFromOtherThreads.pop(message)){
+		QueueMessage(message);
+	};
+}
+
+void SerialConnection::QueueMessage(boost::shared_ptr<const BfbMessage> message){
+	if(!IsActive){
+		return;
+	};
+	std::deque<boost::shared_ptr<const BfbMessage>>& queue=MessagesOfId[message->GetDestination()];
+	bool wasQueueEmpty=queue.empty();
+	size_t payloadSize=message->GetPayload().size();
+	if(payloadSize<=BfbConstants::maxLongPayloadLength){
+		queue.push_back(message);
+	}else if(payloadSize<=BfbConstants::maxFragmentedPayloadLength){ // The bus master only transmits long packets. Larger payloads are sent as fragments.
+		auto fragments=BfbFunctions::splitIntoFragments(*message, NextFragmentTransferId++);
+		auto lastFragment=boost::make_shared<ExtendedBfbMessage>(*fragments.back());
+		lastFragment->PrecedingFragments.assign(fragments.begin(), fragments.end()-1);
+		queue.insert(queue.end(), lastFragment->PrecedingFragments.begin(), lastFragment->PrecedingFragments.end());
+		queue.push_back(lastFragment);
 	}else{
-		//resynchronize
+		return;
 	};
-	TryToReceiveMessages();
+	if(wasQueueEmpty){
+		IdsWithMessages[QueueOfId[message->GetDestination()]].push_back(message->GetDestination());
+	};
+	if(!IsSendPending){
+		SendNextMessage();
+	};
+};
 
+bool SerialConnection::IsRequestExpectingReply(const BfbMessage& message) const{
+	bool isBusMasterConfiguration=(message.GetDestination()==1 && message.GetProtocol()==1 && (message.GetCommand()==0x80 || message.GetCommand()==0x82)); // The bus master does not answer its configuration. Its other requests (e.g. the identification) are answered.
+	return InitialisationState==InitialisationComplete && message.GetBusAllocation() && message.GetProtocol()!=0x09 && !isBusMasterConfiguration;
 }
 
-void SerialConnection::SendMessage(boost::shared_ptr<const BfbMessage> message){
-	boost::lock_guard<boost::recursive_mutex> lock(*ExclusiveAccessMutex); 
-	if(IsActive){
-		MessagesToBeSend.push(message);
-		if(!IsSendPending){
-			SendNextMessage();
-		};
+void SerialConnection::ReleaseOutstandingRequest(const BfbMessage& request){
+	unsigned int queue=QueueOfId[request.GetDestination()];
+	if(NumOfOutstandingRequests[queue]>0){
+		NumOfOutstandingRequests[queue]--;
 	};
-};
+	if(NumOfOutstandingRequestsOfId[request.GetDestination()]>0){
+		NumOfOutstandingRequestsOfId[request.GetDestination()]--;
+	};
+	if(!IsSendPending){
+		SendNextMessage();
+	};
+}
 
-void SerialConnection::SendNextMessage(){//Don't call this function without having locked the ConnectionMutex before. 
-	boost::lock_guard<boost::recursive_mutex> lock(*ExclusiveAccessMutex); 
+void SerialConnection::SendNextMessage(){// This must only be called from the I/O thread.
 	boost::shared_ptr<const BfbMessage> tempMessage;
-	while(!MessagesToBeSend.empty()){
-		tempMessage=MessagesToBeSend.front();
-		MessagesToBeSend.pop();
-		if(tempMessage->GetPayload().size()<=151){
-			break;
-		}
-	}
+	unsigned int maxOutstandingRequestsOfLine=std::max(maxOutstandingRequestsPerLine, ClientWindow);
+	// Serve the lines in turns, starting with the one after the line served last. Within a line, the clients are served in turns as well. Only the first message of each client is inspected.
+	for(unsigned int i=1;i<=IdsWithMessages.size() && !tempMessage;i++){
+		unsigned int queue=(LastServedQueue+i)%IdsWithMessages.size();
+		std::deque<unsigned char>& ids=IdsWithMessages[queue];
+		for(size_t j=0;j<ids.size() && !tempMessage;j++){
+			unsigned char id=ids.front();
+			ids.pop_front();
+			std::deque<boost::shared_ptr<const BfbMessage>>& messages=MessagesOfId[id];
+			if(queue!=otherMessagesQueue && IsRequestExpectingReply(*messages.front()) && (NumOfOutstandingRequests[queue]>=maxOutstandingRequestsOfLine || NumOfOutstandingRequestsOfId[id]>=ClientWindow)){
+				ids.push_back(id); // The line or the client is busy. The request would only wait in the bus master while its resend deadline is running.
+				continue;
+			};
+			tempMessage=messages.front();
+			messages.pop_front();
+			if(tempMessage==UnsentSetpointOfId[id]){
+				UnsentSetpointOfId[id].reset();
+			};
+			if(!messages.empty()){
+				ids.push_back(id);
+			};
+			LastServedQueue=queue;
+		};
+	};
+	if(!tempMessage && !ProbesToBeSent.empty()){ // The slot is idle, so it is used for the hot plug detection.
+		unsigned char probedId=ProbesToBeSent.front();
+		ProbesToBeSent.pop_front();
+		OutgoingData=createIdentificationRequestMessageForId(probedId).GetRawData();
+		IsSendPending=true;
+		boost::asio::async_write(SerialPort, boost::asio::buffer(OutgoingData.data(), OutgoingData.size()),
+			boost::bind(&SerialConnection::HandleSentProbe, this, probedId, boost::asio::placeholders::error));
+		return;
+	};
+	if(!tempMessage){
+		IsSendPending=false;
+		return;
+	};
 	OutgoingData=tempMessage->GetRawData();
 	IsSendPending=true;
 	boost::asio::async_write(SerialPort, boost::asio::buffer(OutgoingData.data(), OutgoingData.size()),
@@ -627,35 +1735,221 @@ void SerialConnection::SendNextMessage(){//Don't call this function without havi
 };
 
 void SerialConnection::HandleSentMessage(boost::shared_ptr<const BfbMessage> message, const boost::system::error_code& error){
-	boost::lock_guard<boost::recursive_mutex> lock(*ExclusiveAccessMutex); 
 	if (error){
 		CloseConnection();
 		return;
 	}
 	boost::shared_ptr<const ExtendedBfbMessage> extMessage= boost::dynamic_pointer_cast<const ExtendedBfbMessage>(message);
-	if(InitialisationState==InitialisationComplete && message->GetBusAllocation() && message->GetProtocol()!=0x09){
+	if(IsRequestExpectingReply(*message)){
 		if(extMessage==nullptr ){
 			extMessage=boost::make_shared<ExtendedBfbMessage>(*message);
 		};
 		extMessage->NumOfTransmissions+=1;
-		extMessage->TimeOfLastTransmission=boost::posix_time::microsec_clock::local_time();
-		if(extMessage->NumOfTransmissions<NumOfTransmissionAttempts){
-			//if(extMessage->NumberOfTransmissions>=3){
-			//	std::cout<<"Sent message "<<std::dec<<int(extMessage->NumberOfTransmissions)<< " times"<<std::endl;
-			//};
-			UnansweredRequests.push_back(extMessage);
-			//std::cout<<"UnansweredRequests has a size of "<<std::dec<< int(UnansweredRequests.size()) << std::endl;
-			if(UnansweredRequests.size()==1){
-				boost::posix_time::time_duration deltaT= (boost::posix_time::microsec_clock::local_time()-UnansweredRequests.front()->TimeOfLastTransmission);
-				ResendTimer.expires_from_now( TimeToWaitForResponse-deltaT );
-				ResendTimer.async_wait(boost::bind(&SerialConnection::HandleExpiredResendTimer, this, boost::asio::placeholders::error));
-				IsResendTimerActive=true;
+		extMessage->TimeOfLastTransmission=std::chrono::steady_clock::now();
+		//if(extMessage->NumberOfTransmissions>=3){
+		//	std::cout<<"Sent message "<<std::dec<<int(extMessage->NumberOfTransmissions)<< " times"<<std::endl;
+		//};
+		// The last transmission is registered as well. It won't be resent, but its line stays occupied until the reply arrived or the deadline expired.
+		UnansweredRequests[expectedReplyKey(*extMessage)].push_back(extMessage);
+		extMessage->IsAwaitingReply=true;
+		NumOfOutstandingRequests[QueueOfId[extMessage->GetDestination()]]++;
+		NumOfOutstandingRequestsOfId[extMessage->GetDestination()]++;
+		// The bus master forwards the fragments of a large message one after another, so the reply to the last one takes longer by the transmission time of the preceding ones.
+		ResendDeadlines.Insert(extMessage, std::chrono::steady_clock::now()+TimeToWaitForResponse*(1+extMessage->PrecedingFragments.size()));
+		ScheduleResendTimer();
+	}
+	SendNextMessage();
+}
+
+void SerialConnection::HandleSentProbe(unsigned char clientId, const boost::system::error_code& error){
+	if(error){
+		CloseConnection();
+		return;
+	};
+	SentProbes.push_back(std::make_pair(clientId, std::chrono::steady_clock::now()));
+	UnansweredProbes.set(clientId);
+	SendNextMessage();
+}
+
+void SerialConnection::StartHotPlugDetection(std::function<void (const BusTopology&)> topologyChangeFunction){
+	IoService->post([this, topologyChangeFunction](){
+		if(!IsActive || InitialisationState!=InitialisationComplete || TopologyChangeFunction){
+			return;
+		};
+		TopologyChangeFunction=topologyChangeFunction;
+		NextProbedId[0]=(ClientsOnLine0.empty() ? firstClientId : ConfigStartIdOnLine0);
+		NextProbedId[1]=(ClientsOnLine1.empty() ? firstClientId : ConfigStartIdOnLine1);
+		ProbeTimer.expires_from_now(hotPlugProbePeriod);
+		ProbeTimer.async_wait(boost::bind(&SerialConnection::HandleExpiredProbeTimer, this, boost::asio::placeholders::error));
+	});
+}
+
+void SerialConnection::HandleExpiredProbeTimer(const boost::system::error_code& error){
+	if(error || !IsActive){
+		return;
+	};
+	std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now();
+	while(!SentProbes.empty() && now-SentProbes.front().second>=probeReplyTimeout){
+		unsigned char probedId=SentProbes.front().first;
+		SentProbes.pop_front();
+		if(!UnansweredProbes.test(probedId)){
+			continue;
+		};
+		UnansweredProbes.reset(probedId);
+		if(QueueOfId[probedId]!=otherMessagesQueue && ++NumOfMissedProbesOfId[probedId]>=missedProbesForRemoval){
+			RemoveClient(probedId);
+		};
+	};
+	if(ProbesToBeSent.empty()){ // Otherwise, there was no idle slot in the last period. No further probes are queued until the pending ones have been sent.
+		QueueProbesOfLine(0);
+		QueueProbesOfLine(1);
+		if(!IsSendPending){
+			SendNextMessage();
+		};
+	};
+	ProbeTimer.expires_at(ProbeTimer.expiry()+hotPlugProbePeriod);
+	ProbeTimer.async_wait(boost::bind(&SerialConnection::HandleExpiredProbeTimer, this, boost::asio::placeholders::error));
+}
+
+void SerialConnection::QueueProbesOfLine(unsigned int line){
+	std::list<unsigned char>& clients=(line==0 ? ClientsOnLine0 : ClientsOnLine1);
+	unsigned char& configStartId=(line==0 ? ConfigStartIdOnLine0 : ConfigStartIdOnLine1);
+	unsigned char otherConfigStartId=(line==0 ? ConfigStartIdOnLine1 : ConfigStartIdOnLine0);
+	unsigned char& nextProbedId=NextProbedId[line];
+	if(!clients.empty()){ // Probe the range of the line. Known clients are only probed if they might have been plugged out.
+		std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now();
+		unsigned int numOfProbes=0;
+		for(unsigned int i=0; i<0x10 && numOfProbes<numOfProbesPerPeriod; i++){
+			unsigned char probedId=configStartId+(nextProbedId & 0x0F);
+			nextProbedId=configStartId+((nextProbedId+1) & 0x0F);
+			if(QueueOfId[probedId]!=otherMessagesQueue && !UnresponsiveClients.test(probedId) && now-TimeOfLastMessageOfId[probedId]<maxClientSilence){
+				continue;
 			};
+			ProbesToBeSent.push_back(probedId);
+			numOfProbes++;
 		};
-	}
-	if(MessagesToBeSend.empty()){
-		IsSendPending=false;
-	}else{
+		return;
+	};
+	// Probe all ranges one after another. The range of the other line is skipped, so both lines never forward the same IDs.
+	if(nextProbedId<firstClientId || nextProbedId>=line0DeactivationStartId){
+		nextProbedId=firstClientId;
+	};
+	if((nextProbedId & 0xF0)==otherConfigStartId){
+		nextProbedId=(nextProbedId & 0xF0)+0x10;
+		if(nextProbedId>=line0DeactivationStartId){
+			nextProbedId=firstClientId;
+		};
+	};
+	if((nextProbedId & 0xF0)!=configStartId){
+		configStartId=nextProbedId & 0xF0;
+		LineOfClientIdRange[(configStartId-firstClientId)/0x10]=line;
+		QueueMessage(boost::make_shared<const BfbMessage>(createBusMasterConfigurationMessage(line==1, configStartId)));
+	};
+	for(unsigned int i=0; i<numOfProbesPerPeriod; i++){
+		ProbesToBeSent.push_back(nextProbedId++);
+	};
+}
+
+void SerialConnection::PlayTrajectory(boost::shared_ptr<const Trajectory> trajectory, std::chrono::steady_clock::time_point startTime){
+	IoService->post([this, trajectory, startTime](){
+		Player.reset();
+		PlaybackTimer.cancel();
+		IsTrajectoryPlaying=false;
+		std::vector<size_t> driveIndices;
+		for(size_t i=0; i<trajectory->DriveIds.size(); i++){
+			if(QueueOfId[trajectory->DriveIds[i]]!=otherMessagesQueue){
+				driveIndices.push_back(i);
+			};
+		};
+		if(!IsActive || driveIndices.empty()){
+			return;
+		};
+		NumOfPlayedSetpoints=0;
+		NumOfSkippedSetpoints=0;
+		HasOutputQueueErrorBeenReported=false;
+		Player=boost::make_shared<TrajectoryPlayer>(trajectory, driveIndices, startTime);
+		IsTrajectoryPlaying=true;
+		PlaybackTimer.expires_at(startTime);
+		PlaybackTimer.async_wait(boost::bind(&SerialConnection::HandleExpiredPlaybackTimer, this, Player, boost::asio::placeholders::error));
+	});
+}
+
+TrajectoryStatus SerialConnection::GetTrajectoryStatus() const{
+	TrajectoryStatus status;
+	status.IsPlaying=IsTrajectoryPlaying;
+	status.NumOfSetpoints=NumOfPlayedSetpoints;
+	status.NumOfSkippedSetpoints=NumOfSkippedSetpoints;
+	return status;
+}
+
+void SerialConnection::HandleExpiredPlaybackTimer(boost::shared_ptr<TrajectoryPlayer> player, const boost::system::error_code& error){
+	if(error || !IsActive || player!=Player){
+		return;
+	};
+	const Trajectory& trajectory=*Player->GetTrajectory();
+	const std::vector<size_t>& driveIndices=Player->GetDriveIndices();
+	bool isPlaying=Player->Interpolate(PlaybackTimer.expiry(), Setpoints); // The setpoints belong to the nominal time, so a late wakeup does not distort the trajectory.
+	int numOfUnsentBytes=0;
+	bool isLineBusy=true;
+	if(ioctl(SerialPort.native_handle(), TIOCOUTQ, &numOfUnsentBytes)==0){ // The setpoints are not paced by replies, so the driver may still hold those of the previous periods.
+		isLineBusy=(static_cast<size_t>(numOfUnsentBytes)>=driveIndices.size()*BfbConstants::shortLength);
+	}else if(!HasOutputQueueErrorBeenReported){
+		std::cout<<"The unsent bytes of the serial port "<<SerialPortName<<" cannot be read ("<<strerror(errno)<<"). The setpoints of the trajectory are skipped."<<std::endl;
+		HasOutputQueueErrorBeenReported=true;
+	};
+	for(size_t i=0; i<driveIndices.size(); i++){
+		unsigned char driveId=trajectory.DriveIds[driveIndices[i]];
+		if(isLineBusy || UnsentSetpointOfId[driveId] || QueueOfId[driveId]==otherMessagesQueue){ // The drive may have been unplugged during the playback.
+			NumOfSkippedSetpoints++;
+			continue;
+		};
+		UnsentSetpointOfId[driveId]=boost::make_shared<const BfbMessage>(driveId, 2, false, false, trajectory.Protocol, trajectory.Command, BfbFunctions::convertDoubleToBytes(Setpoints[i], 16, true));
+		QueueMessage(UnsentSetpointOfId[driveId]);
+		NumOfPlayedSetpoints++;
+	};
+	if(!isPlaying){
+		Player.reset();
+		IsTrajectoryPlaying=false;
+		return;
+	};
+	std::chrono::steady_clock::time_point expiry=PlaybackTimer.expiry()+trajectory.Period;
+	std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now();
+	if(expiry<now){ // The thread has been stalled for more than a period. The missed setpoints are dropped instead of being sent in a burst.
+		auto numOfMissedPeriods=(now-expiry)/trajectory.Period+1;
+		expiry+=numOfMissedPeriods*trajectory.Period;
+		NumOfSkippedSetpoints+=numOfMissedPeriods*driveIndices.size();
+	};
+	PlaybackTimer.expires_at(expiry);
+	PlaybackTimer.async_wait(boost::bind(&SerialConnection::HandleExpiredPlaybackTimer, this, Player, boost::asio::placeholders::error));
+}
+
+void SerialConnection::AddClient(unsigned char clientId, unsigned int line){
+	std::list<unsigned char>& clients=(line==0 ? ClientsOnLine0 : ClientsOnLine1);
+	clients.push_back(clientId);
+	clients.sort();
+	UpdateQueueOfId();
+	std::cout<<"The client "<<std::dec<<int(clientId)<<" ( "<<std::hex<<std::showbase<<int(clientId)<<std::noshowbase<<std::dec<<" ) has been plugged in on line "<<line<<" of the bus master connected to port "<<SerialPortName<<"."<<std::endl;
+	if(TopologyChangeFunction){ // It is empty if the client has been found by the verification of a cached topology without hot plug detection.
+		TopologyChangeFunction(GetTopology());
+	};
+}
+
+void SerialConnection::RemoveClient(unsigned char clientId){
+	unsigned int queue=QueueOfId[clientId];
+	// The outstanding requests of the client will be released via the otherMessagesQueue. So they must not block its line any longer.
+	NumOfOutstandingRequests[queue]-=std::min(NumOfOutstandingRequests[queue], NumOfOutstandingRequestsOfId[clientId]);
+	ClientsOnLine0.remove(clientId);
+	ClientsOnLine1.remove(clientId);
+	MessagesOfId[clientId].clear();
+	UnsentSetpointOfId[clientId].reset();
+	NumOfMissedProbesOfId[clientId]=0;
+	UnresponsiveClients.reset(clientId);
+	UpdateQueueOfId();
+	std::cout<<"The client "<<std::dec<<int(clientId)<<" ( "<<std::hex<<std::showbase<<int(clientId)<<std::noshowbase<<std::dec<<" ) has been plugged out of line "<<queue<<" of the bus master connected to port "<<SerialPortName<<"."<<std::endl;
+	if(TopologyChangeFunction){
+		TopologyChangeFunction(GetTopology());
+	};
+	if(!IsSendPending){
 		SendNextMessage();
 	};
 }
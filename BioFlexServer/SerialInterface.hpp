@@ -3,9 +3,14 @@
 
 // STL includes
 #include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <list>
 #include <map>
 #include <queue>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 // Own header files
@@ -13,6 +18,7 @@
 #include <boost/asio/deadline_timer.hpp>
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
 #include <boost/signals2.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/mutex.hpp>
@@ -20,22 +26,38 @@
 
 // Own header files
 #include <BfbMessage.hpp>
+#include "LatencyStatistics.hpp"
+#include "TrajectoryPlayer.hpp"
 //#include "TcpInterface.hpp"
 
 //Forward declarations (The "real" declaration is in the 'CommunicationInterface.cpp' file.)
 class SerialConnection;
 //class SerialInterfaceKey;
 
+/** \brief The topology of the bus connected to one serial port. It is used to store the result of the client discovery in the topology cache file. */
+struct BusTopology{
+	std::string SerialPortName; /*!< Name of the serial port the bus master is connected to. */
+	unsigned char ConfigStartIdOnLine0=0; /*!< The start of the ID range the bus master forwards to line 0. */
+	unsigned char ConfigStartIdOnLine1=0; /*!< The start of the ID range the bus master forwards to line 1. */
+	std::list<unsigned char> ClientsOnLine0; /*!< The IDs of the clients connected to line 0. */
+	std::list<unsigned char> ClientsOnLine1; /*!< The IDs of the clients connected to line 1. */
+};
 
 
 class SerialInterface
 {
 	public:
-		/** \brief The constructor takes no arguments. It searches for all connected bus masters and creates connections to them. There's currently no way to let it search for a specific one or to exclude one from the search. */
-		SerialInterface();
+		/** \brief The constructor searches for all connected bus masters and creates connections to them. There's currently no way to let it search for a specific one or to exclude one from the search. 
+		 * \param topologyCacheFile If a file name is passed, the bus topology of the serial ports listed in this file is not discovered but read from the file. The cached topology is verified in the background. 
+		 * 	If it turned out to be outdated, the routing and the file are updated to the clients that actually replied. After the initialisation, the current topology is written to the file.
+		 * \param serialPortNames The serial ports that are searched for bus masters. If no port is passed, all ports matching /dev/ttyA* are used. This can be used to connect to the pseudo-terminal of the bus master emulator.
+		 */
+		SerialInterface(std::string topologyCacheFile="", std::vector<std::string> serialPortNames=std::vector<std::string>());
 		~SerialInterface();
 		
-		/** \brief Use this method in order to send a message to one of the connected serial clients. The destination ID of the client must be specified in the message. */
+		/** \brief Use this method in order to send a message to one of the connected serial clients. The destination ID of the client must be specified in the message. 
+		 * 	If an identical read request of another sender is still waiting for its reply, the message is not sent again. Instead, the reply is forwarded to both senders.
+		 */
 		void SendMessage(boost::shared_ptr<const BfbMessage> message);
 		
 		/** \brief This method can be used to route incoming messages to the passed function. The function must accept a shared_ptr to a BioFlexBus message. It is possible to call this method multiple times passing different functions. In this case, the incoming message will be distributed to all passed functions. */
@@ -47,25 +69,91 @@ class SerialInterface
 		std::list<unsigned char> GetConnectedClients(); 
 		std::list<std::string> GetSerialPortNames();
 		
+		/** \brief Start to detect clients that are plugged in or out during operation. Every bus master probes a few IDs per period in the slots in which no other message is sent, so the normal traffic is not paused. 
+		 * 	Clients that answer are added to the routing, known clients that miss several probes are removed. Afterwards, the topology cache file is updated and the functions passed to NotifyOfClientChanges are called.
+		 */
+		void StartHotPlugDetection();
+		/** \brief The passed function is called with the sorted list of all connected clients whenever a client has been plugged in or out. It is called from the thread that forwards the incoming messages. */
+		void NotifyOfClientChanges(std::function<void (std::list<unsigned char>)> notificationFunction);
+		
+		/** \brief Play the passed setpoint trajectory. Every serial port sends the setpoints of its own drives from its I/O thread, so the timing of the setpoints does not depend on the TCP clients. 
+		 * 	All ports start after the start delay of the trajectory. A running playback is replaced; a trajectory without drives stops it.
+		 * \return The number of drives of the trajectory that are connected.
+		 */
+		unsigned int PlayTrajectory(boost::shared_ptr<const Trajectory> trajectory);
+		/** \brief The state of the playback of all serial ports. */
+		TrajectoryStatus GetTrajectoryStatus();
+		
 		/** \brief This method returns a handle to the SendMessage-method of the instance. This makes it redundant to work with boost::bind in order to create a handle manually. */
 		boost::function<void (boost::shared_ptr<const BfbMessage>)> GetSendMessageHandle();
 		
 		void SetNumOfTransmissionAttempts(unsigned int numOfTransmissionAttempts);
+		/** \brief Set the number of requests per client that may wait for their replies. Clients that buffer several requests can be served at the speed of the line instead of one round trip per request. The requests of a client are always sent in the order they were passed to SendMessage. */
+		void SetClientWindow(unsigned int clientWindow);
+		
+		/** \brief Every serial port is served by its own I/O thread. This method sets the scheduling of these threads.
+		 * \param realTimePriority If it is larger than 0, the threads are scheduled with SCHED_FIFO and this priority.
+		 * \param firstCpu If it is not negative, the thread of the first serial port is pinned to this CPU, the thread of the second port to the next CPU and so on.
+		 * \return True if the scheduling could be set for all threads.
+		 */
+		bool SetSerialThreadScheduling(int realTimePriority, int firstCpu);
+		/** \brief Set the scheduling of the thread that forwards the incoming messages to the routes (see SetSerialThreadScheduling). */
+		bool SetForwardingThreadScheduling(int realTimePriority, int cpu);
+		/** \brief Set the low latency flag (ASYNC_LOW_LATENCY) of all serial ports. Without it, the drivers of some serial ports deliver received bytes only every few milliseconds.
+		 * \return True if the flag could be set for all ports.
+		 */
+		bool SetSerialLowLatency();
+		
+		/** \brief Print the number of received bytes each serial port dropped while it searched for valid messages and the round-trip statistics of all clients. */
+		void PrintStatistics();
+		/** \brief The round-trip latencies, retries and timeouts of the requests sent to the passed client, one summary per protocol and command. */
+		std::vector<LatencySummary> GetLatencySummaries(unsigned char clientId);
 	private:
 		SerialInterface(const SerialInterface&) = delete;
 		SerialInterface & operator=(const SerialInterface&) = delete;
 		
-		boost::shared_ptr<boost::asio::io_service> IoService=boost::make_shared<boost::asio::io_service>(); /*!< The service object managing all the asynchronous tasks */
+		boost::shared_ptr<boost::asio::io_service> IoService=boost::make_shared<boost::asio::io_service>(); /*!< The service object that forwards the incoming messages to the routes. The serial ports are served by the service objects of the serial connections. */
 		boost::asio::io_service::work Work; /*!< The worker keeps the IoService object busy. Without it, the IOService is sometimes runs out of work before the asynchronous receive operations are started and stops itself.*/
 		boost::thread IoServiceThread; /*!< Thread in which the IoService object runs it's run method. */
 		/*!< Signal used to distribute an incoming message. Multiple recipients may be connected to this signal using the "RouteIncomingMessagesTo" method. */
 		void ForwardIncomingMessage(boost::shared_ptr<const BfbMessage> message);
+		typedef boost::lockfree::spsc_queue<boost::shared_ptr<const BfbMessage>> MessageQueue; /*!< A queue between exactly one producing and one consuming thread. It stores the shared pointers themselves, so handing a message over does not allocate. */
+		/** \brief Hand an incoming message over from the I/O thread of a serial port to the forwarding thread. In this way, the serial threads never execute the routes (e.g. the TCP server).
+		 * \param queue The queue of the serial port. Only the I/O thread of this port pushes into it.
+		 */
+		void QueueIncomingMessage(MessageQueue* queue, boost::shared_ptr<const BfbMessage> message);
+		/** \brief Forward all queued incoming messages. This is executed in the forwarding thread. */
+		void ForwardQueuedIncomingMessages();
+		std::vector<boost::shared_ptr<MessageQueue>> IncomingMessages; /*!< The incoming messages of each serial port that have not been forwarded yet. The queues are created before the I/O threads are started and are not changed afterwards. */
+		std::atomic<bool> IsForwardingOfIncomingMessagesScheduled; /*!< True if ForwardQueuedIncomingMessages has been posted and has not started yet. */
 		std::list<boost::function<void (boost::shared_ptr<const BfbMessage>)>> InputMessagesRouteList={};
 
-		std::vector<boost::shared_ptr<SerialConnection>> SerialConnections; /*!< This vector is used to store the serial connections to all available serial ports.*/
+		/** \brief A read request that is on its way to the bus and the sources of the identical read requests that wait for the same reply. */
+		struct CoalescedRead{
+			unsigned char Requester; /*!< The source of the request that was sent to the bus. Its reply is addressed to this ID. */
+			std::vector<unsigned char> AdditionalRequesters; /*!< The sources of the identical requests that were not sent. They receive a copy of the reply. */
+			std::chrono::steady_clock::time_point TimeOfRequest;
+		};
+		std::unordered_map<unsigned long, CoalescedRead> PendingReads; /*!< The read requests that have not been answered yet. The key is built from the values of the expected reply. */
+		boost::mutex PendingReadsMutex; /*!< The pending reads are added by the senders (e.g. the TCP server) and removed by the forwarding thread. */
+		/** \brief Register the read request as pending. 
+		 * \return False if an identical read is already pending. In this case, the source of the request is added to its requesters and the request must not be sent.
+		 */
+		bool RegisterPendingRead(boost::shared_ptr<const BfbMessage> request);
+		/** \brief Forward the reply to all requesters of a pending read. */
+		void ForwardReplyToAdditionalRequesters(boost::shared_ptr<const BfbMessage> reply);
+
+		std::vector<boost::shared_ptr<SerialConnection>> SerialConnections; /*!< This vector is used to store the serial connections to all available serial ports. It is only changed by the constructor and the destructor.*/
 		std::map<unsigned char, boost::shared_ptr<SerialConnection>> Clients; /*!< Map that stores all connected client IDs and the corresponding serial connection instances. A message that is addressed to a certain client may be routed to the serial connection registered for this client ID. */
+		std::map<std::string, BusTopology> Topologies; /*!< The current topology of every serial port. */
+		boost::mutex ClientsMutex; /*!< The clients and the topologies are changed by the I/O threads of the serial ports if the hot plug detection is active. */
+		/** \brief Update the routing to the clients of the passed topology and rewrite the topology cache file. This is called from the I/O thread of the serial port whose topology has changed or whose cached topology turned out to be outdated. */
+		void HandleChangedTopology(const BusTopology& topology);
+		std::list<std::function<void (std::list<unsigned char>)>> ClientChangeNotificationFunctions; /*!< The functions passed to NotifyOfClientChanges. */
 		
 		unsigned int NumOfTransmissionAttempts=3;
+		
+		std::string TopologyCacheFile; /*!< The name of the topology cache file. If it is empty, no cache is used. */
 };
 
 #endif /* COMMUNICATION_INTERFACE_HPP_INCLUDED */
@@ -0,0 +1,110 @@
+// STL includes
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+// Own header files
+#include "TrajectoryPlayer.hpp"
+
+/** \brief Read an unsigned little endian number of the passed size. */
+static unsigned long readUint(const std::vector<unsigned char>& payload, size_t position, unsigned int numOfBytes){
+	unsigned long value=0;
+	for(unsigned int i=0; i<numOfBytes; i++){
+		value|=static_cast<unsigned long>(payload[position+i])<<(8*i);
+	};
+	return value;
+}
+
+bool decodeTrajectory(const std::vector<unsigned char>& payload, Trajectory& trajectory){
+	const size_t headerLength=12;
+	if(payload.size()<headerLength){
+		return false;
+	};
+	trajectory=Trajectory();
+	trajectory.Protocol=payload[0];
+	trajectory.Command=payload[1];
+	size_t numOfDrives=payload[2];
+	trajectory.IsRepeated=((payload[3] & 0x01)!=0);
+	trajectory.Period=std::chrono::microseconds(readUint(payload, 4, 4));
+	trajectory.StartDelay=std::chrono::microseconds(readUint(payload, 8, 4));
+	if(numOfDrives==0){
+		return true;
+	};
+	size_t sampleLength=4+2*numOfDrives;
+	if(payload.size()<headerLength+numOfDrives+sampleLength || (payload.size()-headerLength-numOfDrives)%sampleLength!=0 || trajectory.Period.count()==0){
+		return false;
+	};
+	trajectory.DriveIds.assign(payload.begin()+headerLength, payload.begin()+headerLength+numOfDrives);
+	size_t numOfSamples=(payload.size()-headerLength-numOfDrives)/sampleLength;
+	trajectory.SampleTimes.reserve(numOfSamples);
+	trajectory.Values.reserve(numOfSamples*numOfDrives);
+	for(size_t position=headerLength+numOfDrives; position<payload.size(); position+=sampleLength){
+		std::chrono::microseconds time(readUint(payload, position, 4));
+		if(!trajectory.SampleTimes.empty() && time<=trajectory.SampleTimes.back()){
+			return false;
+		};
+		trajectory.SampleTimes.push_back(time);
+		for(size_t drive=0; drive<numOfDrives; drive++){
+			trajectory.Values.push_back(static_cast<int16_t>(readUint(payload, position+4+2*drive, 2)));
+		};
+	};
+	return true;
+}
+
+std::vector<unsigned char> encodeTrajectoryStatus(const TrajectoryStatus& status){
+	std::vector<unsigned char> payload;
+	payload.push_back(status.IsPlaying ? 1 : 0);
+	for(unsigned long value: {status.NumOfSetpoints, status.NumOfSkippedSetpoints}){
+		value=std::min<unsigned long>(value, std::numeric_limits<uint32_t>::max());
+		for(unsigned int i=0; i<4; i++){
+			payload.push_back((value>>(8*i)) & 0xFF);
+		};
+	};
+	return payload;
+}
+
+TrajectoryPlayer::TrajectoryPlayer(boost::shared_ptr<const Trajectory> trajectory, std::vector<size_t> driveIndices, std::chrono::steady_clock::time_point startTime):
+	PlayedTrajectory(trajectory),
+	DriveIndices(driveIndices),
+	StartTime(startTime){
+}
+
+bool TrajectoryPlayer::Interpolate(std::chrono::steady_clock::time_point time, std::vector<double>& setpoints){
+	const Trajectory& trajectory=*PlayedTrajectory;
+	const size_t numOfDrives=trajectory.DriveIds.size();
+	const size_t lastSample=trajectory.SampleTimes.size()-1;
+	bool isPlaying=true;
+	std::chrono::steady_clock::duration elapsed=time-StartTime;
+	if(elapsed>=trajectory.SampleTimes.back() && trajectory.IsRepeated && trajectory.SampleTimes.back().count()>0){ // The last sample is the first one of the next repetition.
+		std::chrono::steady_clock::duration repetitionLength=trajectory.SampleTimes.back();
+		StartTime+=(elapsed/repetitionLength)*repetitionLength;
+		elapsed=time-StartTime;
+		Segment=0;
+	};
+	while(Segment<lastSample && elapsed>=trajectory.SampleTimes[Segment+1]){
+		Segment++;
+	};
+	setpoints.resize(DriveIndices.size());
+	if(Segment==lastSample || elapsed<=trajectory.SampleTimes[Segment]){ // Before the first sample or after the last one, the setpoints are held.
+		isPlaying=(Segment<lastSample || trajectory.IsRepeated);
+		for(size_t i=0; i<DriveIndices.size(); i++){
+			setpoints[i]=trajectory.Values[Segment*numOfDrives+DriveIndices[i]];
+		};
+		return isPlaying;
+	};
+	double fraction=std::chrono::duration<double>(elapsed-trajectory.SampleTimes[Segment])/std::chrono::duration<double>(trajectory.SampleTimes[Segment+1]-trajectory.SampleTimes[Segment]);
+	for(size_t i=0; i<DriveIndices.size(); i++){
+		double first=trajectory.Values[Segment*numOfDrives+DriveIndices[i]];
+		double second=trajectory.Values[(Segment+1)*numOfDrives+DriveIndices[i]];
+		setpoints[i]=first+fraction*(second-first);
+	};
+	return isPlaying;
+}
+
+boost::shared_ptr<const Trajectory> TrajectoryPlayer::GetTrajectory() const{
+	return PlayedTrajectory;
+}
+
+const std::vector<size_t>& TrajectoryPlayer::GetDriveIndices() const{
+	return DriveIndices;
+}
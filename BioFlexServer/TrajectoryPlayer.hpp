@@ -0,0 +1,67 @@
+#ifndef TRAJECTORYPLAYER_HPP
+#define TRAJECTORYPLAYER_HPP
+
+// STL includes
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+// Boost includes
+#include <boost/shared_ptr.hpp>
+
+/** \brief A setpoint trajectory for a set of drives as uploaded by a TCP client.
+ * 	The values are given in the units of the clients (e.g. -8192...8191 for desiredPosition), so the server does not need to know the protocol definitions.
+ */
+struct Trajectory{
+	unsigned char Protocol=0; /*!< The protocol of the setpoint messages. */
+	unsigned char Command=0; /*!< The command of the setpoint messages (the write command of the property, e.g. 86 for desiredPosition). */
+	bool IsRepeated=false; /*!< If true, the trajectory starts over after its last sample. */
+	std::chrono::microseconds Period=std::chrono::microseconds(0); /*!< The time between two setpoints of a drive. */
+	std::chrono::microseconds StartDelay=std::chrono::microseconds(0); /*!< The time between the upload and the first setpoint. It lets the players of all serial ports start at the same time. */
+	std::vector<unsigned char> DriveIds;
+	std::vector<std::chrono::microseconds> SampleTimes; /*!< The times of the samples relative to the start. They are strictly increasing. */
+	std::vector<double> Values; /*!< The values of all samples, one value per drive for every sample. */
+};
+
+/** \brief The state of the playback of all serial ports. */
+struct TrajectoryStatus{
+	bool IsPlaying=false; /*!< True if at least one serial port is still sending setpoints. */
+	unsigned long NumOfSetpoints=0; /*!< The number of setpoints sent since the playback was started. */
+	unsigned long NumOfSkippedSetpoints=0; /*!< The number of setpoints that were not sent since the previous setpoint of the same drive had not been sent yet or the serial port still held the setpoints of a whole period. */
+};
+
+/** \brief Decode a trajectory from the payload of a SIMSERV request (all numbers little endian):
+ * 	protocol (1 byte), command (1 byte), number of drives N (1 byte), flags (1 byte, bit 0: repeat), period in microseconds (4 bytes), start delay in microseconds (4 bytes), N drive IDs (1 byte each),
+ * 	followed by the samples. Every sample consists of its time in microseconds (4 bytes) and N signed 16 bit values.
+ * \return False if the payload is malformed. A trajectory without drives is valid; it stops the playback.
+ */
+bool decodeTrajectory(const std::vector<unsigned char>& payload, Trajectory& trajectory);
+
+/** \brief Encode the status as payload of a reply: the playing state (1 byte) followed by the numbers of sent and skipped setpoints (4 bytes each, little endian). */
+std::vector<unsigned char> encodeTrajectoryStatus(const TrajectoryStatus& status);
+
+/** \brief Plays the part of a trajectory that belongs to the drives of one serial port. The setpoints are interpolated linearly between the samples. */
+class TrajectoryPlayer{
+	public:
+		/** \param trajectory The trajectory that is played.
+		 * \param driveIndices The indices (in the drive list of the trajectory) of the drives this player sends setpoints to.
+		 * \param startTime The time of the first sample.
+		 */
+		TrajectoryPlayer(boost::shared_ptr<const Trajectory> trajectory, std::vector<size_t> driveIndices, std::chrono::steady_clock::time_point startTime);
+
+		/** \brief Interpolate the setpoints of the drives of the player at the passed time. The times must not decrease from call to call.
+		 * \param setpoints The setpoints in the order of the drive indices.
+		 * \return False if the trajectory is over (and not repeated). In this case, the setpoints of the last sample are returned.
+		 */
+		bool Interpolate(std::chrono::steady_clock::time_point time, std::vector<double>& setpoints);
+
+		boost::shared_ptr<const Trajectory> GetTrajectory() const;
+		const std::vector<size_t>& GetDriveIndices() const;
+	private:
+		boost::shared_ptr<const Trajectory> PlayedTrajectory;
+		std::vector<size_t> DriveIndices;
+		std::chrono::steady_clock::time_point StartTime; /*!< The time of the first sample of the current repetition. */
+		size_t Segment=0; /*!< The index of the sample the current interpolation segment starts with. */
+};
+
+#endif
@@ -1,6 +1,8 @@
 #include <stdlib.h>
+#include <algorithm>
 #include <functional>
 
+#include <boost/algorithm/string.hpp>
 #include <boost/asio.hpp>
 #include <boost/assign.hpp>
 #include <boost/bind.hpp>
@@ -16,9 +18,19 @@
 #include "SerialInterface.hpp"
 #include <TcpServer.hpp>
 #include "NotificationTimer.hpp"
+#include "CyclicPoller.hpp"
+#include "RealTime.hpp"
 
 unsigned long portNum;
 
+static const int defaultRealTimeSerialThreadPriority=80; /*!< The priority of the serial threads in real-time mode if none is set explicitly. */
+static const int defaultRealTimeTcpThreadPriority=70; /*!< The priority of the TCP threads in real-time mode if none is set explicitly. They run below the serial threads, so the bus timing does not depend on the network load. */
+static const size_t prefaultedHeapSize=16*1024*1024; /*!< The heap that is mapped in real-time mode before the communication starts. */
+static const size_t prefaultedStackSize=512*1024;
+static const std::chrono::microseconds jitterMeasurementPeriod(1000); /*!< The period of the jitter measurement. It matches the 1 kHz control loops of the robot. */
+static const unsigned int numOfJitterMeasurementWakeups=1000;
+static const unsigned char simulationServerId=14; /*!< The ID the TCP clients send the SIMSERV requests to (see NotificationTimer). It is the source of the notifications of the server. */
+
 
 
 ////////////////////////////////////////// Main
@@ -34,6 +46,18 @@ int main (int argc, char **argv)
 	("print", boost::program_options::value<bool>()->default_value(false), "print every message that is received via the serial or the TCP interface")
 	("maxPayloadPrintout", boost::program_options::value<signed long int>()->default_value(-1), "Sets the maximum number of payload bytes that will be printed. This might be helpful if the output of the geometry xml should not be printed completely.")
 	("resend", boost::program_options::value<unsigned int>()->default_value(3), "set the number of transmission attempts the server will undertake in order to get a reply for a message for which a reply is expected.")
+	("clientWindow", boost::program_options::value<unsigned int>()->default_value(2), "set the number of requests per serial client that may wait for their replies. Larger values let clients that buffer several requests be served at the speed of the line.")
+	("serialPort", boost::program_options::value<std::vector<std::string>>()->multitoken(), "set the serial ports that are searched for bus masters (e.g. the link created by the BusMasterEmulator). By default, all ports matching /dev/ttyA* are used.")
+	("serialThreadPriority", boost::program_options::value<int>()->default_value(0), "set the real-time priority (SCHED_FIFO) of the I/O threads of the serial ports. 0 keeps the normal scheduling.")
+	("serialThreadCpu", boost::program_options::value<int>()->default_value(-1), "pin the I/O thread of the first serial port to this CPU, the one of the second port to the next CPU and so on. -1 disables the pinning.")
+	("tcpThreadPriority", boost::program_options::value<int>()->default_value(0), "set the real-time priority (SCHED_FIFO) of the threads that serve the TCP connections and forward the serial messages to them. 0 keeps the normal scheduling.")
+	("tcpThreadCpu", boost::program_options::value<int>()->default_value(-1), "pin the threads that serve the TCP connections and forward the serial messages to them to this CPU. -1 disables the pinning.")
+	("realTime", boost::program_options::value<bool>()->default_value(false), "run in real-time mode: lock the memory of the server, pre-fault the heap and the stack, set the low latency flag of the serial ports and report the achieved wakeup jitter. Unless they are set explicitly, the priorities of the serial and TCP threads default to 80 and 70.")
+	("hotPlug", boost::program_options::value<bool>()->default_value(true), "probe the IDs of the bus in idle slots during operation. Clients that are plugged in or out are added to or removed from the routing without a restart, and all TCP clients are notified (SIMSERV busClients).")
+	("topologyCache", boost::program_options::value<std::string>()->default_value(""), "set the file in which the bus topology is cached. If the file exists, the discovery of the bus clients is skipped and the cached topology is verified in the background.")
+	("poll", boost::program_options::value<std::vector<std::string>>()->multitoken(), "read the values in the format clientId:protocol:command cyclically from the bus. Read requests of TCP clients for these values are answered from the latest reply as long as it is fresh enough.")
+	("pollPeriod", boost::program_options::value<unsigned int>()->default_value(10000), "set the time in microseconds between two reads of a polled value")
+	("maxValueAge", boost::program_options::value<unsigned int>()->default_value(20000), "set the maximum age in microseconds of a polled value that is used to answer a read request. Older values are read from the bus.")
 	;
 	
 	//Parse the options
@@ -51,17 +75,98 @@ int main (int argc, char **argv)
 	
 	// Create the interfaces to the serial and the network interfaces. 
 	TcpServer  TcpInter(portNum);
-	SerialInterface  SerialInter;
-	NotificationTimer Timer(TcpInter.GetSendMessageHandle());
+	std::vector<std::string> serialPortNames;
+	if(vm.count("serialPort")){
+		serialPortNames=vm["serialPort"].as<std::vector<std::string>>();
+	};
+	SerialInterface  SerialInter(vm["topologyCache"].as<std::string>(), serialPortNames);
+	NotificationTimer Timer(boost::bind(&TcpServer::SendMessageToConnection, &TcpInter, _1, _2));
 	
 	SerialInter.SetNumOfTransmissionAttempts(vm["resend"].as<unsigned int>());
+	SerialInter.SetClientWindow(vm["clientWindow"].as<unsigned int>());
+	bool isRealTime=vm["realTime"].as<bool>();
+	int serialThreadPriority=vm["serialThreadPriority"].as<int>();
+	int tcpThreadPriority=vm["tcpThreadPriority"].as<int>();
+	if(isRealTime && vm["serialThreadPriority"].defaulted()){
+		serialThreadPriority=defaultRealTimeSerialThreadPriority;
+	};
+	if(isRealTime && vm["tcpThreadPriority"].defaulted()){
+		tcpThreadPriority=defaultRealTimeTcpThreadPriority;
+	};
+	if(!SerialInter.SetSerialThreadScheduling(serialThreadPriority, vm["serialThreadCpu"].as<int>())){
+		std::cout<<"The scheduling of the serial threads could not be set. Real-time priorities require root privileges."<<std::endl;
+	};
+	if(!SerialInter.SetForwardingThreadScheduling(tcpThreadPriority, vm["tcpThreadCpu"].as<int>()) || !setThreadScheduling(TcpInter.GetIoThreadHandle(), tcpThreadPriority, vm["tcpThreadCpu"].as<int>())){
+		std::cout<<"The scheduling of the TCP threads could not be set. Real-time priorities require root privileges."<<std::endl;
+	};
+	if(isRealTime){
+		if(!SerialInter.SetSerialLowLatency()){
+			std::cout<<"The low latency flag could not be set for all serial ports. Their drivers may deliver the received bytes delayed."<<std::endl;
+		};
+		// All threads that serve the bus have been started. Their stacks are locked as well.
+		if(!lockMemory()){
+			std::cout<<"The memory could not be locked. This requires root privileges. Page faults may stall the server."<<std::endl;
+		};
+		prefaultHeap(prefaultedHeapSize);
+		prefaultStack(prefaultedStackSize);
+		WakeupJitter jitter=measureWakeupJitter(serialThreadPriority, vm["serialThreadCpu"].as<int>(), jitterMeasurementPeriod, numOfJitterMeasurementWakeups);
+		std::cout<<std::dec<<"Wakeup lateness of a thread with the priority of the serial threads over "<<jitter.NumOfWakeups<<" periods of "<<jitterMeasurementPeriod.count()<<" us: mean "
+			<<jitter.MeanLateness<<" us, 99% "<<jitter.Percentile99Lateness<<" us, max "<<jitter.MaxLateness<<" us"<<std::endl;
+	};
 	
 	TcpInter.NotifyOfNewConnection(boost::bind(&NotificationTimer::ResetTimer, &Timer, _1));
 	
+	// Create the poller before the routes to the TCP server are set up. Thus, the cache is updated before a reply is forwarded.
+	boost::shared_ptr<CyclicPoller> Poller;
+	if(vm.count("poll")){
+		Poller=boost::make_shared<CyclicPoller>(SerialInter.GetSendMessageHandle(), std::chrono::microseconds(vm["pollPeriod"].as<unsigned int>()), std::chrono::microseconds(vm["maxValueAge"].as<unsigned int>()));
+		auto polledValues=vm["poll"].as<std::vector<std::string>>();
+		auto clients=SerialInter.GetConnectedClients();
+		for(auto it=polledValues.begin(); it!=polledValues.end(); it++){
+			std::vector<std::string> fields;
+			boost::split(fields, *it, boost::is_any_of(":"));
+			std::vector<unsigned long> numbers;
+			try{
+				for(auto field=fields.begin(); field!=fields.end(); field++){
+					numbers.push_back(std::stoul(*field, nullptr, 0));
+				};
+			}catch(const std::exception&){
+				numbers.clear();
+			};
+			if(numbers.size()!=3 || numbers[0]>255 || numbers[1]>255 || numbers[2]>255){
+				std::cout<<"The polled value \""<<*it<<"\" is invalid. Use the format clientId:protocol:command."<<std::endl;
+				continue;
+			};
+			if(std::find(clients.begin(), clients.end(), numbers[0])==clients.end()){
+				std::cout<<"The polled value \""<<*it<<"\" is ignored since the client is not connected."<<std::endl;
+				continue;
+			};
+			Poller->AddPolledValue(numbers[0], numbers[1], numbers[2]);
+		};
+		// The route keeps the poller alive until the serial interface is destroyed.
+		SerialInter.RouteIncomingMessagesTo(boost::bind(&CyclicPoller::ProcessIncomingMessage, Poller, _1));
+		Poller->Start();
+	};
+	
 	// Give the two interfaces a handle to the respectively other one.
 	SerialInter.RouteIncomingMessagesTo(TcpInter.GetSendMessageHandle());
 	
-	boost::function<void (boost::shared_ptr<const BfbMessage>)> ProcessIncomingTcpMessages=[&](boost::shared_ptr<const BfbMessage> message)->void{
+	// Tell all TCP clients which serial clients are connected whenever a client has been plugged in or out.
+	SerialInter.NotifyOfClientChanges([&TcpInter](std::list<unsigned char> clients){
+		auto notification=boost::make_shared<BfbMessage>();
+		notification->SetDestination(0);
+		notification->SetSource(simulationServerId);
+		notification->SetBusAllocationFlag(false);
+		notification->SetProtocol(BfbProtocolIds::SIMSERV_1_PROT);
+		notification->SetCommand(85);
+		notification->SetPayload(std::vector<unsigned char>(clients.begin(), clients.end()));
+		TcpInter.SendMessageToAll(notification);
+	});
+	if(vm["hotPlug"].as<bool>()){
+		SerialInter.StartHotPlugDetection();
+	};
+	
+	boost::function<void (boost::shared_ptr<const BfbMessage>, unsigned short)> ProcessIncomingTcpMessages=[&](boost::shared_ptr<const BfbMessage> message, unsigned short connectionId)->void{
 		//BfbFunctions::printMessage(message);
 		if(message->GetProtocol()==BfbProtocolIds::SIMSERV_1_PROT){
 			auto reply=boost::make_shared<BfbMessage>(message->GetRawData());
@@ -70,7 +175,7 @@ int main (int argc, char **argv)
 			reply->SetCommand(message->GetCommand()+1);
 			switch (message->GetCommand()){
 				case 30:
-					reply->SetPayload(boost::assign::list_of<unsigned char>(TcpInter.GetTcpConnectionBroadcastState(message->GetSource())));
+					reply->SetPayload(boost::assign::list_of<unsigned char>(TcpInter.GetTcpConnectionBroadcastState(connectionId)));
 					break;
 				case 32:
 				{
@@ -82,23 +187,57 @@ int main (int argc, char **argv)
 							break;
 						};
 					};
-					TcpInter.SetTcpConnectionBroadcastState(message->GetSource(), state);
+					TcpInter.SetTcpConnectionBroadcastState(connectionId, state);
+					break;
+				};
+				case 80: // Query the round-trip statistics of the serial client whose ID is the first payload byte.
+				{
+					auto payload=message->GetPayload();
+					unsigned char clientId=(payload.empty() ? 0 : payload[0]);
+					reply->SetPayload(encodeLatencySummaries(clientId, SerialInter.GetLatencySummaries(clientId)));
+					break;
+				};
+				case 84: // Query the IDs of the connected serial clients.
+				{
+					auto clients=SerialInter.GetConnectedClients();
+					reply->SetPayload(std::vector<unsigned char>(clients.begin(), clients.end()));
+					break;
+				};
+				case 90: // Query the state of the trajectory playback.
+					reply->SetPayload(encodeTrajectoryStatus(SerialInter.GetTrajectoryStatus()));
+					break;
+				case 92: // Upload a setpoint trajectory and start to play it (see decodeTrajectory). The reply contains the number of connected drives of the trajectory.
+				{
+					auto trajectory=boost::make_shared<Trajectory>();
+					if(!decodeTrajectory(message->GetPayload(), *trajectory)){
+						reply->SetErrorFlag(true);
+						reply->SetPayload(std::vector<unsigned char>());
+						break;
+					};
+					reply->SetPayload(boost::assign::list_of<unsigned char>(SerialInter.PlayTrajectory(trajectory)));
 					break;
 				};
 				default:
-					Timer.ProcessMessage(message);
+					Timer.ProcessMessage(message, connectionId);
 					return;
 					break;
 			};
 			if(message->GetBusAllocation()){
-				TcpInter.SendMessage(reply);
+				TcpInter.SendMessageToConnection(connectionId, reply);
 			};
 		}else{
+			if(Poller){
+				auto reply=Poller->GetCachedReply(message);
+				if(reply){
+					TcpInter.SendMessage(reply);
+					return;
+				};
+			};
 			SerialInter.SendMessage(message);
 		};
 	};
 	
-	TcpInter.RouteIncomingMessagesTo(ProcessIncomingTcpMessages);
+	TcpInter.RouteIncomingMessagesOfConnectionsTo(ProcessIncomingTcpMessages);
 	
 	// If the print option was specified, also add the print function to the message signals.
 	
@@ -130,9 +269,9 @@ int main (int argc, char **argv)
 	for(auto it=clientList.begin();it!=clientList.end();it++){
 		std::cout<<std::dec<<std::right<<std::setw(4)<<int(*it)<<"( "<<std::hex<< std::showbase<<int(*it)<<" ), "<<std::endl;;
 	};
-	auto serialPortNames=SerialInter.GetSerialPortNames();
+	auto connectedSerialPortNames=SerialInter.GetSerialPortNames();
 	std::cout<<"The following serial ports are connected to bus masters:"<< std::endl;
-	for(auto it=serialPortNames.begin();it!=serialPortNames.end();it++){
+	for(auto it=connectedSerialPortNames.begin();it!=connectedSerialPortNames.end();it++){
 		std::cout<<*it<<std::endl;;
 	};
 	
@@ -145,5 +284,10 @@ int main (int argc, char **argv)
 		};
 	};
 	
+	if(Poller){
+		Poller->Stop();
+		Poller->PrintStatistics();
+	};
+	SerialInter.PrintStatistics();
 	return 0;
 }
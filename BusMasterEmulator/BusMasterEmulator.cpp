@@ -0,0 +1,243 @@
+// STL includes
+#include <stdlib.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <iostream>
+#include <stdexcept>
+
+// Boost includes
+#include <boost/asio/steady_timer.hpp>
+#include <boost/assign.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+// Own header files
+#include "BusMasterEmulator.hpp"
+#include "BfbProtocolIds.hpp"
+
+static const unsigned char busMasterId=1; /*!< The BioFlex bus ID of the bus master. */
+
+BusMasterEmulator::BusMasterEmulator(boost::shared_ptr<boost::asio::io_service> ioService, std::vector<boost::shared_ptr<EmulatedClient>> clients, EmulatedBusTiming timing, unsigned int randomSeed):
+		IoService(ioService),
+		PseudoTerminal(*ioService),
+		Timing(timing),
+		RandomGenerator(randomSeed){
+	for(auto it=clients.begin(); it!=clients.end(); it++){
+		Clients[(*it)->GetBioFlexBusId()]=*it;
+	};
+	LineBusyUntil.fill(std::chrono::steady_clock::now());
+
+	// Create the pseudo-terminal. Both sides are switched to raw mode so no byte is modified or echoed.
+	MasterFileDescriptor=posix_openpt(O_RDWR | O_NOCTTY);
+	if(MasterFileDescriptor<0 || grantpt(MasterFileDescriptor)!=0 || unlockpt(MasterFileDescriptor)!=0){
+		throw std::runtime_error("The pseudo-terminal could not be created.");
+	};
+	SerialPortName=ptsname(MasterFileDescriptor);
+	SlaveFileDescriptor=open(SerialPortName.c_str(), O_RDWR | O_NOCTTY);
+	if(SlaveFileDescriptor<0){
+		throw std::runtime_error("The slave side of the pseudo-terminal could not be opened.");
+	};
+	for(int fileDescriptor: {MasterFileDescriptor, SlaveFileDescriptor}){
+		struct termios settings;
+		tcgetattr(fileDescriptor, &settings);
+		cfmakeraw(&settings);
+		tcsetattr(fileDescriptor, TCSANOW, &settings);
+	};
+	PseudoTerminal.assign(MasterFileDescriptor);
+	TryToReceiveData();
+}
+
+BusMasterEmulator::~BusMasterEmulator(){
+	boost::system::error_code error;
+	PseudoTerminal.close(error);
+	if(SlaveFileDescriptor>=0){
+		close(SlaveFileDescriptor);
+	};
+}
+
+std::string BusMasterEmulator::GetSerialPortName() const{
+	return SerialPortName;
+}
+
+void BusMasterEmulator::SetClientConnected(unsigned char clientId, bool isConnected){
+	if(isConnected){
+		DisconnectedClients.erase(clientId);
+	}else{
+		DisconnectedClients.insert(clientId);
+	};
+}
+
+void BusMasterEmulator::PrintStatistics() const{
+	std::cout<<std::dec<<"Received messages: "<<NumOfReceivedMessages<<std::endl;
+	std::cout<<"Answered messages: "<<NumOfAnsweredMessages<<std::endl;
+	std::cout<<"Lost messages:     "<<NumOfLostMessages<<std::endl;
+	std::cout<<"Lost reply bytes:  "<<NumOfLostBytes<<std::endl;
+	std::cout<<"Skipped bytes:     "<<NumOfSkippedBytes<<std::endl;
+}
+
+void BusMasterEmulator::TryToReceiveData(){
+	PseudoTerminal.async_read_some(boost::asio::buffer(ReceiveBuffer),
+		boost::bind(&BusMasterEmulator::HandleReceivedData, this,
+			boost::asio::placeholders::error,
+			boost::asio::placeholders::bytes_transferred));
+}
+
+void BusMasterEmulator::HandleReceivedData(const boost::system::error_code& error, size_t bytesTransferred){
+	if(error==boost::asio::error::operation_aborted){
+		return;
+	};
+	if(error){ // Linux reports an error while no process has the slave side opened. Since the emulator keeps it open, this should not happen.
+		std::cout<<"Reading from the pseudo-terminal failed: "<<error.message()<<std::endl;
+		return;
+	};
+	IncomingData.insert(IncomingData.end(), ReceiveBuffer.begin(), ReceiveBuffer.begin()+bytesTransferred);
+	size_t position=0;
+	while(IncomingData.size()-position>=8){
+		std::vector<unsigned char> header(IncomingData.begin()+position, IncomingData.begin()+position+8);
+		size_t messageLength=0;
+		if(BfbFunctions::isValidShortPacket(header)){
+			messageLength=8;
+		}else if(BfbFunctions::isValidLongPacketHeader(header)){
+			messageLength=8+BfbFunctions::numOfMissingBytes(header);
+		}else{ // Skip one byte in order to resynchronise.
+			NumOfSkippedBytes++;
+			position++;
+			continue;
+		};
+		if(IncomingData.size()-position<messageLength){ // Wait for the rest of the message.
+			break;
+		};
+		std::vector<unsigned char> rawData(IncomingData.begin()+position, IncomingData.begin()+position+messageLength);
+		if(messageLength==8 || BfbFunctions::isValidLongPacket(rawData)){
+			position+=messageLength;
+			ProcessMessage(boost::make_shared<const BfbMessage>(rawData));
+		}else{
+			NumOfSkippedBytes++;
+			position++;
+		};
+	};
+	IncomingData.erase(IncomingData.begin(), IncomingData.begin()+position);
+	TryToReceiveData();
+}
+
+void BusMasterEmulator::ProcessMessage(boost::shared_ptr<const BfbMessage> message){
+	NumOfReceivedMessages++;
+	if(message->GetDestination()==busMasterId){
+		ProcessBusMasterMessage(message);
+		return;
+	};
+	// Find the line the message is forwarded to.
+	unsigned int line=0;
+	while(line<2 && (message->GetDestination() & ForwardingMask[line])!=ForwardingStartId[line]){
+		line++;
+	};
+	if(line==2){ // No line is configured for this ID. The bus master drops the message.
+		return;
+	};
+	// The request occupies the line until its last byte has been transmitted.
+	std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point endOfRequest=std::max(now, LineBusyUntil[line])+message->GetRawData().size()*Timing.ByteDuration;
+	LineBusyUntil[line]=endOfRequest;
+	auto client=Clients.find(message->GetDestination());
+	if(client==Clients.end() || client->second->GetLine()!=line || DisconnectedClients.count(message->GetDestination())){
+		return;
+	};
+	if(LossDistribution(RandomGenerator)<Timing.MessageLossProbability){
+		NumOfLostMessages++;
+		return;
+	};
+	if(BfbFunctions::isFragment(*message)){
+		message=client->second->AddFragment(message);
+		if(!message){ // The message is not complete yet.
+			return;
+		};
+	};
+	if(!message->GetBusAllocation()){
+		return;
+	};
+	boost::shared_ptr<const BfbMessage> reply=client->second->ProcessMessage(message);
+	if(reply){
+		std::vector<boost::shared_ptr<const BfbMessage>> replyPackets;
+		if(reply->GetPayload().size()>BfbConstants::maxLongPayloadLength){
+			auto fragments=BfbFunctions::splitIntoFragments(*reply, NextFragmentTransferId++);
+			replyPackets.assign(fragments.begin(), fragments.end());
+		}else{
+			replyPackets.push_back(reply);
+		};
+		std::chrono::steady_clock::time_point endOfReply=endOfRequest+Timing.ResponseDelay;
+		for(auto it=replyPackets.begin(); it!=replyPackets.end(); it++){ // The fragments are sent back to back.
+			endOfReply+=(*it)->GetRawData().size()*Timing.ByteDuration;
+			ScheduleReply(*it, endOfReply);
+		};
+		LineBusyUntil[line]=endOfReply;
+	};
+}
+
+void BusMasterEmulator::ProcessBusMasterMessage(boost::shared_ptr<const BfbMessage> message){
+	if(message->GetProtocol()!=BfbProtocolIds::BIOFLEX_1_PROT){
+		return;
+	};
+	switch(message->GetCommand()){
+		case 0x00:{ // Identification request
+			auto reply=boost::make_shared<BfbMessage>(message->GetRawData());
+			reply->SetDestination(message->GetSource());
+			reply->SetSource(busMasterId);
+			reply->SetBusAllocationFlag(false);
+			reply->SetCommand(message->GetCommand()+1);
+			reply->SetPayload(boost::assign::list_of(0)(0));
+			ScheduleReply(reply, std::chrono::steady_clock::now()+Timing.ResponseDelay);
+			break;
+		}
+		case 0x80: // Configuration of line 1
+		case 0x82:{ // Configuration of line 0
+			unsigned int line=(message->GetCommand()==0x80 ? 1 : 0);
+			std::vector<unsigned char> payload=message->GetPayload();
+			if(payload.size()>=2){
+				ForwardingMask[line]=payload[0];
+				ForwardingStartId[line]=payload[1];
+			};
+			break;
+		}
+		default:
+			break;
+	};
+}
+
+void BusMasterEmulator::ScheduleReply(boost::shared_ptr<const BfbMessage> reply, std::chrono::steady_clock::time_point timeOfArrival){
+	NumOfAnsweredMessages++;
+	auto rawData=boost::make_shared<std::vector<unsigned char>>();
+	std::vector<unsigned char> completeRawData=reply->GetRawData();
+	for(auto it=completeRawData.begin(); it!=completeRawData.end(); it++){
+		if(Timing.ByteLossProbability>0.0 && LossDistribution(RandomGenerator)<Timing.ByteLossProbability){
+			NumOfLostBytes++;
+		}else{
+			rawData->push_back(*it);
+		};
+	};
+	auto timer=boost::make_shared<boost::asio::steady_timer>(*IoService, timeOfArrival);
+	timer->async_wait([this, timer, rawData](const boost::system::error_code& error){
+		if(!error){
+			SendData(rawData);
+		};
+	});
+}
+
+void BusMasterEmulator::SendData(boost::shared_ptr<const std::vector<unsigned char>> data){
+	DataToBeSent.push(data);
+	if(!IsSendPending){
+		IsSendPending=true;
+		boost::asio::async_write(PseudoTerminal, boost::asio::buffer(*DataToBeSent.front()),
+			boost::bind(&BusMasterEmulator::HandleSentData, this, boost::asio::placeholders::error));
+	};
+}
+
+void BusMasterEmulator::HandleSentData(const boost::system::error_code& error){
+	DataToBeSent.pop();
+	if(error || DataToBeSent.empty()){
+		IsSendPending=false;
+		return;
+	};
+	boost::asio::async_write(PseudoTerminal, boost::asio::buffer(*DataToBeSent.front()),
+		boost::bind(&BusMasterEmulator::HandleSentData, this, boost::asio::placeholders::error));
+}
@@ -0,0 +1,102 @@
+#ifndef BUSMASTEREMULATOR_HPP
+#define BUSMASTEREMULATOR_HPP
+
+// STL includes
+#include <array>
+#include <chrono>
+#include <map>
+#include <queue>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+// Boost includes
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+
+// Own header files
+#include <BfbMessage.hpp>
+#include "EmulatedClients.hpp"
+
+/** \brief The timing and the error behaviour of the emulated bus. */
+struct EmulatedBusTiming{
+	std::chrono::steady_clock::duration ByteDuration=std::chrono::microseconds(10); /*!< The time it takes to transmit one byte on a line of the bus (10 bits per byte). */
+	std::chrono::steady_clock::duration ResponseDelay=std::chrono::microseconds(20); /*!< The time a client needs between the end of a request and the start of its reply. */
+	double ByteLossProbability=0.0; /*!< The probability that a single byte of a reply is lost on the bus. */
+	double MessageLossProbability=0.0; /*!< The probability that a request does not reach its client. */
+};
+
+/** \brief The class emulates a bus master with two lines on a pseudo-terminal.
+ * The BioFlexServer can open the slave side of the pseudo-terminal like the serial port of a real bus master.
+ * The emulator answers the identification request addressed to the bus master, accepts the line configuration and forwards every request to the emulated client on the configured line.
+ * The transmission on each line is emulated byte by byte: the lines are half-duplex, so requests and replies of one line are serialised, while both lines run in parallel.
+ * A reply is written to the pseudo-terminal at the time its last byte would have been received by the bus master.
+ */
+class BusMasterEmulator{
+	public:
+		/** \brief The constructor creates the pseudo-terminal and starts to receive messages.
+		 * \param ioService The service object that runs all asynchronous operations of the emulator.
+		 * \param clients The clients connected to the lines of the emulated bus master.
+		 * \param timing The timing and the error behaviour of the emulated lines.
+		 * \param randomSeed The seed of the random generator deciding about lost bytes and messages.
+		 */
+		BusMasterEmulator(boost::shared_ptr<boost::asio::io_service> ioService, std::vector<boost::shared_ptr<EmulatedClient>> clients, EmulatedBusTiming timing, unsigned int randomSeed);
+		~BusMasterEmulator();
+
+		/** \brief The name of the slave side of the pseudo-terminal (e.g. /dev/pts/3). This is the serial port the server has to open. */
+		std::string GetSerialPortName() const;
+
+		/** \brief Plug the client with the passed ID in or out. A client that is plugged out ignores all messages, as if it had been disconnected from its line. This must be called from the thread running the service object. */
+		void SetClientConnected(unsigned char clientId, bool isConnected);
+
+		/** \brief Print the number of processed, answered and lost messages. */
+		void PrintStatistics() const;
+	private:
+		BusMasterEmulator(const BusMasterEmulator&) = delete;
+		BusMasterEmulator & operator=(const BusMasterEmulator&) = delete;
+
+		boost::shared_ptr<boost::asio::io_service> IoService; /*!< The service object managing all the asynchronous tasks */
+		int MasterFileDescriptor=-1; /*!< The master side of the pseudo-terminal. */
+		int SlaveFileDescriptor=-1; /*!< The slave side is kept open by the emulator so the master does not report a hang-up while the server is not connected. */
+		std::string SerialPortName; /*!< The name of the slave side of the pseudo-terminal. */
+		boost::asio::posix::stream_descriptor PseudoTerminal; /*!< Asynchronous access to the master side of the pseudo-terminal. */
+
+		std::map<unsigned char, boost::shared_ptr<EmulatedClient>> Clients; /*!< The emulated clients accessible by their BioFlex bus ID. */
+		std::set<unsigned char> DisconnectedClients; /*!< The clients that are currently plugged out. */
+		EmulatedBusTiming Timing;
+		std::array<unsigned char, 2> ForwardingMask={{0xF0, 0xF0}}; /*!< A message is forwarded to a line if its destination ID masked with this value equals the start ID of the line. */
+		std::array<unsigned char, 2> ForwardingStartId={{0x90, 0xA0}}; /*!< Until the bus master is configured, both lines forward an ID range without clients. */
+		std::array<std::chrono::steady_clock::time_point, 2> LineBusyUntil; /*!< The time at which the last scheduled transmission of each line ends. */
+		unsigned char NextFragmentTransferId=0; /*!< The transfer ID of the next reply that is split into fragments. */
+
+		std::mt19937 RandomGenerator;
+		std::uniform_real_distribution<double> LossDistribution=std::uniform_real_distribution<double>(0.0, 1.0);
+
+		std::vector<unsigned char> ReceiveBuffer=std::vector<unsigned char>(512); /*!< Buffer for the asynchronous read operation. */
+		std::vector<unsigned char> IncomingData; /*!< The received bytes that do not form a complete message yet. */
+		/** \brief Start an asynchronous read operation on the pseudo-terminal. */
+		void TryToReceiveData();
+		/** \brief Append the received bytes to the incoming data and extract all complete messages. Invalid bytes are skipped in order to resynchronise. */
+		void HandleReceivedData(const boost::system::error_code& error, size_t bytesTransferred);
+		/** \brief Answer a message addressed to the bus master or forward it to the client on the configured line. Fragments are reassembled by the client, and replies that do not fit into a long packet are sent back as fragments. */
+		void ProcessMessage(boost::shared_ptr<const BfbMessage> message);
+		/** \brief Process a message addressed to the bus master itself. */
+		void ProcessBusMasterMessage(boost::shared_ptr<const BfbMessage> message);
+		/** \brief Write the reply to the pseudo-terminal at the passed time. Bytes may get lost according to the ByteLossProbability. */
+		void ScheduleReply(boost::shared_ptr<const BfbMessage> reply, std::chrono::steady_clock::time_point timeOfArrival);
+
+		std::queue<boost::shared_ptr<const std::vector<unsigned char>>> DataToBeSent; /*!< The replies that wait for the completion of the current write operation. */
+		bool IsSendPending=false; /*!< Flag that shows whether an asynchronous write operation is in progress. */
+		/** \brief Write the passed data to the pseudo-terminal as soon as the previous write operations are completed. */
+		void SendData(boost::shared_ptr<const std::vector<unsigned char>> data);
+		/** \brief Start the write operation for the next data in the queue. */
+		void HandleSentData(const boost::system::error_code& error);
+
+		unsigned long NumOfReceivedMessages=0;
+		unsigned long NumOfAnsweredMessages=0;
+		unsigned long NumOfLostMessages=0;
+		unsigned long NumOfLostBytes=0;
+		unsigned long NumOfSkippedBytes=0; /*!< Bytes of the incoming data that did not belong to a valid message. */
+};
+#endif
@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <math.h>
+#include <boost/assign.hpp>
+#include <boost/make_shared.hpp>
+// Own header files
+#include "EmulatedClients.hpp"
+#include "BfbProtocolIds.hpp"
+
+
+EmulatedClient::EmulatedClient(unsigned char bioFlexBusId, unsigned char line):
+	BioFlexBusId(bioFlexBusId),
+	Line(line){
+		for(auto it=UniqueIdentificationData.begin(); it!=UniqueIdentificationData.end(); it++){
+			(*it)=rand()%256; // Create a pseudo-random number in the range 0...255 .
+		};
+};
+
+boost::shared_ptr<const BfbMessage> EmulatedClient::AddFragment(boost::shared_ptr<const BfbMessage> fragment){
+	return Fragments.AddFragment(*fragment);
+}
+
+unsigned char EmulatedClient::GetBioFlexBusId() const{
+	return BioFlexBusId;
+}
+
+unsigned char EmulatedClient::GetLine() const{
+	return Line;
+}
+
+double EmulatedClient::EmulatedValue(double amplitude) const{
+	return amplitude*sin(0.01*NumOfProcessedMessages+BioFlexBusId);
+}
+
+boost::shared_ptr<BfbMessage> EmulatedClient::CreateReply(boost::shared_ptr<const BfbMessage> message, std::vector<double> values, unsigned char numOfBits){
+	auto reply=boost::make_shared<BfbMessage>(message->GetRawData());
+	reply->SetDestination(message->GetSource());
+	reply->SetSource(message->GetDestination());
+	reply->SetBusAllocationFlag(false);
+	reply->SetCommand(message->GetCommand()+1);
+	if(values.empty()){
+		reply->SetPayload(boost::assign::list_of(0)(0));
+	}else{
+		reply->SetPayload(BfbFunctions::convertDoublesToBytes(values, numOfBits, true));
+	};
+	return reply;
+}
+
+boost::shared_ptr<BfbMessage> EmulatedClient::ProcessMessage(boost::shared_ptr<const BfbMessage> message){
+	NumOfProcessedMessages++;
+	if(message->GetProtocol()==BfbProtocolIds::BIOFLEX_1_PROT && message->GetCommand()==0x00){
+		auto reply=CreateReply(message, std::vector<double>(), 8);
+		reply->SetPayload(std::vector<unsigned char>(UniqueIdentificationData.begin(), UniqueIdentificationData.end()));
+		return reply;
+	};
+	return boost::shared_ptr<BfbMessage>();
+}
+
+
+EmulatedDrive::EmulatedDrive(unsigned char bioFlexBusId, unsigned char line):
+	EmulatedClient(bioFlexBusId, line){
+};
+
+boost::shared_ptr<BfbMessage> EmulatedDrive::ProcessMessage(boost::shared_ptr<const BfbMessage> message){
+	if(message->GetProtocol()==BfbProtocolIds::BIOFLEX_ROTATORY_CONTROL1_PROT || message->GetProtocol()==BfbProtocolIds::BIOFLEX_ROTATORY_ERROR_PROT){
+		unsigned int key=(message->GetProtocol()<<8) | message->GetCommand();
+		if(message->GetPayload().size()>BfbConstants::maxLongPayloadLength){ // The write command of a property is its read command plus two.
+			ParameterBlocks[key-2]=message->GetPayload();
+		}else if(ParameterBlocks.count(key)>0){
+			NumOfProcessedMessages++;
+			auto reply=CreateReply(message, std::vector<double>(), 8);
+			reply->SetPayload(ParameterBlocks[key]);
+			return reply;
+		};
+	};
+	switch(message->GetProtocol()){
+		case BfbProtocolIds::BIOFLEX_ROTATORY_1_PROT: // All properties of this protocol are (at least) 16 bit values.
+			NumOfProcessedMessages++;
+			return CreateReply(message, boost::assign::list_of<double>(EmulatedValue(10000)), 16);
+		case BfbProtocolIds::BIOFLEX_ROTATORY_CONTROL1_PROT:
+		case BfbProtocolIds::BIOFLEX_ROTATORY_ERROR_PROT: // Write requests are confirmed.
+			NumOfProcessedMessages++;
+			return CreateReply(message, std::vector<double>(), 8);
+		default:
+			return EmulatedClient::ProcessMessage(message);
+	};
+}
+
+
+EmulatedImu::EmulatedImu(unsigned char bioFlexBusId, unsigned char line):
+	EmulatedClient(bioFlexBusId, line){
+};
+
+boost::shared_ptr<BfbMessage> EmulatedImu::ProcessMessage(boost::shared_ptr<const BfbMessage> message){
+	if(message->GetProtocol()!=BfbProtocolIds::IMU_SENSOR_PROT){
+		return EmulatedClient::ProcessMessage(message);
+	};
+	NumOfProcessedMessages++;
+	switch(message->GetCommand()){
+		case 20: // acceleration
+		case 40: // magnetic field
+			return CreateReply(message, boost::assign::list_of<double>(EmulatedValue(1000))(EmulatedValue(500))(1000), 16);
+		case 94: // position
+		case 96: // rotation
+			return CreateReply(message, boost::assign::list_of<double>(EmulatedValue(100000))(EmulatedValue(50000))(0), 32);
+		default:
+			return boost::shared_ptr<BfbMessage>();
+	};
+}
+
+
+EmulatedPressureSensor::EmulatedPressureSensor(unsigned char bioFlexBusId, unsigned char line):
+	EmulatedClient(bioFlexBusId, line){
+};
+
+boost::shared_ptr<BfbMessage> EmulatedPressureSensor::ProcessMessage(boost::shared_ptr<const BfbMessage> message){
+	if(message->GetProtocol()!=BfbProtocolIds::PRESSURE_SENSOR_PROT){
+		return EmulatedClient::ProcessMessage(message);
+	};
+	NumOfProcessedMessages++;
+	switch(message->GetCommand()){
+		case 4: // max_value
+			return CreateReply(message, boost::assign::list_of<double>(fabs(EmulatedValue(120))), 8);
+		case 10: // highestPressure
+			return CreateReply(message, boost::assign::list_of<double>(fabs(EmulatedValue(100))), 16);
+		default:
+			return boost::shared_ptr<BfbMessage>();
+	};
+}
+
+
+boost::shared_ptr<EmulatedClient> createEmulatedClient(std::string type, unsigned char bioFlexBusId, unsigned char line){
+	if(type=="drive"){
+		return boost::make_shared<EmulatedDrive>(bioFlexBusId, line);
+	}else if(type=="imu"){
+		return boost::make_shared<EmulatedImu>(bioFlexBusId, line);
+	}else if(type=="pressure"){
+		return boost::make_shared<EmulatedPressureSensor>(bioFlexBusId, line);
+	};
+	return boost::shared_ptr<EmulatedClient>();
+}
@@ -0,0 +1,74 @@
+#ifndef EMULATEDCLIENTS_HPP
+#define EMULATEDCLIENTS_HPP
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include "BfbMessage.hpp"
+
+/** \brief Base class of the clients that are emulated on one of the lines of the virtual bus master.
+ * Like the clients of the simulation, it answers the identification request of the BIOFLEX_1_PROT. The derived classes add the protocols of the devices they emulate.
+ */
+class EmulatedClient{
+	protected:
+		unsigned char BioFlexBusId;
+		unsigned char Line; /*!< The line of the bus master the client is connected to (0 or 1). */
+		std::array<unsigned char, 16> UniqueIdentificationData{{}}; // The BioFlex Protocol specifies that this information should be sent as reply for a message with protocol id 1 and command id 0. Currently, the data is created randomly.
+		unsigned long NumOfProcessedMessages=0; /*!< Used to create sensor values that change from request to request. */
+		BfbFragmentAssembler Fragments; /*!< Reassembles the messages that were split into fragments by the server. */
+
+		/** \brief Create a reply that carries the passed values as payload.
+		 * \param message The request the reply is created for.
+		 * \param values The values of the reply.
+		 * \param numOfBits The number of bits each value is encoded with.
+		 */
+		boost::shared_ptr<BfbMessage> CreateReply(boost::shared_ptr<const BfbMessage> message, std::vector<double> values, unsigned char numOfBits);
+		/** \brief The emulated value of a sensor or a drive. It changes slowly with the number of processed messages. */
+		double EmulatedValue(double amplitude) const;
+	public:
+		EmulatedClient(unsigned char bioFlexBusId, unsigned char line);
+		virtual ~EmulatedClient(){};
+		/** \brief Process a message addressed to the client.
+		 * \return The reply of the client or an empty pointer if the client does not know the command.
+		 */
+		virtual boost::shared_ptr<BfbMessage> ProcessMessage(boost::shared_ptr<const BfbMessage> message);
+		/** \brief Pass a fragment of a large message to the client.
+		 * \return The reassembled message after its last fragment has been received, otherwise an empty pointer.
+		 */
+		boost::shared_ptr<const BfbMessage> AddFragment(boost::shared_ptr<const BfbMessage> fragment);
+		unsigned char GetBioFlexBusId() const;
+		unsigned char GetLine() const;
+};
+
+/** \brief Emulation of a BioFlex rotatory drive. Read requests of the BIOFLEX_ROTATORY_1_PROT are answered with 16 bit values, write requests of the control and error protocols are confirmed. 
+ * A parameter block that is too large for a long packet (and was therefore sent as fragments) is stored, so it can be read back with the read command of the property.
+ */
+class EmulatedDrive: public EmulatedClient{
+	public:
+		EmulatedDrive(unsigned char bioFlexBusId, unsigned char line);
+		boost::shared_ptr<BfbMessage> ProcessMessage(boost::shared_ptr<const BfbMessage> message);
+	private:
+		std::map<unsigned int, std::vector<unsigned char>> ParameterBlocks; /*!< The stored parameter blocks accessible by the protocol (upper byte) and the read command (lower byte). */
+};
+
+/** \brief Emulation of an inertial measurement unit answering the requests of the IMU_SENSOR_PROT. */
+class EmulatedImu: public EmulatedClient{
+	public:
+		EmulatedImu(unsigned char bioFlexBusId, unsigned char line);
+		boost::shared_ptr<BfbMessage> ProcessMessage(boost::shared_ptr<const BfbMessage> message);
+};
+
+/** \brief Emulation of a pressure sensor answering the requests of the PRESSURE_SENSOR_PROT. */
+class EmulatedPressureSensor: public EmulatedClient{
+	public:
+		EmulatedPressureSensor(unsigned char bioFlexBusId, unsigned char line);
+		boost::shared_ptr<BfbMessage> ProcessMessage(boost::shared_ptr<const BfbMessage> message);
+};
+
+/** \brief Create an emulated client of the specified type.
+ * \param type One of "drive", "imu" or "pressure".
+ * \return The client or an empty pointer if the type is unknown.
+ */
+boost::shared_ptr<EmulatedClient> createEmulatedClient(std::string type, unsigned char bioFlexBusId, unsigned char line);
+#endif
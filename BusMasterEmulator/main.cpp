@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/program_options.hpp>
+
+#include "BusMasterEmulator.hpp"
+#include "EmulatedClients.hpp"
+
+/** \brief The default bus: twelve drives on line 0, six drives, an IMU and two pressure sensors on line 1. */
+std::vector<std::string> defaultClients(){
+	std::vector<std::string> clients;
+	for(unsigned int id=0x10;id<0x1C;id++){
+		clients.push_back("drive:"+std::to_string(id)+":0");
+	};
+	for(unsigned int id=0x20;id<0x26;id++){
+		clients.push_back("drive:"+std::to_string(id)+":1");
+	};
+	clients.push_back("imu:"+std::to_string(0x26)+":1");
+	clients.push_back("pressure:"+std::to_string(0x27)+":1");
+	clients.push_back("pressure:"+std::to_string(0x28)+":1");
+	return clients;
+}
+
+/** \brief Parse a numeric field of a description passed via command line.
+ * \return false if the field is not a number or larger than maxValue. The bad field is reported in this case.
+ */
+static bool parseField(const std::string& description, const std::string& fieldName, const std::string& field, unsigned long maxValue, unsigned long& value){
+	size_t numOfParsedCharacters=0;
+	try{
+		value=std::stoul(field, &numOfParsedCharacters, 0);
+	}catch(const std::exception&){
+		numOfParsedCharacters=0;
+	};
+	if(field.empty() || field[0]=='-' || numOfParsedCharacters!=field.size() || value>maxValue){
+		std::cout<<"The "<<fieldName<<" \""<<field<<"\" of the description \""<<description<<"\" is invalid. It must be a number from 0 to "<<maxValue<<"."<<std::endl;
+		return false;
+	};
+	return true;
+}
+
+////////////////////////////////////////// Main
+int main (int argc, char **argv)
+{
+	/** Declare and parse the program options specified via command line. */
+	boost::program_options::options_description desc("Command line options");
+	desc.add_options()
+	("help", "produce help message")
+	("link", boost::program_options::value<std::string>()->default_value("/tmp/ttyBfbEmulator"), "create a symbolic link with this name pointing to the pseudo-terminal. Start the BioFlexServer with --serialPort set to this name.")
+	("client", boost::program_options::value<std::vector<std::string>>()->multitoken(), "add an emulated client in the format type:id:line. The type may be drive, imu or pressure. The clients of one line must share the same ID range (id/16). If no client is specified, a default bus with 18 drives, an IMU and two pressure sensors is emulated.")
+	("baudRate", boost::program_options::value<unsigned int>()->default_value(1000000), "set the baud rate of the lines of the bus (10 bits per byte)")
+	("responseDelay", boost::program_options::value<unsigned int>()->default_value(20), "set the time in microseconds a client needs before it starts to reply")
+	("byteLoss", boost::program_options::value<double>()->default_value(0.0), "set the probability that a single byte of a reply is lost")
+	("messageLoss", boost::program_options::value<double>()->default_value(0.0), "set the probability that a request does not reach its client")
+	("seed", boost::program_options::value<unsigned int>()->default_value(1), "set the seed of the random generator used for the losses")
+	("hotPlug", boost::program_options::value<std::vector<std::string>>()->multitoken(), "plug an emulated client in and out in the format id:plugIn:plugOut. The client is connected from plugIn until plugOut seconds after the start. If plugOut is 0, it stays connected.")
+	;
+
+	//Parse the options
+	boost::program_options::variables_map vm;
+	boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+	boost::program_options::notify(vm);
+
+	if (vm.count("help")) { // Show the help text and stop the program.
+		std::cout << desc << std::endl;
+		return 1;
+	}
+
+	std::vector<std::string> clientDescriptions=(vm.count("client") ? vm["client"].as<std::vector<std::string>>() : defaultClients());
+	std::vector<boost::shared_ptr<EmulatedClient>> clients;
+	for(auto it=clientDescriptions.begin(); it!=clientDescriptions.end(); it++){
+		std::vector<std::string> fields;
+		boost::split(fields, *it, boost::is_any_of(":"));
+		if(fields.size()!=3){
+			std::cout<<"The client description \""<<*it<<"\" is invalid. Use the format type:id:line."<<std::endl;
+			return 1;
+		};
+		unsigned long id, line;
+		if(!parseField(*it, "ID", fields[1], 255, id) || !parseField(*it, "line", fields[2], 1, line)){
+			return 1;
+		};
+		boost::shared_ptr<EmulatedClient> client=createEmulatedClient(fields[0], id, line);
+		if(!client){
+			std::cout<<"The type \""<<fields[0]<<"\" of the client description \""<<*it<<"\" is invalid. It must be drive, imu or pressure."<<std::endl;
+			return 1;
+		};
+		clients.push_back(client);
+	};
+
+	EmulatedBusTiming timing;
+	timing.ByteDuration=std::chrono::nanoseconds(10ull*1000000000ull/vm["baudRate"].as<unsigned int>());
+	timing.ResponseDelay=std::chrono::microseconds(vm["responseDelay"].as<unsigned int>());
+	timing.ByteLossProbability=vm["byteLoss"].as<double>();
+	timing.MessageLossProbability=vm["messageLoss"].as<double>();
+
+	auto ioService=boost::make_shared<boost::asio::io_service>();
+	BusMasterEmulator emulator(ioService, clients, timing, vm["seed"].as<unsigned int>());
+
+	// Plug the clients in and out at the passed times.
+	std::vector<boost::shared_ptr<boost::asio::steady_timer>> hotPlugTimers;
+	if(vm.count("hotPlug")){
+		auto hotPlugs=vm["hotPlug"].as<std::vector<std::string>>();
+		for(auto it=hotPlugs.begin(); it!=hotPlugs.end(); it++){
+			std::vector<std::string> fields;
+			boost::split(fields, *it, boost::is_any_of(":"));
+			if(fields.size()!=3){
+				std::cout<<"The hot plug description \""<<*it<<"\" is invalid. Use the format id:plugIn:plugOut."<<std::endl;
+				return 1;
+			};
+			std::vector<unsigned long> numbers(3);
+			const unsigned long maxSeconds=std::numeric_limits<unsigned int>::max();
+			if(!parseField(*it, "ID", fields[0], 255, numbers[0]) || !parseField(*it, "plug in time", fields[1], maxSeconds, numbers[1]) || !parseField(*it, "plug out time", fields[2], maxSeconds, numbers[2])){
+				return 1;
+			};
+			unsigned char clientId=numbers[0];
+			auto schedule=[&](unsigned long seconds, bool isConnected){
+				auto timer=boost::make_shared<boost::asio::steady_timer>(*ioService, std::chrono::seconds(seconds));
+				timer->async_wait([&emulator, clientId, isConnected](const boost::system::error_code& error){
+					if(!error){
+						emulator.SetClientConnected(clientId, isConnected);
+					};
+				});
+				hotPlugTimers.push_back(timer);
+			};
+			if(numbers[1]>0){
+				emulator.SetClientConnected(clientId, false);
+				schedule(numbers[1], true);
+			};
+			if(numbers[2]>0){
+				schedule(numbers[2], false);
+			};
+		};
+	};
+
+	std::string linkName=vm["link"].as<std::string>();
+	if(!linkName.empty()){
+		boost::system::error_code error;
+		boost::filesystem::remove(linkName, error);
+		boost::filesystem::create_symlink(emulator.GetSerialPortName(), linkName, error);
+		if(error){
+			std::cout<<"The link "<<linkName<<" could not be created: "<<error.message()<<std::endl;
+		};
+	};
+	std::cout<<"Emulating a bus master with "<<clients.size()<<" clients on "<<emulator.GetSerialPortName();
+	if(!linkName.empty()){
+		std::cout<<" ("<<linkName<<")";
+	};
+	std::cout<<". Press Ctrl+C to stop."<<std::endl;
+
+	// Stop on Ctrl+C and print what happened on the bus.
+	boost::asio::signal_set signals(*ioService, SIGINT, SIGTERM);
+	signals.async_wait([ioService](const boost::system::error_code&, int){
+		ioService->stop();
+	});
+	ioService->run();
+
+	emulator.PrintStatistics();
+	if(!linkName.empty()){
+		boost::system::error_code error;
+		boost::filesystem::remove(linkName, error);
+	};
+	return 0;
+}
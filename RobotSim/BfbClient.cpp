@@ -52,4 +52,12 @@ boost::shared_ptr<BfbMessage> BfbClient::ProcessMessage(boost::shared_ptr<const
 //void BioFlexBusClient::PreSimulationStepUpdate(){};
 void BfbClient::PostSimulationStepUpdate(double deltaT){
 	(void)deltaT;
-};
\ No newline at end of file
+};
+
+void BfbClient::SaveState(StateWriter& writer){
+	writer.WriteBool(FatalError);
+}
+
+void BfbClient::RestoreState(StateReader& reader){
+	FatalError=reader.ReadBool();
+}
\ No newline at end of file
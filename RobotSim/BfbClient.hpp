@@ -2,6 +2,7 @@
 #define BFBCLIENT_HPP
 #include <array>
 #include "BfbMessage.hpp"
+#include "SimulationState.hpp"
 
 class BfbClient{
 	protected:
@@ -14,5 +15,9 @@ class BfbClient{
 		virtual boost::shared_ptr<BfbMessage> ProcessMessage(boost::shared_ptr<const BfbMessage> Message);
 		//virtual void PreSimulationStepUpdate(); 
 		virtual void PostSimulationStepUpdate(double deltaT); 
+		/** \brief Append the state of the client (e.g. sensor filters) to a snapshot of the universe. Derived classes that have a state must call this function first. */
+		virtual void SaveState(StateWriter& writer);
+		/** \brief Restore the state written by SaveState. */
+		virtual void RestoreState(StateReader& reader);
 };
 #endif
\ No newline at end of file
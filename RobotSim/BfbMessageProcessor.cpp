@@ -1,3 +1,8 @@
+// STL includes
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
 // Boost includes
 #include <boost/assign/list_of.hpp>
 #include <boost/lexical_cast.hpp>
@@ -13,6 +18,7 @@
 #include "Bodies.hpp"
 #include "GeometryXmlParser.hpp"
 #include "OdeDrawstuff.hpp"
+#include "SimulationState.hpp"
 #include "Universe.hpp"
 
 #include <boost/algorithm/string.hpp>
@@ -21,19 +27,98 @@
 
 static std::string geometryXml=""; // The variable that holds the last geometry xml data for all tcp clients.
 std::map<unsigned char, double> relTimerMap;
-std::map<unsigned char, double> absTimerMap;
+std::map<unsigned char, uint64_t> absTimerMap; // The tick count each TCP client has let the simulation run to. The simulation only runs until the earliest of them, so the clients stay in lockstep.
 
 void SimulateUntillMinimalTimer(boost::shared_ptr<Universe> universe){
-	double minAbsTime=absTimerMap.begin()->second;
+	uint64_t minAbsTickCount=absTimerMap.begin()->second;
 	for(auto it=absTimerMap.begin(); it!=absTimerMap.end(); it++){
-		if(minAbsTime>it->second){
-			minAbsTime=it->second;
+		if(minAbsTickCount>it->second){
+			minAbsTickCount=it->second;
 		};
 	};
-	universe->SimulateUntill(minAbsTime);
+	universe->StepUntil(minAbsTickCount);
 	
 }
 
+/** \brief Convert a tick count into eight bytes (little endian). */
+static std::vector<unsigned char> convertTickCountToBytes(uint64_t tickCount){
+	std::vector<unsigned char> bytes;
+	for(unsigned int i=0;i<8;i++){
+		bytes.push_back((tickCount>>(i*8))&255);
+	};
+	return bytes;
+}
+
+static const uint64_t maxTicksPerStepCommand=1000000; // The step command (102) blocks the simulation loop until its ticks are simulated, so a single request must not exceed this (1000 s at the default frequency of 1 kHz).
+
+static std::map<unsigned char, std::vector<unsigned char> > snapshotMap; // The snapshots that have been saved by the TCP clients, by slot number.
+
+/** \brief Take a snapshot of the universe and of the timers of the TCP clients. */
+static std::vector<unsigned char> saveSnapshot(boost::shared_ptr<Universe> universe){
+	StateWriter writer;
+	universe->SaveState(writer);
+	writer.WriteUint(relTimerMap.size());
+	for(auto it=relTimerMap.begin(); it!=relTimerMap.end(); it++){
+		writer.WriteUint(it->first);
+		writer.WriteDouble(it->second);
+	};
+	writer.WriteUint(absTimerMap.size());
+	for(auto it=absTimerMap.begin(); it!=absTimerMap.end(); it++){
+		writer.WriteUint(it->first);
+		writer.WriteUint(it->second);
+	};
+	return writer.GetData();
+}
+
+/** \brief Restore a snapshot taken by saveSnapshot.
+ * \return False if the snapshot does not belong to the current scene or is corrupt. The universe and the timers are not changed in this case.
+ */
+static bool restoreSnapshot(boost::shared_ptr<Universe> universe, const std::vector<unsigned char>& snapshot){
+	StateReader reader(snapshot);
+	StateWriter backup; // The timers follow the universe in the snapshot, so the universe must be rolled back if they are corrupt.
+	universe->SaveState(backup);
+	try{
+		universe->RestoreState(reader);
+		std::map<unsigned char, double> tempRelTimerMap;
+		for(uint64_t numOfTimers=reader.ReadUint(); numOfTimers>0; numOfTimers--){
+			unsigned char client=reader.ReadUint();
+			tempRelTimerMap[client]=reader.ReadDouble();
+		};
+		std::map<unsigned char, uint64_t> tempAbsTimerMap;
+		for(uint64_t numOfTimers=reader.ReadUint(); numOfTimers>0; numOfTimers--){
+			unsigned char client=reader.ReadUint();
+			tempAbsTimerMap[client]=reader.ReadUint();
+		};
+		reader.ExpectEnd();
+		relTimerMap.swap(tempRelTimerMap);
+		absTimerMap.swap(tempAbsTimerMap);
+	}catch(std::invalid_argument& error){
+		StateReader backupReader(backup.GetData());
+		universe->RestoreState(backupReader);
+		std::cout<<"The snapshot could not be restored: "<<error.what()<<std::endl;
+		return false;
+	};
+	return true;
+}
+
+/** \brief Get the file name that optionally follows the slot number in the payload of a snapshot command. An empty name means that the snapshot is kept in memory only. */
+static std::string getSnapshotFileName(const std::vector<unsigned char>& payload){
+	if(payload.size()<2){
+		return "";
+	};
+	std::string fileName(payload.begin()+1, payload.end());
+	return fileName.substr(0, fileName.find('\0')); // Short messages always have two bytes of payload, so the name may be padded with zeros.
+}
+
+/** \brief Check that a snapshot file name of a TCP client stays within the working directory of the simulation, i.e. that it is neither absolute nor leads to a parent directory. */
+static bool isSnapshotFileNameAllowed(const std::string& fileName){
+	if(fileName.empty() || (fileName[0]!='/' && fileName.find("..")==std::string::npos)){
+		return true;
+	};
+	std::cout<<"The snapshot file name "<<fileName<<" was rejected. It must be relative and must not contain \"..\"."<<std::endl;
+	return false;
+}
+
 boost::shared_ptr<BfbMessage> BfbMessageProcessor::ProcessMessage(boost::shared_ptr<Universe> universe, boost::shared_ptr<const BfbMessage> message){
 
 	const unsigned char messageDestination=message->GetDestination();
@@ -76,10 +161,12 @@ boost::shared_ptr<BfbMessage> BfbMessageProcessor::ProcessMessage(boost::shared_
 						tempInt|=( messagePayload.at(i)<<(i*8) );
 					};
 					relTimerMap[message->GetSource()]=dReal(tempInt)/1000;
-					try{
-						absTimerMap[message->GetSource()]+=dReal(tempInt)/1000;
-					}catch(std::out_of_range& err){
-						absTimerMap[message->GetSource()]=universe->GetTime()+dReal(tempInt)/1000;
+					uint64_t numOfTicks=llround(dReal(tempInt)/1000*universe->GetSimFrequency());
+					auto absTimer=absTimerMap.find(message->GetSource());
+					if(absTimer!=absTimerMap.end()){
+						absTimer->second+=numOfTicks;
+					}else{ // The first period of a client starts now.
+						absTimerMap[message->GetSource()]=universe->GetTickCount()+numOfTicks;
 					};
 					SimulateUntillMinimalTimer(universe);
 					break;
@@ -215,6 +302,68 @@ boost::shared_ptr<BfbMessage> BfbMessageProcessor::ProcessMessage(boost::shared_
 				}
 				break;
 				};
+			case 100: // Get the tick count of the simulation.
+				reply->SetPayload(convertTickCountToBytes(universe->GetTickCount()));
+				break;
+			case 102: // Simulate the passed number of ticks (little endian, up to eight bytes) and reply with the new tick count. Unlike the timers (command 12), the ticks are simulated right away without waiting for the other clients. More than maxTicksPerStepCommand ticks are rejected with the error flag set and nothing is simulated.
+				{
+					uint64_t numOfTicks=0;
+					for(unsigned int i=0;i<messagePayload.size() && i<8;i++){
+						numOfTicks|=( uint64_t(messagePayload.at(i))<<(i*8) );
+					};
+					if(numOfTicks>maxTicksPerStepCommand){
+						reply->SetErrorFlag(true);
+						reply->SetComment("At most " + boost::lexical_cast<std::string>(maxTicksPerStepCommand) + " ticks can be simulated per step command.");
+					}else{
+						universe->Step(numOfTicks);
+					};
+					reply->SetPayload(convertTickCountToBytes(universe->GetTickCount()));
+					break;
+				};
+			case 104: // Get the snapshot saved in the slot that is passed as first payload byte. The reply is empty if the slot is empty.
+				{
+					auto snapshot=snapshotMap.find(messagePayload.empty() ? 0 : messagePayload[0]);
+					reply->SetPayload(snapshot!=snapshotMap.end() ? snapshot->second : std::vector<unsigned char>());
+					break;
+				};
+			case 106: // Save a snapshot of the simulation in the slot that is passed as first payload byte and, if a file name follows, also in that file. The reply is 1 on success. The name must be relative and must not contain "..".
+				{
+					unsigned char slot=messagePayload.empty() ? 0 : messagePayload[0];
+					std::string fileName=getSnapshotFileName(messagePayload);
+					if(!isSnapshotFileNameAllowed(fileName)){
+						reply->SetPayload(boost::assign::list_of(0));
+						break;
+					};
+					std::vector<unsigned char>& snapshot=snapshotMap[slot];
+					snapshot=saveSnapshot(universe);
+					bool success=true;
+					if(!fileName.empty()){
+						std::ofstream file(fileName, std::ios::binary);
+						file.write(reinterpret_cast<const char*>(snapshot.data()), snapshot.size());
+						success=file.good();
+					};
+					reply->SetPayload(boost::assign::list_of(success ? 1 : 0));
+					break;
+				};
+			case 110: // Restore the snapshot in the slot that is passed as first payload byte. If a file name follows, the snapshot is loaded from that file instead (with the same restrictions as for command 106) and is stored in the slot once it has been restored. The reply is 1 on success.
+				{
+					unsigned char slot=messagePayload.empty() ? 0 : messagePayload[0];
+					std::string fileName=getSnapshotFileName(messagePayload);
+					bool success=isSnapshotFileNameAllowed(fileName);
+					if(success && !fileName.empty()){
+						std::ifstream file(fileName, std::ios::binary);
+						std::vector<unsigned char> snapshot((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+						success=!file.bad() && file.is_open() && restoreSnapshot(universe, snapshot);
+						if(success){ // A file that cannot be restored must not replace the snapshot in the slot.
+							snapshotMap[slot].swap(snapshot);
+						};
+					}else if(success){
+						auto snapshot=snapshotMap.find(slot);
+						success=snapshot!=snapshotMap.end() && restoreSnapshot(universe, snapshot->second);
+					};
+					reply->SetPayload(boost::assign::list_of(success ? 1 : 0));
+					break;
+				};
 			
 		};
 		return reply;
@@ -1,6 +1,6 @@
 /**
  * \file BfbProtocolIds.hpp The file contains a list of the protocol Ids that are used in the BioFlex protocol.
- * Note: A file with this name exists both in the server and the simulation. If a protocol ID changes, this change must be carried out in both files!!!
+ * Note: A file with this name exists in the server, the simulation and the bus master emulator. If a protocol ID changes, this change must be carried out in all files!!!
  */
 #ifndef BFBPROTOCOLIDS_HPP
 #define BFBPROTOCOLIDS_HPP
@@ -148,6 +148,30 @@ void BioFlexRotatory::SetMaximumTorque(dReal torque){
 	MaxTorque=fabs(torque);
 }
 
+void BioFlexRotatory::SaveState(StateWriter& writer){
+	BfbClient::SaveState(writer);
+	for(dReal value: {SpringConstant, DampingConstant, MaxTorque, InputSpeed, InputAngle, OutputAngle, Torsion, Torque}){
+		writer.WriteDouble(value);
+	};
+	writer.WriteDouble(Time);
+	for(bool flag: {Activation, Tmc603aError, CommunicationTimeoutError, TorsionMeasurementError, OutputAngleMeasurementError, RotorOvertemperatureError, DriverOvertemperatureError, InputAngleError, OutputAngleError, TorsionError, WatchdogError, OvervoltageError, UndervoltageError, I2cError}){
+		writer.WriteBool(flag);
+	};
+	writer.WriteUint(ResetState);
+}
+
+void BioFlexRotatory::RestoreState(StateReader& reader){
+	BfbClient::RestoreState(reader);
+	for(dReal* value: {&SpringConstant, &DampingConstant, &MaxTorque, &InputSpeed, &InputAngle, &OutputAngle, &Torsion, &Torque}){
+		*value=reader.ReadDouble();
+	};
+	Time=reader.ReadDouble();
+	for(bool* flag: {&Activation, &Tmc603aError, &CommunicationTimeoutError, &TorsionMeasurementError, &OutputAngleMeasurementError, &RotorOvertemperatureError, &DriverOvertemperatureError, &InputAngleError, &OutputAngleError, &TorsionError, &WatchdogError, &OvervoltageError, &UndervoltageError, &I2cError}){
+		*flag=reader.ReadBool();
+	};
+	ResetState=reader.ReadUint();
+}
+
 
 boost::shared_ptr<BfbMessage> BioFlexRotatory::ProcessMessage(boost::shared_ptr<const BfbMessage> message){
 	auto reply=boost::shared_ptr<BfbMessage>(new BfbMessage(message->GetRawData()));
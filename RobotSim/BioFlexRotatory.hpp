@@ -61,6 +61,12 @@ public:
 	
 	void PostSimulationStepUpdate(double deltaT); 
 	boost::shared_ptr<BfbMessage> ProcessMessage(boost::shared_ptr<const BfbMessage> Message);
+	
+	/*! \brief Append the state of the drive (angles, spring and controller parameters, activation and error flags) to a snapshot.
+	 *	The hinge itself does not need to be saved since ODE derives its state from the bodies.
+	 */
+	void SaveState(StateWriter& writer);
+	void RestoreState(StateReader& reader);
 
 	bool GetActivation();
 	void SetActivation(bool newActivation);
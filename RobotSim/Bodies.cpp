@@ -1,5 +1,6 @@
 // STL includes
 #include <string.h>
+#include <atomic>
 
 // Boost includes
 #include <boost/lexical_cast.hpp>
@@ -13,7 +14,7 @@
 #include "HelperFunctions.hpp"
 #include "OdeDrawstuff.hpp"
 
-static unsigned int 	NumOfInstance=0;	// This variable is used to track the number of instances THAT HAVE BEEN CREATED THROUGHOUT THE SIMULATION. 
+static std::atomic<unsigned int> NumOfInstance(0);	// This variable is used to track the number of instances THAT HAVE BEEN CREATED THROUGHOUT THE SIMULATION. It is shared by all universes, which may create bodies in different threads.
 namespace Bodies{
 BaseBody::BaseBody(	dSpaceID 	spaceId,
 			std::string	name,
@@ -30,9 +31,9 @@ BaseBody::BaseBody(	dSpaceID 	spaceId,
 				CategoryBits(categoryBits),
 				CollideBits(collideBits),
 				GeomPrimList(GeometricPrimitivesList(0)){
-	NumOfInstance++;
+	unsigned int instanceNumber=++NumOfInstance;
 	if(Name==""){
-		Name=std::string("BodyNr").append(boost::lexical_cast<std::string>(NumOfInstance));
+		Name=std::string("BodyNr").append(boost::lexical_cast<std::string>(instanceNumber));
 	}
 	
 	/*	Create a sub-space to hold the primitves for this RigidBody and do
@@ -64,10 +65,9 @@ BaseBody::~BaseBody(){
 }
 
 void BaseBody::RouteCollisionFeedbacksTo(std::function<void (const CollisionFeedback collisionFeedback)> callbackFunction){
-	if(CollisionFeedbackForwardFunctions.size()==0){
-		for(auto g=GeomPrimList.begin(); g!=GeomPrimList.end(); g++){
-			(*g)->RouteCollisionFeedbacksTo(boost::bind(&BaseBody::AddCollisionFeedback, this, _1));
-		};
+	// The primitives call the function directly, so a contact does not take a detour through the body.
+	for(auto g=GeomPrimList.begin(); g!=GeomPrimList.end(); g++){
+		(*g)->RouteCollisionFeedbacksTo(callbackFunction);
 	};
 	CollisionFeedbackForwardFunctions.push_back(callbackFunction);
 }
@@ -80,9 +80,11 @@ void BaseBody::AddCollisionFeedback(const CollisionFeedback collisionFeedback){
 
 void BaseBody::AdministerNewGeometricPrimitive(boost::shared_ptr<GeometricPrimitives::GeometricPrimitiveBase> primitive){
 	this->GeomPrimList.push_back(primitive);
-	if(CollisionFeedbackForwardFunctions.size()>0){
-		primitive->RouteCollisionFeedbacksTo(boost::bind(&BaseBody::AddCollisionFeedback, this, _1));
-	}
+	primitive->SetMaterial(Material);
+	primitive->SetMaterialId(MaterialId);
+	for(auto it=CollisionFeedbackForwardFunctions.begin(); it!=CollisionFeedbackForwardFunctions.end(); it++){
+		primitive->RouteCollisionFeedbacksTo(*it);
+	};
 };
 
 void BaseBody::AddSphere( dReal Radius, dRealVector3 offsetPosition, dRealMatrix3 offsetRotation, doubleArray3 color ){
@@ -150,10 +152,25 @@ std::string BaseBody::GetName() { return Name; }
 
 std::string BaseBody::GetMaterial() { return Material; }
 
+void BaseBody::SetMaterialId(unsigned int materialId){
+	MaterialId=materialId;
+	for(auto it=GeomPrimList.begin(); it!=GeomPrimList.end(); it++){
+		(*it)->SetMaterialId(materialId);
+	};
+}
+
 dBodyID BaseBody::GetBodyId() { return BodyId; }
 
 dSpaceID BaseBody::GetSpaceId() { return SpaceId; }
 
+void BaseBody::SaveState(StateWriter& writer){
+	(void)writer;
+}
+
+void BaseBody::RestoreState(StateReader& reader){
+	(void)reader;
+}
+
 void BaseBody::SetPosAndRotOfPrimitive(boost::shared_ptr<GeometricPrimitives::GeometricPrimitiveBase> primitive, dRealVector3 offsetPosition, dRealMatrix3 offsetRotation){
 	dGeomID tempGeomId=primitive->GetGeomId();
 	boost::numeric::ublas::vector<dReal> tempVec(3);
@@ -255,6 +272,39 @@ dRealVector3 RigidBody::GetRelMassOffset(){
 	return RelMassOffset;
 }
 
+void RigidBody::SaveState(StateWriter& writer){
+	writer.WriteDoubles(dBodyGetPosition(BodyId), 3);
+	writer.WriteDoubles(dBodyGetQuaternion(BodyId), 4);
+	writer.WriteDoubles(dBodyGetLinearVel(BodyId), 3);
+	writer.WriteDoubles(dBodyGetAngularVel(BodyId), 3);
+	writer.WriteDoubles(dBodyGetForce(BodyId), 3);
+	writer.WriteDoubles(dBodyGetTorque(BodyId), 3);
+	writer.WriteBool(dBodyIsEnabled(BodyId));
+}
+
+void RigidBody::RestoreState(StateReader& reader){
+	dVector3 position, linearVelocity, angularVelocity, force, torque;
+	dQuaternion quaternion;
+	reader.ReadDoubles(position, 3);
+	reader.ReadDoubles(quaternion, 4);
+	reader.ReadDoubles(linearVelocity, 3);
+	reader.ReadDoubles(angularVelocity, 3);
+	reader.ReadDoubles(force, 3);
+	reader.ReadDoubles(torque, 3);
+	bool isEnabled=reader.ReadBool();
+	dBodySetPosition(BodyId, position[0], position[1], position[2]);
+	dBodySetQuaternion(BodyId, quaternion);
+	dBodySetLinearVel(BodyId, linearVelocity[0], linearVelocity[1], linearVelocity[2]);
+	dBodySetAngularVel(BodyId, angularVelocity[0], angularVelocity[1], angularVelocity[2]);
+	dBodySetForce(BodyId, force[0], force[1], force[2]);
+	dBodySetTorque(BodyId, torque[0], torque[1], torque[2]);
+	if(isEnabled){
+		dBodyEnable(BodyId);
+	}else{
+		dBodyDisable(BodyId);
+	};
+}
+
 
 
 
@@ -19,6 +19,7 @@
 #include "DataTypes.hpp"
 #include "GeometricPrimitives.hpp"
 #include "OdeDrawstuff.hpp"
+#include "SimulationState.hpp"
 namespace Bodies{
 
 /*! \brief Objects in the simulated world are represented by RigidBodies (for movable objects) and StaticBodies (for non-movable objects).
@@ -51,6 +52,7 @@ class BaseBody{
 		dRealMatrix3 		InitialRotation;	
 		
 		std::string 		Material;
+		unsigned int		MaterialId=0;	//!< The ID of the material in the material table of the universe. It is passed on to all primitives of the body.
 		
 		std::bitset<32> 	CategoryBits;
 		std::bitset<32> 	CollideBits;
@@ -160,6 +162,12 @@ class BaseBody{
 		*/
 		std::string GetMaterial( );
 		
+		/*! \brief Set the ID of the material of this body and all of its primitives (see Universe::GetMaterialId).
+		*
+		*	\param materialId The ID the universe has assigned to the material of this body.
+		*/
+		void SetMaterialId(unsigned int materialId);
+		
 		/*! \brief Get the position of this RigidBody.
 		*
 		*	ODE does not support different positions for the center of mass and the
@@ -175,6 +183,15 @@ class BaseBody{
 		*
 		*/
 		virtual dRealMatrix3 GetRotation( )=0;
+		
+		/*! \brief Append the dynamic state of this body to a snapshot of the universe.
+		*
+		*	Static bodies do not have a dynamic state, so nothing is written.
+		*/
+		virtual void SaveState(StateWriter& writer);
+		
+		/*! \brief Restore the dynamic state written by SaveState. */
+		virtual void RestoreState(StateReader& reader);
 };
 
 
@@ -243,6 +260,16 @@ class RigidBody: public BaseBody
 		virtual void SetRotation(dRealMatrix3 NewRotationMatrix);
 		
 		dRealVector3 GetRelMassOffset();
+		
+		/*! \brief Append the position, orientation, velocities, accumulated forces and the enabled state of the body to a snapshot. */
+		virtual void SaveState(StateWriter& writer);
+		
+		/*! \brief Restore the state written by SaveState.
+		*
+		*	ODE normalises the quaternion when it is set, which may change its last bit. Furthermore, the idle counters of the auto-disabling start over.
+		*	Hence, a run that continues from a restored state may differ slightly from the run the snapshot was taken of. Runs restored from the same snapshot are identical, though.
+		*/
+		virtual void RestoreState(StateReader& reader);
 };
 
 class StaticBody: public BaseBody{
@@ -56,6 +56,16 @@ float GeometricPrimitiveBase::global_alpha = 1.0;
 	{
 		Material=newMaterial;
 	}
+	
+	unsigned int GeometricPrimitiveBase::GetMaterialId()
+	{
+		return MaterialId;
+	}
+	
+	void GeometricPrimitiveBase::SetMaterialId(unsigned int newMaterialId)
+	{
+		MaterialId=newMaterialId;
+	}
 
 	bool GeometricPrimitiveBase::isCollisionFeedbackUsed(){
 		return (CollisionFeedbackForwardFunctions.size()>0);
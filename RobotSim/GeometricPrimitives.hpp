@@ -25,6 +25,7 @@ class GeometricPrimitiveBase
 		dGeomID 	GeomId=0;
 		doubleArray3 	Color;		//!< Object color in RGB. This is only relevant for the visualization using the integrated 3D engine. 
 		std::string	Material;
+		unsigned int	MaterialId=0;	//!< The ID of the material in the material table of the universe. The collision callback uses it to look up the contact parameters without comparing strings.
 			/*! \brief Simple ExtendedPrimitive class constructor
 		 *
 		 *	The simple class constructor creates an extended primitive with no body associated with this geometry. 
@@ -78,6 +79,10 @@ class GeometricPrimitiveBase
 		
 		void SetMaterial(std::string newMaterial);
 		
+		unsigned int GetMaterialId();
+		
+		void SetMaterialId(unsigned int newMaterialId);
+		
 		virtual void Draw()=0;
 		
 		bool isCollisionFeedbackUsed();
@@ -338,11 +338,12 @@ void ProcessGeometricPrimitivesListNode(pugi::xml_node node, boost::shared_ptr<B
 }
 
 
-void ProcessBodyNode(pugi::xml_node node, boost::shared_ptr< Universe > uni, std::string defaultName, bool isStatic=false){
+void ProcessBodyNode(pugi::xml_node node, boost::shared_ptr< Universe > uni, std::string defaultName, std::string defaultSubSpace, bool isStatic=false){
 	pugi::xml_node tempNode;
 	
 	std::string name=getValue<std::string>(node, "Name", defaultName);
 	std::string material=getValue<std::string>(node, "Material", "StdMaterial");
+	std::string subSpace=getValue<std::string>(node, "SubSpace", isStatic ? "Environment" : defaultSubSpace);
 		
 	dRealVector3 initialPosition=boost::assign::list_of<dReal>(0)(0)(0);
 	tempNode=node.child("InitialPosition").child("Vector3");
@@ -384,7 +385,10 @@ void ProcessBodyNode(pugi::xml_node node, boost::shared_ptr< Universe > uni, std
 						initialPosition,
 						initialRotation,
 						massOffset,
-						material);
+						material,
+						0,
+						0,
+						subSpace);
 	}else{
 		newBody=uni->AddRigidBody(	name,
 						mass,
@@ -392,7 +396,10 @@ void ProcessBodyNode(pugi::xml_node node, boost::shared_ptr< Universe > uni, std
 						initialPosition,
 						initialRotation,
 						massOffset,
-						material);
+						material,
+						0,
+						0,
+						subSpace);
 	}
 	tempNode=node.child("GeometricPrimitivesList");
 	if(tempNode){
@@ -400,6 +407,69 @@ void ProcessBodyNode(pugi::xml_node node, boost::shared_ptr< Universe > uni, std
 	};
 }
 
+BroadphaseParameters ProcessBroadphaseNode(pugi::xml_node node){
+	pugi::xml_node tempNode;
+	BroadphaseParameters broadphase;
+	
+	std::string type=getValue<std::string>(node, "Broadphase", "Hash");
+	if(type=="Simple"){
+		broadphase.Type=BroadphaseParameters::Simple;
+	}else if(type=="Hash"){
+		broadphase.Type=BroadphaseParameters::Hash;
+	}else if(type=="SweepAndPrune"){
+		broadphase.Type=BroadphaseParameters::SweepAndPrune;
+	}else if(type=="QuadTree"){
+		broadphase.Type=BroadphaseParameters::QuadTree;
+	}else{
+		throw std::invalid_argument("The broadphase '" + type + "' is unknown. Valid broadphases are Simple, Hash, SweepAndPrune and QuadTree.");
+	};
+	
+	broadphase.MinLevel=getValue<int>(node, "MinLevel", broadphase.MinLevel);
+	broadphase.MaxLevel=getValue<int>(node, "MaxLevel", broadphase.MaxLevel);
+	
+	std::string axisOrder=getValue<std::string>(node, "AxisOrder", "XYZ");
+	std::map<std::string, int> axisOrders={{"XYZ", dSAP_AXES_XYZ}, {"XZY", dSAP_AXES_XZY}, {"YXZ", dSAP_AXES_YXZ}, {"YZX", dSAP_AXES_YZX}, {"ZXY", dSAP_AXES_ZXY}, {"ZYX", dSAP_AXES_ZYX}};
+	if(axisOrders.count(axisOrder)==0){
+		throw std::invalid_argument("The axis order '" + axisOrder + "' is unknown. It must be a permutation of XYZ.");
+	};
+	broadphase.AxisOrder=axisOrders[axisOrder];
+	
+	tempNode=node.child("Center").child("Vector3");
+	if(tempNode){
+		broadphase.Center=ProcessVector3Node(tempNode);
+	};
+	tempNode=node.child("Extents").child("Vector3");
+	if(tempNode){
+		broadphase.Extents=ProcessVector3Node(tempNode);
+	};
+	broadphase.Depth=getValue<int>(node, "Depth", broadphase.Depth);
+	return broadphase;
+}
+
+void ProcessUniverseNode(pugi::xml_node node, boost::shared_ptr< Universe > uni){
+	uni->SetBroadphase(ProcessBroadphaseNode(node)); // The broadphase takes effect when the universe is recreated.
+	uni->Clear(); // If a "Universe" node was defined in the xml, the universe should be recreated. This also resets the broadphases of the sub-spaces of the previous scene.
+	for(auto it=node.begin(); it!=node.end(); it++){
+		if(std::string(it->name())=="SubSpace"){
+			uni->SetSubSpaceBroadphase(getValue<std::string>(*it, "Name"), ProcessBroadphaseNode(*it));
+		};
+	};
+}
+
+void ProcessMaterialPairNode(pugi::xml_node node, boost::shared_ptr< Universe > uni){
+	std::string material1=getValue<std::string>(node, "Material1");
+	std::string material2=getValue<std::string>(node, "Material2");
+	
+	dReal frictionCoefficient=getValue<dReal>(node, "FrictionCoefficient", -1);
+	if(frictionCoefficient>=0){
+		uni->SetFrictionCoefficient(material1, material2, frictionCoefficient);
+	};
+	dReal restitutionCoefficient=getValue<dReal>(node, "RestitutionCoefficient", -1);
+	if(restitutionCoefficient>=0){
+		uni->SetRestitutionCoefficient(material1, material2, restitutionCoefficient);
+	};
+}
+
 void ProcessBioFlexRotatoryNode(pugi::xml_node node, boost::shared_ptr< Universe > uni){
 	pugi::xml_node tempNode;
 	
@@ -507,16 +577,23 @@ boost::shared_ptr< Universe > GeometryXmlParser::Process(std::istream& stream, b
 	
 	auto tempNode=doc.first_child().child("Universe");
 	if(tempNode){
-		uni->Clear(); // If a "Universe" node was defined in the xml, the universe should be recreated.
+		ProcessUniverseNode(tempNode, uni);
+	};
+	
+	for(auto it=doc.first_child().begin(); it!=doc.first_child().end(); it++){
+		if(std::string(it->name())=="MaterialPair"){
+			ProcessMaterialPairNode(*it, uni);
+		};
 	};
 	
 	unsigned int bodyCounter=0;
+	const std::string robotSubSpace=uni->GetUnusedSubSpaceName("Robot"); // Every document describes a robot of its own, so its rigid bodies get a sub-space of their own by default.
 	for(auto it=doc.first_child().begin(); it!=doc.first_child().end(); it++){
 		if(std::string(it->name())=="RigidBody"){
-			ProcessBodyNode(*it, uni, "BodyNo"+(boost::lexical_cast<std::string>( bodyCounter )), false);
+			ProcessBodyNode(*it, uni, "BodyNo"+(boost::lexical_cast<std::string>( bodyCounter )), robotSubSpace, false);
 			bodyCounter++;
 		}else if(std::string(it->name())=="StaticBody"){
-			ProcessBodyNode(*it, uni, "BodyNo"+(boost::lexical_cast<std::string>( bodyCounter )), true);
+			ProcessBodyNode(*it, uni, "BodyNo"+(boost::lexical_cast<std::string>( bodyCounter )), robotSubSpace, true);
 			bodyCounter++;
 		};
 	};
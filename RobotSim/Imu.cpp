@@ -116,6 +116,20 @@ void Imu::PostSimulationStepUpdate(double deltaT){
 	};
 };
 
+void Imu::SaveState(StateWriter& writer){
+	BfbClient::SaveState(writer);
+	writer.WriteVector3(RelAcceleration);
+	writer.WriteVector3(Velocity);
+	writer.WriteVector3(LastVelocity);
+}
+
+void Imu::RestoreState(StateReader& reader){
+	BfbClient::RestoreState(reader);
+	RelAcceleration=reader.ReadVector3();
+	Velocity=reader.ReadVector3();
+	LastVelocity=reader.ReadVector3();
+}
+
 boost::shared_ptr<BfbMessage> Imu::ProcessMessage(boost::shared_ptr<const BfbMessage> Message) {
 	auto reply=boost::shared_ptr<BfbMessage>(new BfbMessage(Message->GetRawData()));
 	reply->SetDestination(Message->GetSource());
@@ -42,6 +42,10 @@ class Imu : public BfbClient
 		virtual boost::shared_ptr<BfbMessage> ProcessMessage(boost::shared_ptr<const BfbMessage> Message);
 		
 		virtual void PostSimulationStepUpdate(double deltaT);
+		
+		/** \brief Append the velocities the acceleration is derived from to a snapshot. */
+		virtual void SaveState(StateWriter& writer);
+		virtual void RestoreState(StateReader& reader);
 };
 
 #endif // IMU_HPP
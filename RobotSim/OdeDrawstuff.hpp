@@ -2,8 +2,10 @@
 // The variable can be set either here or can be set in the compiler command via the -DdDouble option. 
 #ifndef ODEDRAWSTUFF_HPP
 #define ODEDRAWSTUFF_HPP
-#include <drawstuff/drawstuff.h>
 #include <ode/ode.h>
+#ifndef HEADLESS
+#include <drawstuff/drawstuff.h>
+#endif
 
 	/** If the physics engine should work with double precision, it is convenient to use the visualization also with double precision. 
 	* Therefore, all default single precision functions will be overwritten with their double precision equivalents.
@@ -15,4 +17,19 @@
 	#define dsDrawCapsule dsDrawCapsuleD
 	#define dsDrawLine dsDrawLineD
 	#define dsDrawConvex dsDrawConvexD 
+
+#ifdef HEADLESS
+	/** The headless build (see the "headless" target of the Makefile) does not link drawstuff and OpenGL. 
+	* The drawing functions used by the bodies and the message processor are replaced by functions that do nothing, so they can be used unchanged.
+	*/
+	inline void dsSetViewpoint(float xyz[3], float hpr[3]){}
+	inline void dsSetColorAlpha(float red, float green, float blue, float alpha){}
+	inline void dsDrawBoxD(const double pos[3], const double R[12], const double sides[3]){}
+	inline void dsDrawSphereD(const double pos[3], const double R[12], const float radius){}
+	inline void dsDrawTriangleD(const double pos[3], const double R[12], const double* v0, const double* v1, const double* v2, int solid){}
+	inline void dsDrawCylinderD(const double pos[3], const double R[12], float length, float radius){}
+	inline void dsDrawCapsuleD(const double pos[3], const double R[12], float length, float radius){}
+	inline void dsDrawLineD(const double pos1[3], const double pos2[3]){}
+	inline void dsDrawConvexD(const double pos[3], const double R[12], const double* planes, unsigned int planecount, const double* points, unsigned int pointcount, const unsigned int* polygons){}
+#endif
 #endif
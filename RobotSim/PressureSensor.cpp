@@ -24,16 +24,13 @@ PressureSensor::PressureSensor(unsigned char bioFlexBusId, boost::weak_ptr<Bodie
 			};// TODO: This should throw an error if the body cannot be locked.
 }
 
-void PressureSensor::AddCollisionFeedback(const CollisionFeedback collisionFeedback){
-	CollisionFeedbacks.push_back(CollisionFeedback(collisionFeedback));
+void PressureSensor::AddCollisionFeedback(const CollisionFeedback& collisionFeedback){
+	NewForces.push_back(collisionFeedback.FeedbackForce);
 };
 
 void PressureSensor::PostSimulationStepUpdate(double deltaT){
-	Forces.clear();
-	for(auto it=CollisionFeedbacks.begin(); it!=CollisionFeedbacks.end(); it++){
-		Forces.push_back(it->FeedbackForce);
-	};
-	CollisionFeedbacks.clear();
+	Forces.swap(NewForces);
+	NewForces.clear();
 }
 
 dReal PressureSensor::GetHighestPressure(){
@@ -48,6 +45,22 @@ dReal PressureSensor::GetHighestPressure(){
 	return highestPressure;
 }
 
+void PressureSensor::SaveState(StateWriter& writer){
+	BfbClient::SaveState(writer);
+	writer.WriteUint(Forces.size());
+	for(auto it=Forces.begin(); it!=Forces.end(); it++){
+		writer.WriteVector3(*it);
+	};
+}
+
+void PressureSensor::RestoreState(StateReader& reader){
+	BfbClient::RestoreState(reader);
+	Forces.clear();
+	for(uint64_t numOfForces=reader.ReadUint(); numOfForces>0; numOfForces--){
+		Forces.push_back(reader.ReadVector3());
+	};
+}
+
 boost::shared_ptr<BfbMessage> PressureSensor::ProcessMessage(boost::shared_ptr<const BfbMessage> message){
 	auto reply=boost::shared_ptr<BfbMessage>(new BfbMessage(message->GetRawData()));
 	reply->SetDestination(message->GetSource());
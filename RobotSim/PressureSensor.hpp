@@ -2,8 +2,8 @@
 #define PRESSURESENSOR_HPP
 
 // STL includes
-#include <list>
 #include <utility>
+#include <vector>
 
 // Boost includes
 #include <boost/assign.hpp>
@@ -20,8 +20,11 @@
 class PressureSensor : public BfbClient{
 	
 	private:
-		std::list<CollisionFeedback> CollisionFeedbacks={};
-		std::list<dRealVector3> Forces={}; // pressure values of the cells 
+		/** \brief The forces of the contacts of the current step. 
+		 * 	The vectors are swapped after every step and cleared instead of being freed, so the sensor does not allocate memory once they have grown to the largest number of contacts per step.
+		 */
+		std::vector<dRealVector3> NewForces={};
+		std::vector<dRealVector3> Forces={}; // pressure values of the cells of the last step
 		boost::weak_ptr<Bodies::BaseBody> Body;
 	public:
 		PressureSensor(const PressureSensor&) = delete;
@@ -31,12 +34,16 @@ class PressureSensor : public BfbClient{
 
 		virtual ~PressureSensor() { };
 
-		void AddCollisionFeedback(const CollisionFeedback collisionFeedback);
+		void AddCollisionFeedback(const CollisionFeedback& collisionFeedback);
 		
 		dReal GetHighestPressure();
 
 		virtual void PostSimulationStepUpdate(double deltaT); 
 		virtual boost::shared_ptr<BfbMessage> ProcessMessage(boost::shared_ptr<const BfbMessage> message);
+		
+		/** \brief Append the forces of the last simulation step to a snapshot. The forces of the current step are collected during a step only, so they are always empty between two steps. */
+		virtual void SaveState(StateWriter& writer);
+		virtual void RestoreState(StateReader& reader);
 };
 
 #endif // PRESSURESENSOR_HPP
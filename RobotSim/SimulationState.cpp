@@ -0,0 +1,98 @@
+// STL includes
+#include <string.h>
+#include <stdexcept>
+
+// Own header files
+#include "SimulationState.hpp"
+
+void StateWriter::WriteUint(uint64_t value){
+	for(unsigned int i=0; i<8; i++){
+		Data.push_back((value>>(8*i)) & 0xFF);
+	};
+}
+
+void StateWriter::WriteBool(bool value){
+	Data.push_back(value ? 1 : 0);
+}
+
+void StateWriter::WriteDouble(double value){
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	WriteUint(bits);
+}
+
+void StateWriter::WriteDoubles(const dReal* values, size_t numOfValues){
+	for(size_t i=0; i<numOfValues; i++){
+		WriteDouble(values[i]);
+	};
+}
+
+void StateWriter::WriteVector3(const dRealVector3& vector){
+	WriteDoubles(vector.data(), vector.size());
+}
+
+void StateWriter::WriteString(const std::string& value){
+	WriteUint(value.size());
+	Data.insert(Data.end(), value.begin(), value.end());
+}
+
+const std::vector<unsigned char>& StateWriter::GetData() const{
+	return Data;
+}
+
+StateReader::StateReader(const std::vector<unsigned char>& data):
+	Data(data){
+}
+
+size_t StateReader::Advance(size_t numOfBytes){
+	if(numOfBytes>Data.size()-Position){
+		throw std::invalid_argument("The simulation state ends unexpectedly.");
+	};
+	size_t position=Position;
+	Position+=numOfBytes;
+	return position;
+}
+
+uint64_t StateReader::ReadUint(){
+	size_t position=Advance(8);
+	uint64_t value=0;
+	for(unsigned int i=0; i<8; i++){
+		value|=static_cast<uint64_t>(Data[position+i])<<(8*i);
+	};
+	return value;
+}
+
+bool StateReader::ReadBool(){
+	return Data[Advance(1)]!=0;
+}
+
+double StateReader::ReadDouble(){
+	uint64_t bits=ReadUint();
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+void StateReader::ReadDoubles(dReal* values, size_t numOfValues){
+	for(size_t i=0; i<numOfValues; i++){
+		values[i]=ReadDouble();
+	};
+}
+
+dRealVector3 StateReader::ReadVector3(){
+	dRealVector3 vector;
+	ReadDoubles(vector.data(), vector.size());
+	return vector;
+}
+
+std::string StateReader::ReadString(){
+	size_t length=ReadUint();
+	size_t position=Advance(length);
+	return std::string(Data.begin()+position, Data.begin()+position+length);
+}
+
+void StateReader::ExpectEnd(){
+	if(Position!=Data.size()){
+		throw std::invalid_argument("The simulation state is longer than expected.");
+	};
+}
@@ -0,0 +1,56 @@
+#ifndef SIMULATIONSTATE_HPP
+#define SIMULATIONSTATE_HPP
+
+// STL includes
+#include <stdlib.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Own header files
+#include "DataTypes.hpp"
+
+/** \brief Writes the state of a simulation into a compact binary blob (see Universe::SaveState).
+ * 	Integers are stored little endian. Real numbers are stored as the raw bytes of a double, so they are restored bit for bit.
+ */
+class StateWriter{
+	public:
+		void WriteUint(uint64_t value);
+		void WriteBool(bool value);
+		void WriteDouble(double value);
+		void WriteDoubles(const dReal* values, size_t numOfValues);
+		void WriteVector3(const dRealVector3& vector);
+		void WriteString(const std::string& value);
+
+		const std::vector<unsigned char>& GetData() const;
+	private:
+		std::vector<unsigned char> Data;
+};
+
+/** \brief Reads a blob written by a StateWriter in the same order as it was written.
+ * 	All read functions throw a std::invalid_argument if the blob ends too early.
+ */
+class StateReader{
+	public:
+		StateReader(const std::vector<unsigned char>& data);
+
+		uint64_t ReadUint();
+		bool ReadBool();
+		double ReadDouble();
+		void ReadDoubles(dReal* values, size_t numOfValues);
+		dRealVector3 ReadVector3();
+		std::string ReadString();
+
+		/** \brief Check that the whole blob has been read.
+		 * 	\throws std::invalid_argument if there are bytes left, e.g. because the blob belongs to a different scene.
+		 */
+		void ExpectEnd();
+	private:
+		const std::vector<unsigned char>& Data;
+		size_t Position=0;
+
+		/** \brief Get the position of the next numOfBytes bytes and skip them. */
+		size_t Advance(size_t numOfBytes);
+};
+
+#endif
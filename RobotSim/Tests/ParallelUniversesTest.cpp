@@ -0,0 +1,85 @@
+// STL includes
+#include <stdlib.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// Boost includes
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+// Own header files
+#include "../GeometryXmlParser.hpp"
+#include "../SimulationState.hpp"
+#include "../Universe.hpp"
+
+/** \brief Steps several universes in parallel threads and compares their states bit for bit with the same universes stepped one after another.
+ * 	If the machine has more than one core, the parallel steps must also take clearly less time than the serial ones, so the universes do not wait for each other.
+ * 	The test is run from the RobotSim folder, since it loads the default universe and robot from there.
+ */
+
+const unsigned int numOfUniverses=4;
+const uint64_t numOfTicks=2000;
+const double maxParallelTimeRatio=0.75; //!< The maximum ratio of the time of the parallel steps to the time of the serial steps on a machine with more than one core.
+
+/** \brief Create a universe with the default robot standing on the ground. */
+boost::shared_ptr<Universe> createUniverse(){
+	auto universe=boost::make_shared<Universe>();
+	GeometryXmlParser::Process("DefaultUniverse.xml", universe);
+	GeometryXmlParser::Process("DefaultRobot.xml", universe);
+	return universe;
+}
+
+/** \brief Step a universe and take a snapshot of it. The universes step a different number of ticks, so their states differ from each other. */
+void stepUniverse(boost::shared_ptr<Universe> universe, unsigned int index, std::vector<unsigned char>& state){
+	universe->Step(numOfTicks+index*100);
+	StateWriter writer;
+	universe->SaveState(writer);
+	state=writer.GetData();
+}
+
+int main(int argc, char **argv){
+	std::vector<std::vector<unsigned char>> serialStates(numOfUniverses);
+	std::chrono::steady_clock::duration serialTime=std::chrono::steady_clock::duration::zero();
+	for(unsigned int i=0; i<numOfUniverses; i++){
+		auto universe=createUniverse();
+		auto start=std::chrono::steady_clock::now();
+		stepUniverse(universe, i, serialStates[i]);
+		serialTime+=std::chrono::steady_clock::now()-start;
+	};
+
+	std::vector<boost::shared_ptr<Universe>> universes;
+	for(unsigned int i=0; i<numOfUniverses; i++){
+		universes.push_back(createUniverse());
+	};
+	std::vector<std::vector<unsigned char>> parallelStates(numOfUniverses);
+	boost::thread_group threads;
+	auto start=std::chrono::steady_clock::now();
+	for(unsigned int i=0; i<numOfUniverses; i++){
+		threads.create_thread(boost::bind(&stepUniverse, universes[i], i, boost::ref(parallelStates[i])));
+	};
+	threads.join_all();
+	std::chrono::steady_clock::duration parallelTime=std::chrono::steady_clock::now()-start;
+
+	unsigned int numOfDifferences=0;
+	for(unsigned int i=0; i<numOfUniverses; i++){
+		if(parallelStates[i]!=serialStates[i]){
+			std::cout<<"The universe "<<i<<" differs when it is stepped in parallel to the others."<<std::endl;
+			numOfDifferences++;
+		};
+	};
+	if(numOfDifferences>0){
+		return EXIT_FAILURE;
+	};
+	std::cout<<"The "<<numOfUniverses<<" universes stepped in parallel equal the ones stepped one after another."<<std::endl;
+	
+	double timeRatio=std::chrono::duration<double>(parallelTime).count()/std::chrono::duration<double>(serialTime).count();
+	std::cout<<"The parallel steps took "<<timeRatio<<" times as long as the serial ones."<<std::endl;
+	if(boost::thread::hardware_concurrency()>=2 && timeRatio>maxParallelTimeRatio){
+		std::cout<<"The universes did not step in parallel. The ratio must not exceed "<<maxParallelTimeRatio<<" on a machine with "<<boost::thread::hardware_concurrency()<<" cores."<<std::endl;
+		return EXIT_FAILURE;
+	};
+	return EXIT_SUCCESS;
+}
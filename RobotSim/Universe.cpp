@@ -1,4 +1,6 @@
 // STL includes
+#include <algorithm>
+#include <cmath>
 #include <stdexcept>
 #include <string>
 
@@ -6,6 +8,7 @@
 #include <boost/assign/list_of.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/thread/lock_guard.hpp>
 
 // Own header files
 #include "BfbClient.hpp"
@@ -15,7 +18,9 @@
 #include "PressureSensor.hpp"
 #include "Universe.hpp"
 
-#ifdef __APPLE__
+#ifdef HEADLESS
+// The headless build does not draw anything.
+#elif defined __APPLE__
 #include <OpenGL/gl.h>
 #include <OpenGL/glu.h>
 #else
@@ -25,17 +30,25 @@
 
 /*! \brief Class constructor for the Universe class. */
 unsigned int Universe::NumOfInstances=0;
+boost::mutex Universe::InstancesMutex;
+std::atomic<unsigned int> Universe::OdeInitialisationCount(0);
 Universe::Universe():
-	FrictionCoefficientMap(StrFrictionCoefficientMap()),
+	MaterialIdMap(StrMaterialIdMap()),
+	MaterialPairTable(),
 	BodyMap(StrBodyMap()),
 //	IntModelEndPointDeque(InternalModelPointDeque()),
 	BfbClientMap(UCharBfbClientMap()),
     IntModelLineDeque(InternalModelLineDeque()){	
-	NumOfInstances++;
-	if(NumOfInstances==1){ // If this is the first instance of the universe, the physics engine must be explicitly initialized.
-		dInitODE();
-	};
+	{
+		boost::lock_guard<boost::mutex> lock(InstancesMutex);
+		NumOfInstances++;
+		if(NumOfInstances==1){ // If this is the first instance of the universe, the physics engine must be explicitly initialized.
+			dInitODE2(0);
+			OdeInitialisationCount++;
+		};
+	}
 	
+	GetMaterialId("default"); // The primitives use the ID 0 until they are added to a body.
 	CreateUniverse();
 }
 
@@ -46,16 +59,27 @@ Universe::~Universe()
 {
 	DestroyUniverse();
 	
+	boost::lock_guard<boost::mutex> lock(InstancesMutex);
 	NumOfInstances--;
 	if(NumOfInstances==0){ // If the instance that is currently being destroyed was the last instance, the physics engine can be deinitialized.
 		dCloseODE();
 	};
 }
 
+void Universe::PrepareOdeForThisThread(){
+	static thread_local unsigned int preparedInitialisation=0; // The initialisation of the physics engine the data of this thread was allocated for.
+	if(preparedInitialisation==OdeInitialisationCount){ // This is the case for every step but the first one of a thread, so the steps do not take the lock.
+		return;
+	};
+	boost::lock_guard<boost::mutex> lock(InstancesMutex);
+	dAllocateODEDataForThread(dAllocateMaskAll);
+	preparedInitialisation=OdeInitialisationCount;
+}
+
 void Universe::CreateUniverse(){
-	dRandSetSeed(42); // In order to get a deteministic behaviour, the (pseudo-) random number generator is seeded with a constant number. "42" is chosen because it is the answer to the question "What is the perfect seed for the pseudo random number generator?".
+	PrepareOdeForThisThread();
 	WorldId=dWorldCreate();	// create a new world in which dynamic bodies can be simulated. This will be the world all the objects in the universe will be placed into.
-	SpaceId=dHashSpaceCreate(0);	// crate a new space for collision detection. The parameter defines the ID of a parent space the newly created space should be placed into. Setting this value to zero creates a new base space.
+	SpaceId=CreateSpace(Broadphase, 0);	// crate a new space for collision detection. The parameter defines the ID of a parent space the newly created space should be placed into. Setting this value to zero creates a new base space.
 	ContactGroupId=dJointGroupCreate(0); 	// create the collision joint group. The parameter is deprecated, therefore should be set to zero.
 
 	dWorldSetGravity(this->WorldId, this->Gravity.at(0), this->Gravity.at(1), this->Gravity.at(2));
@@ -79,11 +103,17 @@ void Universe::DestroyUniverse(){
 	BfbClientMap.clear(); 	// Delete all BioFlex Rotatory drives within this universe.
 	dWorldDestroy(this->WorldId); 	// Destroy the world that was used for the dynamics simulation.
 	dSpaceDestroy(this->SpaceId); 	// Destroy the space that was used for collision detection.
+	SubSpaceMap.clear();		// The sub-spaces have been destroyed together with the space.
+	dJointGroupDestroy(this->ContactGroupId); 	// Destroy the group of the collision joints.
 }
 
 
 void Universe::Clear(){
 	DestroyUniverse();
+	StrMaterialIdMap().swap(MaterialIdMap); // No body uses the materials anymore, so their IDs can be reassigned.
+	std::vector<MaterialPairParameters>().swap(MaterialPairTable);
+	StrBroadphaseParametersMap().swap(SubSpaceBroadphaseMap); // The sub-spaces of the new scene may have the same names but different contents.
+	GetMaterialId("default");
 	CreateUniverse();
 }
 
@@ -111,44 +141,49 @@ void Universe::NearCallback(void* InstancePointer, dGeomID primitive1, dGeomID p
 	if ( dGeomIsSpace(primitive1) || dGeomIsSpace(primitive2) ) { 
 		// colliding a space with something :
 		dSpaceCollide2(primitive1, primitive2, InstancePointer, &NearCallback); 
-		// collide all geoms internal to the space(s)
-		if ( dGeomIsSpace(primitive1) )
-			dSpaceCollide((dSpaceID)primitive1, InstancePointer, &NearCallback);
-		if ( dGeomIsSpace (primitive2) )
-			dSpaceCollide((dSpaceID)primitive2, InstancePointer, &NearCallback);
+		// The geoms within a space are not collided here: the sub-spaces are collided within themselves once per step and the geoms within the space of a single body cannot collide with each other.
 	} else {
 		dBodyID bodyId1 = dGeomGetBody(primitive1);
 		dBodyID bodyId2 = dGeomGetBody(primitive2);
+		if(!bodyId1 && !bodyId2){ // Static geoms never move, so contacts between them have no effect.
+			return;
+		};
 
 		auto geomPrim1=(GeometricPrimitives::GeometricPrimitiveBase*)(dGeomGetData(primitive1)); 
 		auto geomPrim2=(GeometricPrimitives::GeometricPrimitiveBase*)(dGeomGetData(primitive2)); 
 		
 		dReal friction=THIS->StdFrictionCoefficient;
+		dReal restitution=0;
 		if(geomPrim1 && geomPrim2){
-			friction=THIS->GetFrictionCoefficient(geomPrim1->GetMaterial(), geomPrim2->GetMaterial());
-			// If it is necessary to also have a custom coefficient of restitution, it could be implemented just like the friction coefficient.
+			const MaterialPairParameters& parameters=THIS->GetMaterialPairParameters(geomPrim1->GetMaterialId(), geomPrim2->GetMaterialId());
+			friction=parameters.FrictionCoefficient;
+			restitution=parameters.RestitutionCoefficient;
 		};
 		const unsigned int numOfContacts = dCollide (primitive1,primitive2,THIS->MaxCollisionContacts,&(contacts[0].geom),sizeof(dContact));
 		for(unsigned int i=0;i<numOfContacts;i++){
-			contacts[i].surface.mode = dContactApprox1;// | dContactBounce | dContactSoftCFM;
+			contacts[i].surface.mode = dContactApprox1;// | dContactSoftCFM;
 			// friction parameter
 			contacts[i].surface.mu = friction;
+			if(restitution>0){
+				contacts[i].surface.mode |= dContactBounce;
+				contacts[i].surface.bounce = restitution;
+				contacts[i].surface.bounce_vel = THIS->MinBounceVelocity;
+			};
 			const dJointID contactJoint = dJointCreateContact(THIS->WorldId,THIS->ContactGroupId,&contacts[i]);
 			dJointAttach (contactJoint,bodyId1,bodyId2);
 			bool geom1UsesFeedback=geomPrim1 && geomPrim1->isCollisionFeedbackUsed();
 			bool geom2UsesFeedback=geomPrim2 && geomPrim2->isCollisionFeedbackUsed();
 			if(geom1UsesFeedback || geom2UsesFeedback){
-				auto tempCollData=boost::make_shared<CollisionData>();
-				THIS->CollisionDataList.push_back(tempCollData);
-				tempCollData->JointId=contactJoint;
-				tempCollData->ContactGeom=contacts[i].geom;
-				if(geom1UsesFeedback){
-					tempCollData->geom1=geomPrim1;
+				if(THIS->NumOfCollisionData==THIS->CollisionDataArena.size()){
+					THIS->CollisionDataArena.emplace_back();
 				};
-				if(geom2UsesFeedback){
-					tempCollData->geom2=geomPrim2;
-				}
-				dJointSetFeedback (contactJoint, &(tempCollData->JointFeedback));
+				CollisionData& collisionData=THIS->CollisionDataArena[THIS->NumOfCollisionData];
+				THIS->NumOfCollisionData++;
+				collisionData.JointId=contactJoint;
+				collisionData.ContactGeom=contacts[i].geom;
+				collisionData.geom1=geom1UsesFeedback ? geomPrim1 : nullptr;
+				collisionData.geom2=geom2UsesFeedback ? geomPrim2 : nullptr;
+				dJointSetFeedback (contactJoint, &(collisionData.JointFeedback));
 			};
 		};
 	};
@@ -156,27 +191,59 @@ void Universe::NearCallback(void* InstancePointer, dGeomID primitive1, dGeomID p
 
 void Universe::Simulate(double deltaT)
 {
-	static double desiredTime=0;
-
 	if(deltaT>0){
-		desiredTime+=deltaT;
-		unsigned int numOfIterations=floor((desiredTime-Time)*SimFrequency);
-		for(unsigned int i=0;i<=numOfIterations;i++){
+		DesiredTime+=deltaT;
+		double numOfTicks=round((DesiredTime-TimeAtFrequencyChange)*SimFrequency);
+		uint64_t desiredTickCount=TickCountAtFrequencyChange+static_cast<uint64_t>(std::max(numOfTicks, 0.0));
+		if(desiredTickCount>TickCount){
+			SimulateTicks(desiredTickCount-TickCount);
+		};
+	};
+}
+
+void Universe::SimulateUntill(double absTime){
+	if(absTime>DesiredTime){
+		Simulate(absTime-DesiredTime);
+	};
+}
+
+void Universe::StepUntil(uint64_t tickCount){
+	if(tickCount>TickCount){
+		Step(tickCount-TickCount);
+	};
+}
+
+void Universe::Step(uint64_t numOfTicks){
+	SimulateTicks(numOfTicks);
+	DesiredTime=std::max(DesiredTime, GetTime()); // Otherwise, the next call of Simulate would start from the time before these steps.
+}
+
+void Universe::SimulateTicks(uint64_t numOfTicks)
+{
+	if(numOfTicks>0){
+		PrepareOdeForThisThread();
+		for(uint64_t tick=0;tick<numOfTicks;tick++){
+			NumOfCollisionData=0;
 			// find collisions and add contact joints
-			dSpaceCollide (SpaceId,this,&Universe::NearCallback);
+			for(auto subSpace=SubSpaceMap.begin(); subSpace!=SubSpaceMap.end(); subSpace++){
+				if(dGeomGetCategoryBits((dGeomID)subSpace->second) & dGeomGetCollideBits((dGeomID)subSpace->second)){ // Otherwise, the bodies in the sub-space cannot collide with each other (e.g. the static environment).
+					dSpaceCollide (subSpace->second,this,&Universe::NearCallback);
+				};
+			};
+			dSpaceCollide (SpaceId,this,&Universe::NearCallback); // This collides the sub-spaces with each other.
 			
 			// simulate the dynamics
 			dWorldQuickStep (this->WorldId ,1/(this->SimFrequency));  
 			
-			for(auto it=CollisionDataList.begin(); it!=CollisionDataList.end(); it++){
+			for(auto it=CollisionDataArena.begin(); it!=CollisionDataArena.begin()+NumOfCollisionData; it++){
 				CollisionFeedback tempFeedback1;
 				CollisionFeedback tempFeedback2;
-				dReal* tempPos=(*it)->ContactGeom.pos;
-				dReal* tempNormal=(*it)->ContactGeom.normal;
-				dReal* tempForce1=(*it)->JointFeedback.f1;
-				dReal* tempForce2=(*it)->JointFeedback.f2;
-				dReal* tempTorque1=(*it)->JointFeedback.t1;
-				dReal* tempTorque2=(*it)->JointFeedback.t2;
+				dReal* tempPos=it->ContactGeom.pos;
+				dReal* tempNormal=it->ContactGeom.normal;
+				dReal* tempForce1=it->JointFeedback.f1;
+				dReal* tempForce2=it->JointFeedback.f2;
+				dReal* tempTorque1=it->JointFeedback.t1;
+				dReal* tempTorque2=it->JointFeedback.t2;
 				for(unsigned int i=0; i<3; i++){
 					tempFeedback1.AbsPosition[i]=tempPos[i];
 					tempFeedback2.AbsPosition[i]=tempPos[i];
@@ -187,14 +254,13 @@ void Universe::Simulate(double deltaT)
 					tempFeedback1.FeedbackTorque[i]=tempTorque1[i];
 					tempFeedback2.FeedbackTorque[i]=tempTorque2[i];
 				};
-				if((*it)->geom1){
-					(*it)->geom1->AddCollisionFeedback(tempFeedback1);
+				if(it->geom1){
+					it->geom1->AddCollisionFeedback(tempFeedback1);
 				};
-				if((*it)->geom2){
-					(*it)->geom2->AddCollisionFeedback(tempFeedback2);
+				if(it->geom2){
+					it->geom2->AddCollisionFeedback(tempFeedback2);
 				}
 			};
-			CollisionDataList.clear();
 			
 			// clear the collision joints for the next iteration.
 			dJointGroupEmpty(this->ContactGroupId);
@@ -205,15 +271,11 @@ void Universe::Simulate(double deltaT)
 			};
 			
 			// update the local simulation time
-			Time+=1.0/SimFrequency;
+			TickCount++;
 		};
 	};
 }
 
-void Universe::SimulateUntill(double absTime){
-	Simulate(absTime-Time);
-}
-
 /*
 void Universe::Simulate(boost::posix_time::time_duration deltaT){
 	Simulate(double(deltaT.total_microseconds())/pow(10,6));
@@ -224,6 +286,7 @@ void Universe::Draw(){
 	for(StrBodyMap::iterator i=BodyMap.begin();i!=BodyMap.end();i++){
 		i->second->Draw();
 	};
+#ifndef HEADLESS
 	if (!IntModelLineDeque.empty()) {
 		glDepthFunc(GL_ALWAYS);
 		for(InternalModelLineDeque::iterator it=IntModelLineDeque.begin(); it!=IntModelLineDeque.end(); it++){
@@ -239,6 +302,7 @@ void Universe::Draw(){
 			
 		}
 	}
+#endif
 };
 
 boost::shared_ptr<Bodies::RigidBody> Universe::AddRigidBody(	std::string name,
@@ -249,12 +313,13 @@ boost::shared_ptr<Bodies::RigidBody> Universe::AddRigidBody(	std::string name,
 						dRealVector3 relMassOffset,
 						std::string material,
 						std::bitset<32> categoryBits,
-						std::bitset<32> collideBits){
+						std::bitset<32> collideBits,
+						std::string subSpace){
 	if(BodyMap.count(name)==1){
 		throw std::invalid_argument("A Body with the name " + name + " already exists.");
 	};
 	boost::shared_ptr<Bodies::RigidBody> body(new Bodies::RigidBody(WorldId,
-							SpaceId,
+							GetSubSpaceId(subSpace),
 							name,
 							mass,
 							inertiaTensor,
@@ -264,6 +329,8 @@ boost::shared_ptr<Bodies::RigidBody> Universe::AddRigidBody(	std::string name,
 							material,
 							categoryBits,
 							collideBits));
+	body->SetMaterialId(GetMaterialId(material));
+	UpdateSubSpaceBits(subSpace, body);
 	BodyMap[name]=static_cast<boost::shared_ptr<Bodies::BaseBody>>(body);
 	return body;
 };
@@ -273,17 +340,22 @@ boost::shared_ptr<Bodies::StaticBody> Universe::AddStaticBody(	std::string name,
 							dRealMatrix3 initialRotation,
 							std::string material,
 							std::bitset<32> categoryBits,
-							std::bitset<32> collideBits){
+							std::bitset<32> collideBits,
+							std::string subSpace){
 	if(BodyMap.count(name)==1){
 		throw std::invalid_argument("A Body with the name " + name + " already exists.");
 	};
-	boost::shared_ptr<Bodies::StaticBody> body(new Bodies::StaticBody(	SpaceId,
+	boost::shared_ptr<Bodies::StaticBody> body(new Bodies::StaticBody(	GetSubSpaceId(subSpace),
 										name,
 										initialPosition,
 										initialRotation,
 										material,
 										categoryBits,
 										collideBits));
+	body->SetMaterialId(GetMaterialId(material));
+	dGeomSetCategoryBits((dGeomID)body->GetSpaceId(), StaticBodyCategoryBits);
+	dGeomSetCollideBits((dGeomID)body->GetSpaceId(), ~StaticBodyCategoryBits);
+	UpdateSubSpaceBits(subSpace, body);
 	BodyMap[name]=body;
 	return body;
 };
@@ -296,7 +368,8 @@ boost::shared_ptr<Bodies::StaticBody> Universe::AddStaticBody(	std::string name,
 								dRealVector3 relMassOffset,
 								std::string material,
 								std::bitset<32> categoryBits,
-								std::bitset<32> collideBits){
+								std::bitset<32> collideBits,
+								std::string subSpace){
 	(void)mass;
 	(void)inertiaTensor;
 	(void)relMassOffset;
@@ -305,7 +378,69 @@ boost::shared_ptr<Bodies::StaticBody> Universe::AddStaticBody(	std::string name,
 				initialRotation,
 				material,
 				categoryBits,
-				collideBits);
+				collideBits,
+				subSpace);
+}
+
+dSpaceID Universe::CreateSpace(const BroadphaseParameters& broadphase, dSpaceID parentSpaceId){
+	dSpaceID spaceId=0;
+	switch(broadphase.Type){
+		case BroadphaseParameters::Simple:
+			spaceId=dSimpleSpaceCreate(parentSpaceId);
+			break;
+		case BroadphaseParameters::Hash:
+			spaceId=dHashSpaceCreate(parentSpaceId);
+			dHashSpaceSetLevels(spaceId, broadphase.MinLevel, broadphase.MaxLevel);
+			break;
+		case BroadphaseParameters::SweepAndPrune:
+			spaceId=dSweepAndPruneSpaceCreate(parentSpaceId, broadphase.AxisOrder);
+			break;
+		case BroadphaseParameters::QuadTree:
+			{
+			dVector3 center={broadphase.Center[0], broadphase.Center[1], broadphase.Center[2]};
+			dVector3 extents={broadphase.Extents[0], broadphase.Extents[1], broadphase.Extents[2]};
+			spaceId=dQuadTreeSpaceCreate(parentSpaceId, center, extents, broadphase.Depth);
+			break;
+			};
+	};
+	return spaceId;
+}
+
+dSpaceID Universe::GetSubSpaceId(std::string name){
+	auto subSpace=SubSpaceMap.find(name);
+	if(subSpace!=SubSpaceMap.end()){
+		return subSpace->second;
+	};
+	BroadphaseParameters broadphase;
+	auto subSpaceBroadphase=SubSpaceBroadphaseMap.find(name);
+	if(subSpaceBroadphase!=SubSpaceBroadphaseMap.end()){
+		broadphase=subSpaceBroadphase->second;
+	};
+	dSpaceID subSpaceId=CreateSpace(broadphase, SpaceId);
+	// The bits are extended by every body that is added to the sub-space.
+	dGeomSetCategoryBits((dGeomID)subSpaceId, 0);
+	dGeomSetCollideBits((dGeomID)subSpaceId, 0);
+	SubSpaceMap[name]=subSpaceId;
+	return subSpaceId;
+}
+
+void Universe::UpdateSubSpaceBits(std::string name, boost::shared_ptr<Bodies::BaseBody> body){
+	dGeomID subSpaceId=(dGeomID)GetSubSpaceId(name);
+	dGeomID bodySpaceId=(dGeomID)body->GetSpaceId();
+	dGeomSetCategoryBits(subSpaceId, dGeomGetCategoryBits(subSpaceId) | dGeomGetCategoryBits(bodySpaceId));
+	dGeomSetCollideBits(subSpaceId, dGeomGetCollideBits(subSpaceId) | dGeomGetCollideBits(bodySpaceId));
+}
+
+void Universe::SetBroadphase(BroadphaseParameters broadphase) { this->Broadphase=broadphase; }
+
+void Universe::SetSubSpaceBroadphase(std::string name, BroadphaseParameters broadphase) { this->SubSpaceBroadphaseMap[name]=broadphase; }
+
+std::string Universe::GetUnusedSubSpaceName(std::string prefix){
+	std::string name=prefix;
+	for(unsigned int number=2; SubSpaceMap.count(name)==1; number++){
+		name=prefix+boost::lexical_cast<std::string>(number);
+	};
+	return name;
 }
 
 void Universe::DeleteBody(std::string name){
@@ -383,15 +518,103 @@ dWorldID Universe::GetWorldId() { return this->WorldId; }
 
 dSpaceID Universe::GetSpaceId() { return this->SpaceId; }
 
-dReal Universe::GetTime() { return this->Time; }
+dReal Universe::GetTime() { return this->TimeAtFrequencyChange+(this->TickCount-this->TickCountAtFrequencyChange)/this->SimFrequency; }
+
+uint64_t Universe::GetTickCount() { return this->TickCount; }
+
+static const std::string StateIdentifier="RobotSimState"; // Precedes every snapshot, so other data is rejected before it is restored.
+static const uint64_t StateVersion=2; // Must be incremented whenever the layout of the snapshots changes.
+
+void Universe::SaveState(StateWriter& writer){
+	writer.WriteString(StateIdentifier);
+	writer.WriteUint(StateVersion);
+	// The structure is written first, so it can be checked before anything is restored.
+	writer.WriteUint(BodyMap.size());
+	for(auto it=BodyMap.begin(); it!=BodyMap.end(); it++){
+		writer.WriteString(it->first);
+	};
+	writer.WriteUint(BfbClientMap.size());
+	for(auto it=BfbClientMap.begin(); it!=BfbClientMap.end(); it++){
+		writer.WriteUint(it->first);
+	};
+	
+	writer.WriteDouble(SimFrequency);
+	writer.WriteUint(TickCount);
+	writer.WriteUint(TickCountAtFrequencyChange);
+	writer.WriteDouble(TimeAtFrequencyChange);
+	writer.WriteDouble(DesiredTime);
+	for(auto it=BodyMap.begin(); it!=BodyMap.end(); it++){
+		it->second->SaveState(writer);
+	};
+	for(auto it=BfbClientMap.begin(); it!=BfbClientMap.end(); it++){
+		it->second->SaveState(writer);
+	};
+}
+
+void Universe::RestoreState(StateReader& reader){
+	StateWriter backup;
+	SaveState(backup);
+	try{
+		ReadState(reader);
+	}catch(...){
+		StateReader backupReader(backup.GetData());
+		ReadState(backupReader); // The backup has just been taken of this universe, so it fits.
+		throw;
+	};
+}
+
+void Universe::ReadState(StateReader& reader){
+	if(reader.ReadString()!=StateIdentifier || reader.ReadUint()!=StateVersion){
+		throw std::invalid_argument("The data is not a simulation state of this version of the simulation.");
+	};
+	if(reader.ReadUint()!=BodyMap.size()){
+		throw std::invalid_argument("The simulation state does not contain the same number of bodies as the universe.");
+	};
+	for(auto it=BodyMap.begin(); it!=BodyMap.end(); it++){
+		if(reader.ReadString()!=it->first){
+			throw std::invalid_argument("The simulation state does not contain the body " + it->first + ".");
+		};
+	};
+	if(reader.ReadUint()!=BfbClientMap.size()){
+		throw std::invalid_argument("The simulation state does not contain the same number of BioFlex clients as the universe.");
+	};
+	for(auto it=BfbClientMap.begin(); it!=BfbClientMap.end(); it++){
+		if(reader.ReadUint()!=it->first){
+			throw std::invalid_argument("The simulation state does not contain the BioFlex client with the bus ID " + boost::lexical_cast<std::string>(static_cast<unsigned int>(it->first)) + ".");
+		};
+	};
+	
+	SimFrequency=reader.ReadDouble();
+	TickCount=reader.ReadUint();
+	TickCountAtFrequencyChange=reader.ReadUint();
+	TimeAtFrequencyChange=reader.ReadDouble();
+	DesiredTime=reader.ReadDouble();
+	for(auto it=BodyMap.begin(); it!=BodyMap.end(); it++){
+		it->second->RestoreState(reader);
+	};
+	for(auto it=BfbClientMap.begin(); it!=BfbClientMap.end(); it++){
+		it->second->RestoreState(reader);
+	};
+}
 
 dReal Universe::GetSimFrequency() { return this->SimFrequency; }
 
-void Universe::SetSimFrequency(dReal newSimFrequency) { this->SimFrequency=newSimFrequency; }
+void Universe::SetSimFrequency(dReal newSimFrequency) { 
+	this->TimeAtFrequencyChange=GetTime();
+	this->TickCountAtFrequencyChange=this->TickCount;
+	this->SimFrequency=newSimFrequency;
+}
 
 dReal Universe::GetStdFrictionCoefficient() { return this->StdFrictionCoefficient; }
 
-void Universe::SetStdFrictionCoefficient(dReal newStdFrictionCoefficient) { this->StdFrictionCoefficient=newStdFrictionCoefficient; }
+void Universe::SetStdFrictionCoefficient(dReal newStdFrictionCoefficient) { 
+	this->StdFrictionCoefficient=newStdFrictionCoefficient;
+	for(auto it=MaterialPairTable.begin(); it!=MaterialPairTable.end(); it++){
+		if(!it->IsFrictionCoefficientDefined){
+			it->FrictionCoefficient=newStdFrictionCoefficient;
+		};
+	};
+}
 
 dReal Universe::GetStdERP() { return this->StdERP; }
 
@@ -427,35 +650,70 @@ std::string Universe::GetRigidBodyMaterial(dBodyID BodyId)
 	throw std::out_of_range("Could not find a body object with the assigned BodyID " + boost::lexical_cast<std::string>(BodyId));
 }
 
+unsigned int Universe::GetMaterialId(std::string material){
+	auto it=MaterialIdMap.find(material);
+	if(it!=MaterialIdMap.end()){
+		return it->second;
+	};
+	const unsigned int oldNumOfMaterials=MaterialIdMap.size();
+	const unsigned int newNumOfMaterials=oldNumOfMaterials+1;
+	MaterialPairParameters stdParameters;
+	stdParameters.FrictionCoefficient=StdFrictionCoefficient;
+	std::vector<MaterialPairParameters> newTable(newNumOfMaterials*newNumOfMaterials, stdParameters);
+	for(unsigned int row=0; row<oldNumOfMaterials; row++){
+		std::copy(	MaterialPairTable.begin()+row*oldNumOfMaterials, 
+				MaterialPairTable.begin()+(row+1)*oldNumOfMaterials, 
+				newTable.begin()+row*newNumOfMaterials);
+	};
+	MaterialPairTable.swap(newTable);
+	MaterialIdMap[material]=oldNumOfMaterials;
+	return oldNumOfMaterials;
+}
+
+MaterialPairParameters& Universe::GetMaterialPairParameters(unsigned int materialId1, unsigned int materialId2){
+	return MaterialPairTable[materialId1*MaterialIdMap.size()+materialId2];
+}
+
 void Universe::SetFrictionCoefficient(	std::string material1,
 					std::string material2,
 					dReal frictionCoefficient )
 {
-	// create string identifying a friction
-	std::string materialCombination;
-	if(material1>material2){
-		materialCombination = material1 + "On" + material2;
-	}else{
-		materialCombination = material2 + "On" + material1;
-	}
-	this->FrictionCoefficientMap[materialCombination]=frictionCoefficient;
+	const unsigned int materialId1=GetMaterialId(material1);
+	const unsigned int materialId2=GetMaterialId(material2);
+	for(MaterialPairParameters* parameters: {&GetMaterialPairParameters(materialId1, materialId2), &GetMaterialPairParameters(materialId2, materialId1)}){
+		parameters->FrictionCoefficient=frictionCoefficient;
+		parameters->IsFrictionCoefficientDefined=true;
+	};
 }
 
 dReal Universe::GetFrictionCoefficient(std::string material1, 
 				       std::string material2)
 {
-	// create string identifying a friction
-	std::string materialCombination;
-	if(material1>material2){
-		materialCombination = material1 + "On" + material2;
-	}else{
-		materialCombination = material2 + "On" + material1;
-	}
-	dReal frictionCoefficient;
-	try{
-		frictionCoefficient=this->FrictionCoefficientMap.at(materialCombination);
-	}catch(const std::out_of_range& oor) {
-		frictionCoefficient=this->StdFrictionCoefficient;
-	}
-	return frictionCoefficient;
+	auto materialId1=MaterialIdMap.find(material1);
+	auto materialId2=MaterialIdMap.find(material2);
+	if(materialId1==MaterialIdMap.end() || materialId2==MaterialIdMap.end()){
+		return this->StdFrictionCoefficient;
+	};
+	return GetMaterialPairParameters(materialId1->second, materialId2->second).FrictionCoefficient;
+}
+
+void Universe::SetRestitutionCoefficient(	std::string material1,
+						std::string material2,
+						dReal restitutionCoefficient )
+{
+	const unsigned int materialId1=GetMaterialId(material1);
+	const unsigned int materialId2=GetMaterialId(material2);
+	GetMaterialPairParameters(materialId1, materialId2).RestitutionCoefficient=restitutionCoefficient;
+	GetMaterialPairParameters(materialId2, materialId1).RestitutionCoefficient=restitutionCoefficient;
+}
+
+dReal Universe::GetRestitutionCoefficient(std::string material1, 
+					  std::string material2)
+{
+	auto materialId1=MaterialIdMap.find(material1);
+	auto materialId2=MaterialIdMap.find(material2);
+	if(materialId1==MaterialIdMap.end() || materialId2==MaterialIdMap.end()){
+		return 0;
+	};
+	return GetMaterialPairParameters(materialId1->second, materialId2->second).RestitutionCoefficient;
 }
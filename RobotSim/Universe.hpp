@@ -2,6 +2,8 @@
 #define UNIVERSE_HPP
 
 // STL includes
+#include <atomic>
+#include <cstdint>
 #include <map>
 #include <deque>
 #include <string>
@@ -9,6 +11,7 @@
 // Boost includes
 #include <boost/assign/list_of.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/variant.hpp>
 
 // Own header files
@@ -18,14 +21,43 @@
 #include "Imu.hpp"
 #include "PressureSensor.hpp"
 #include "OdeDrawstuff.hpp"
+#include "SimulationState.hpp"
 
 
 /** \brief A special map that uses strings as keys and shared pointers to rigid bodies as elements. */
 typedef std::map<std::string, boost::shared_ptr<Bodies::BaseBody> > StrBodyMap;
 /** \brief A special map that uses unsigned characters as keys and shared pointers to BioFlex Rotatory drives as elements. */
 typedef std::map<unsigned char, boost::shared_ptr<BfbClient> > UCharBfbClientMap;
-/** \brief A special map that uses strings as keys and friction coefficients (real numbers) as elements. */
-typedef std::map<std::string, dReal > StrFrictionCoefficientMap;
+/** \brief A special map that uses material names as keys and the IDs of the materials as elements. */
+typedef std::map<std::string, unsigned int> StrMaterialIdMap;
+
+/** \brief The contact parameters of a pair of materials. */
+struct MaterialPairParameters{
+	dReal FrictionCoefficient=1.0;
+	bool IsFrictionCoefficientDefined=false;	//!< If false, the pair follows the standard friction coefficient of the universe.
+	dReal RestitutionCoefficient=0;			//!< The contacts of the pair only bounce if this is larger than zero.
+};
+
+/** \brief The broadphase of a collision space, i.e. the algorithm that finds the pairs of geoms whose bounding boxes overlap. */
+struct BroadphaseParameters{
+	enum BroadphaseType{
+		Simple,		//!< Tests all pairs. This is only efficient for a few geoms.
+		Hash,		//!< A hash table with cells of several sizes. This suits most scenes.
+		SweepAndPrune,	//!< Sorts the bounding boxes along the axes. This suits many geoms that are not distributed evenly.
+		QuadTree	//!< A tree of fixed depth over a fixed region. This suits large terrains with many static geoms.
+	};
+	BroadphaseType	Type=Hash;
+	int		MinLevel=-3;			//!< The smallest cells of the hash space have an edge length of 2^MinLevel meters.
+	int		MaxLevel=10;			//!< The largest cells of the hash space have an edge length of 2^MaxLevel meters. Larger geoms are tested against all others.
+	int		AxisOrder=dSAP_AXES_XYZ;	//!< The order in which the sweep and prune space sorts along the axes. The axis along which the scene is largest should come first.
+	dRealVector3	Center=boost::assign::list_of<dReal>(0)(0)(0);		//!< The center of the region of the quadtree space.
+	dRealVector3	Extents=boost::assign::list_of<dReal>(100)(100)(100);	//!< The size of the region of the quadtree space. The tree divides the region along the x and y axes.
+	int		Depth=6;			//!< The number of levels of the quadtree.
+};
+/** \brief A special map that uses the names of the sub-spaces of a universe as keys and their IDs as elements. */
+typedef std::map<std::string, dSpaceID> StrSpaceIdMap;
+/** \brief A special map that uses the names of the sub-spaces of a universe as keys and their broadphases as elements. */
+typedef std::map<std::string, BroadphaseParameters> StrBroadphaseParametersMap;
 
 typedef std::deque<std::vector<double> > InternalModelLineDeque;
 
@@ -45,16 +77,29 @@ struct CollisionData{
 
 /*! \brief The simulation environment is represented by the Universe class.
  *
- *	Each object in an ODE simulation is located inside a universe. There should
- *	be only one universe per simulation at the same time. The Universe object
+ *	Each object in an ODE simulation is located inside a universe. The Universe object
  *	holds all other object and special parameters which define for example the
  *	gravity within the simulation or the time between two discrete simulation
  *	steps. For more information about the parameters defined by the universe see the
  *	variable descriptions of the class.
+ *
+ *	Every universe has its own world, space, contact group and clock. Therefore, several
+ *	universes can be simulated in different threads at the same time (e.g. for batch simulations).
+ *	A single universe must not be used by more than one thread at a time, though.
+ *	ODE's pseudo random number generator is shared by all universes. The bundled ODE is therefore
+ *	built without the random reordering of the constraints in the quick step (see the Makefile),
+ *	so no step uses the generator. Universes that run in parallel behave exactly like the same
+ *	universes run one after another, and their steps do not have to wait for each other.
  */
 class Universe {
 private:
 	static unsigned int 	NumOfInstances;			//!< This variable is shared by a instances of the universe class. It counts the number of instances. This is used to initialize the physics engine for the first instance and to deinitialize it when the last instance is being deleted.
+	static boost::mutex	InstancesMutex;			//!< Protects NumOfInstances and the initialisation of the physics engine since universes may be created and deleted by different threads.
+	static std::atomic<unsigned int> OdeInitialisationCount;	//!< The number of times the physics engine has been initialised. The threads use it to detect that their thread data has been released by dCloseODE. It is atomic, so the threads can check it without taking InstancesMutex.
+	/*! \brief Allocate the thread specific data of ODE (e.g. the collision caches) for the calling thread if this has not been done since the physics engine was initialised.
+	 *	This must be done in every thread that runs a simulation step.
+	 */
+	static void PrepareOdeForThisThread();
 	dRealVector3 		Gravity		=boost::assign::list_of<dReal>(0)(0)(-9.81);	//!< The gravity within the universe. Since it's a vector, it cannot be initalized in the header file.
 	dReal 			SimFrequency	=1000;		//!< The simulation frequency [Hz]. 1/SimFrequency defines the timestep between two iterations of the physics engine. It refers to simulation time, not to real time. 
 		
@@ -74,12 +119,20 @@ private:
 	 */
 	dReal 			StdCFM		=10e-7;
 
-	/*! \brief A map of friction coefficients between materials of a universe. */
-	StrFrictionCoefficientMap FrictionCoefficientMap;
+	/*! \brief The IDs of the materials of a universe. The IDs are assigned consecutively, starting with 0 for the material "default". */
+	StrMaterialIdMap	MaterialIdMap;
+	/*! \brief The contact parameters of all pairs of materials. 
+	 *	The table is dense and symmetric; the parameters of the materials with the IDs i and j are found at i*MaterialIdMap.size()+j.
+	 * 	This way, the collision callback neither compares strings nor allocates memory.
+	 */
+	std::vector<MaterialPairParameters> MaterialPairTable;
+	/*! \brief Get the parameters of a pair of materials by the IDs of the materials. */
+	MaterialPairParameters& GetMaterialPairParameters(unsigned int materialId1, unsigned int materialId2);
 	dReal 			StdFrictionCoefficient=1.0;	//!< This is the default friction coefficient. It will be used if the friction coefficient between two materials is not defined. 
 	
 	/*! \brief A map of coefficients of restitution between materials of a universe. */
-	dReal 			StdRestitutionCoefficient=0.01;	//!< This is the default coefficient of restitution (the one that defines how high an object will jump [relative to its drop height] when dropped to the ground). It will be used if the coefficient of restitution between two materials is not defined. 
+	dReal 			StdRestitutionCoefficient=0.01;	//!< This is the default coefficient of restitution (the one that defines how high an object will jump [relative to its drop height] when dropped to the ground). It is currently not used: the contacts of materials without a defined coefficient of restitution do not bounce. 
+	dReal			MinBounceVelocity=0.01;		//!< The minimum velocity [m/s] a contact must have in order to bounce. Slower contacts do not bounce, so resting bodies do not jitter.
 	
 	const unsigned int 	MaxCollisionContacts=10; 	//!< The maximum number of collison points for two bodies. 
 
@@ -95,16 +148,45 @@ private:
 	//StrFrictionCoefficientMap FrictionCoefficientMap;
 
 	dWorldID 		WorldId		=0;		//!< The ID of the world within the universe (This is the "container" the dynamic bodies will be placed into.).
-	dSpaceID 		SpaceId		=0;		//!< The ID of the space within the universe (This is the "container" the collision primitives will be placed into.).
+	dSpaceID 		SpaceId		=0;		//!< The ID of the space within the universe (This is the "container" the collision primitives will be placed into.). It only contains the sub-spaces.
+	BroadphaseParameters	Broadphase;			//!< The broadphase of the space of the universe. It collides the sub-spaces with each other.
+	/*! \brief The sub-spaces of the space of the universe, e.g. one for the static environment and one for every robot. 
+	 *	Each body is placed in one of them, so ODE can skip whole groups of bodies that are far apart before the collision callback is called.
+	 * 	A sub-space is created when the first body is added to it.
+	 */
+	StrSpaceIdMap		SubSpaceMap;
+	StrBroadphaseParametersMap SubSpaceBroadphaseMap;	//!< The broadphases of the sub-spaces. Sub-spaces that are not listed use a hash space.
+	static const unsigned long StaticBodyCategoryBits=1ul<<31;	//!< The category bit of the spaces of the static bodies. Static bodies do not collide with each other, so these spaces do not collide with spaces of this category.
+	/*! \brief Create a space with the passed broadphase. */
+	static dSpaceID CreateSpace(const BroadphaseParameters& broadphase, dSpaceID parentSpaceId);
+	/*! \brief Get the ID of a sub-space of the universe. The sub-space is created if it does not exist yet. */
+	dSpaceID GetSubSpaceId(std::string name);
+	/*! \brief Let the category and collide bits of a sub-space include those of a body that has been added to it.
+	 *	A sub-space whose bodies cannot collide with each other (e.g. the static environment) is not tested for collisions within itself.
+	 */
+	void UpdateSubSpaceBits(std::string name, boost::shared_ptr<Bodies::BaseBody> body);
 	dJointGroupID 		ContactGroupId	=0;		//!< This is a temporary joint group in which the collision joints are saved during a simulation step. After each simulation step, this contact group will be cleared.
-	double 			Time		=0;
+	uint64_t		TickCount	=0;		//!< The number of simulation steps since the creation of the universe. Unlike a time that is accumulated in floating point numbers, the counter does not drift. 
+	uint64_t		TickCountAtFrequencyChange=0;	//!< The tick count at which the simulation frequency was set most recently. 
+	double			TimeAtFrequencyChange=0;	//!< The simulation time at which the simulation frequency was set most recently. The time is computed from the ticks since then, so changing the frequency does not change the time.
+	double 			DesiredTime	=0;		//!< The time the universe has been told to simulate to by Simulate and SimulateUntill. The tick count follows it as close as the step size allows.
 	
 	/*! \brief Function used by the collision detection engine in order to test the spaces/bodies for collisions among each other.
 	 * 	\param data 
 	 */
 	static void NearCallback(void* data, dGeomID primitive1, dGeomID primitive2);
 	
-	std::list<boost::shared_ptr<CollisionData>> CollisionDataList={};
+	/*! \brief The contacts of the current step whose feedback is forwarded to the primitives (e.g. for the pressure sensors).
+	 *	ODE keeps pointers to the joint feedbacks until the end of the step, so the elements must not move. Unlike a vector, a deque does not move its elements when it grows.
+	 *	The elements are reused in every step and only the first NumOfCollisionData of them belong to the current step. 
+	 *	Hence, no memory is allocated once the arena has grown to the largest number of contacts per step.
+	 */
+	std::deque<CollisionData> CollisionDataArena={};
+	size_t NumOfCollisionData=0;	//!< The number of elements of the arena that are used in the current step. It is reset at the start of every step.
+	/*! \brief Simulate the passed number of steps without changing the desired time. */
+	void SimulateTicks(uint64_t numOfTicks);
+	/*! \brief Restore a snapshot written by SaveState without rolling back if it fails (see RestoreState). */
+	void ReadState(StateReader& reader);
 	void CreateUniverse();
 	void DestroyUniverse();
 public:
@@ -128,17 +210,39 @@ public:
 	void addIntModelLine(std::vector<double>);
 	
 	/*! \brief Let the dynamics and the collision engines simulate the object interactions for a certain period,
-	 * 	\param deltaT the time the simulation shall run. The value must be positive.
+	 * 	\param deltaT the time the simulation shall run. The value must be positive. The period is rounded to whole steps; the rounding errors of subsequent calls do not add up.
 	 */
 	void Simulate(double deltaT);
 	//void Simulate(boost::posix_time::time_duration deltaT);
 	void SimulateUntill(double absTime);
 	
+	/*! \brief Simulate the passed number of steps of 1/SimFrequency each. 
+	 * 	The simulation does not depend on the wall-clock time, so the same initial state and the same sequence of steps and messages lead to bit-for-bit identical results. 
+	 */
+	void Step(uint64_t numOfTicks);
+	/*! \brief Simulate until the tick count has reached the passed value. Nothing is simulated if it has already been reached. */
+	void StepUntil(uint64_t tickCount);
+	
+	/*! \brief Get the number of simulation steps since the creation of the universe. */
+	uint64_t GetTickCount();
+	
+	/*! \brief Append the complete state of the simulation to a snapshot: the clock, the dynamic state of all bodies and the states of all BioFlex clients (drives and sensors).
+	 *	The structure of the universe (bodies, primitives, joints and settings) is not saved, only the names of the bodies and the IDs of the clients, so a snapshot can only be restored into the universe it was taken of (or one created from the same geometry xml).
+	 */
+	void SaveState(StateWriter& writer);
+	
+	/*! \brief Restore a snapshot written by SaveState.
+	 *	\throws std::invalid_argument if the snapshot does not belong to a universe with the same bodies and clients or if it ends unexpectedly (e.g. because it is corrupt). In this case, the universe is not changed: 
+	 *	the state before the restore is saved first and restored again if the snapshot fails.
+	 */
+	void RestoreState(StateReader& reader);
+	
 	/*! \brief Draw all the bodies defined in the universe (works only if the visualization is active).	 */
 	void Draw();
 
 	/*! \brief Add a rigid body to the simulation
 	 *	\param name The name of the GeometricBody object to add to the simulation
+	 *	\param subSpace The name of the collision sub-space the body is placed in. Bodies that usually are close to each other (e.g. the bodies of a robot) should share a sub-space, but different robots should not (see GetUnusedSubSpaceName). The static bodies are placed in the sub-space "Environment" by default.
 	 */
 	 boost::shared_ptr<Bodies::RigidBody> AddRigidBody(	std::string name,
 							dReal mass=1,
@@ -148,14 +252,16 @@ public:
 							dRealVector3 relMassOffset=boost::assign::list_of<dReal>(0)(0)(0),
 							std::string material="default",
 							std::bitset<32> categoryBits=0,
-							std::bitset<32> collideBits=0);
+							std::bitset<32> collideBits=0,
+							std::string subSpace="Robot");
 
 	 boost::shared_ptr<Bodies::StaticBody> AddStaticBody(	std::string name,
 							dRealVector3 initialPosition=boost::assign::list_of<dReal>(0)(0)(0),
 							dRealMatrix3 initialRotation=boost::numeric::ublas::identity_matrix<dReal>(3),
 							std::string material="default",
 							std::bitset<32> categoryBits=0,
-							std::bitset<32> collideBits=0);
+							std::bitset<32> collideBits=0,
+							std::string subSpace="Environment");
 	 
 	 boost::shared_ptr<Bodies::StaticBody> AddStaticBody(	std::string name,
 							dReal mass,
@@ -165,7 +271,8 @@ public:
 							dRealVector3 relMassOffset=boost::assign::list_of<dReal>(0)(0)(0),
 							std::string material="default",
 							std::bitset<32> categoryBits=0,
-							std::bitset<32> collideBits=0);
+							std::bitset<32> collideBits=0,
+							std::string subSpace="Environment");
 	 
 	void DeleteBody(std::string name);
 	 
@@ -230,6 +337,21 @@ public:
 	 * 	\param newSimFrequ new simulation frequency
 	 */
 	void SetSimFrequency(dReal newSimFrequ);
+	
+	/*! \brief Set the broadphase of the space of the universe, which collides the sub-spaces with each other.
+	 *	The broadphase takes effect when the universe is cleared the next time.
+	 */
+	void SetBroadphase(BroadphaseParameters broadphase);
+	
+	/*! \brief Set the broadphase of a sub-space (e.g. a quadtree for the sub-space of a large terrain).
+	 *	The broadphase takes effect when the sub-space is created, i.e. when the first body is added to it after the universe has been cleared. Clearing the universe resets the broadphases of all sub-spaces.
+	 */
+	void SetSubSpaceBroadphase(std::string name, BroadphaseParameters broadphase);
+	
+	/*! \brief Get a name for a new sub-space: the passed prefix if no sub-space of that name exists yet, otherwise the prefix followed by the lowest number that is not used yet (starting at 2).
+	 *	This is used to give every robot its own sub-space, so the bodies of different robots are not tested against each other unless their sub-spaces overlap.
+	 */
+	std::string GetUnusedSubSpaceName(std::string prefix);
 
 	/*! \brief Get the standard friction coefficient 
 	 *	Since the friction depends on the combination of two materials, probably, some combinations won't be specified. 
@@ -293,6 +415,13 @@ public:
 	 */
 	std::string GetRigidBodyMaterial(dBodyID body);
 
+	/*! \brief Get the ID of a material. If the material does not have an ID yet, a new one is assigned and the table of the material pairs is extended.
+	 *	The IDs are assigned while the geometry is being created, so the simulation steps do not need the names of the materials anymore.
+	 *	\param material The name of the material.
+	 *	\return the ID of the material.
+	 */
+	unsigned int GetMaterialId(std::string material);
+
 	/*! \brief Add/Change a new friction value defining the friction between two material
 	 *	types.
 	 *
@@ -317,6 +446,22 @@ public:
 	 *		is retruende.
 	 */
 	dReal GetFrictionCoefficient(std::string material1, std::string material2);
+	
+	/*! \brief Set the coefficient of restitution between two materials.
+	 *
+	 *	\param material1 The name of the first material.
+	 *	\param material2 The name of the second material.
+	 *	\param restitutionCoefficient The coefficient of restitution between material 1 and material 2. If it is zero (which is the default for all pairs of materials), the contacts do not bounce.
+	 */
+	void SetRestitutionCoefficient(	std::string material1,
+					std::string material2,
+					dReal restitutionCoefficient );
+
+	/*! \brief Get the coefficient of restitution between two materials.
+	 *
+	 *	\return the coefficient of restitution for the material combination or zero if it is not defined.
+	 */
+	dReal GetRestitutionCoefficient(std::string material1, std::string material2);
 };
 #endif
 
@@ -71,8 +71,12 @@ ThreadSafeQueue<boost::shared_ptr<const BfbMessage>> incomingMessages;
 
 /** \brief This variable specifies whether a window should be opended for visualization. 
  * If no visualisation is active, the simulation will run faster, but you won't see what's happening...
+ * The headless build (see the "headless" target of the Makefile) never opens a window.
  */
 bool visualizationActive=false;
+/** \brief The speed of the simulation relative to real time if it runs continuously. 
+ * If it is 0, the simulation only advances when it is told to via the TCP interface. If it is negative, the simulation runs as fast as possible. 
+ */
 double continuousTimeFactor=0;
 
 /** This variable specifies the maximum frequency with which the screen should be updated. 
@@ -89,8 +93,15 @@ double visualisationFrequency=24;
  */
 void SimulationLoop(const int pause){
 	static boost::posix_time::ptime lastVisualizationTime=boost::get_system_time(); //pretend that the visualization must be updated as soon as possible when this is evaluated the first time (consider the "static" keyword).
+	// The continuous simulation computes its target tick from the real time that passed since a reference point. So the rounding to whole ticks does not add up over the loops.
+	static boost::posix_time::ptime continuousReferenceTime=boost::get_system_time();
+	static uint64_t continuousReferenceTick=universe->GetTickCount();
+	static uint64_t continuousTargetTick=continuousReferenceTick;
+	static dReal continuousSimFrequency=universe->GetSimFrequency();
 	boost::system_time breakTime=boost::posix_time::pos_infin;
-	if(visualizationActive || continuousTimeFactor>0){
+	if(continuousTimeFactor<0){ // Only the messages that have already been received are handled. Afterwards, the next step is simulated right away.
+		breakTime=boost::get_system_time();
+	}else if(visualizationActive || continuousTimeFactor>0){
 		breakTime=boost::get_system_time()+boost::posix_time::microseconds(pow(10,6)/visualisationFrequency);
 	};
 	
@@ -113,16 +124,30 @@ void SimulationLoop(const int pause){
 			tcpServer->SendMessage(outgoingMessage); // Send the reply.
 		};
 	};
-	if(continuousTimeFactor>0 && !pause){
-		universe->Simulate( continuousTimeFactor*( double((boost::get_system_time()-lastVisualizationTime).total_microseconds())/pow(10,6)) );
+	if(continuousTimeFactor<0 && !pause){
+		universe->Step(1);
+	}else if(continuousTimeFactor>0){
+		boost::posix_time::ptime now=boost::get_system_time();
+		if(pause || universe->GetTickCount()!=continuousTargetTick || universe->GetSimFrequency()!=continuousSimFrequency){ // The simulation has been paused, stepped, restored or its frequency has been changed in the meantime. The real time is referred to the current tick from now on.
+			continuousReferenceTime=now;
+			continuousSimFrequency=universe->GetSimFrequency();
+			continuousReferenceTick=universe->GetTickCount();
+			continuousTargetTick=continuousReferenceTick;
+		};
+		if(!pause){
+			continuousTargetTick=continuousReferenceTick+static_cast<uint64_t>(continuousTimeFactor*continuousSimFrequency*double((now-continuousReferenceTime).total_microseconds())/pow(10,6));
+			universe->StepUntil(continuousTargetTick);
+		};
 	};
-	if(visualizationActive){ // If the visualisation is active, ...
-		lastVisualizationTime=boost::get_system_time();
+	boost::posix_time::ptime now=boost::get_system_time();
+	if(visualizationActive && (continuousTimeFactor>=0 || now>=lastVisualizationTime+boost::posix_time::microseconds(static_cast<long>(pow(10,6)/visualisationFrequency)))){ // If the visualisation is active, ... (If the simulation runs as fast as possible, the screen is only updated with the visualisation frequency.)
+		lastVisualizationTime=now;
 		universe->Draw();
 	};
 
 };
 
+#ifndef HEADLESS
 /** \brief This is another function needed for the initialization of the visualization. 
  * In this function, the view point and other visualization specific parameters can can be specified. 
  */
@@ -132,6 +157,7 @@ static void start()
     static float hpr[3] = {140.000f,-17.0000f,0.0000f};
     dsSetViewpoint (xyz,hpr);
 }
+#endif
 
 
 ////////////////////////////////////////// Main
@@ -143,10 +169,12 @@ int main (int argc, char **argv)
 		desc.add_options()//This command continues over the next few lines.
 		("help", "produce help message")
 		("port", boost::program_options::value<unsigned short>()->default_value(50002), "Defines the TCP port the simulation will listen on.")
+#ifndef HEADLESS
 		("visualize", boost::program_options::value<bool>()->default_value(true),"Shows/hides the 3D visualisation.")
 		("windowWidth", boost::program_options::value<unsigned int>()->default_value(1200),"Sets the width of the window for the 3D visualization.")
 		("windowHeight", boost::program_options::value<unsigned int>()->default_value(0), "Sets the height of the window for the 3D visualization. If not set (=0), a ration of 0.6250 relative to the width will be used.")
-		("timeFactor", boost::program_options::value<double>()->default_value(0),"Runs the simulation continuously (without the need to explicitly send commands to iterate through time) with the specified factor relative to real time. 10: fast forward; 1: real time;  0.1: slow motion; 0: only 'simulate for some time'-commands are considered.")
+#endif
+		("timeFactor", boost::program_options::value<double>()->default_value(0),"Runs the simulation continuously (without the need to explicitly send commands to iterate through time) with the specified factor relative to real time. 10: fast forward; 1: real time;  0.1: slow motion; 0: only 'simulate for some time'-commands are considered; -1: as fast as possible.")
 		("print", boost::program_options::value<bool>()->default_value(false), "Prints every message that is received/sent via the TCP interface.")
 		("maxPayloadPrintout", boost::program_options::value<signed long int>()->default_value(-1), "Sets the maximum number of payload bytes that will be printed. This might be helpful if the output of the geometry xml should not be printed completely.")
 		("defaultRobot", boost::program_options::value<bool>()->default_value(false), "Loads the default robot (defined in the file 'DefaultRobot.xml').")
@@ -163,7 +191,9 @@ int main (int argc, char **argv)
 			return 1;
 		}
 		unsigned long portNum=vm["port"].as<unsigned short>();
+#ifndef HEADLESS
 		visualizationActive=vm["visualize"].as<bool>();
+#endif
 		continuousTimeFactor=vm["timeFactor"].as<double>();
 
 	/** Just for information purposes, the specified compiler options for the used ODE version are printed. */
@@ -201,6 +231,7 @@ int main (int argc, char **argv)
 	 * If drawstuff is used, it calls the "simulation loop" function endlessly. 
 	 * If it is not used, the "simulation loop" function must be called in an endless loop.
 	 */
+#ifndef HEADLESS
 	if(visualizationActive){
 		dsFunctions fn;
 		fn.version = DS_VERSION;
@@ -217,10 +248,11 @@ int main (int argc, char **argv)
 			windowHeight=0.6250*windowWidth;
 		};
 		dsSimulationLoop (argc,argv,windowWidth,windowHeight,&fn);
-	}else{
-		while(true){
-			SimulationLoop(0);
-		}
-	}
+		return 0;
+	};
+#endif
+	while(true){
+		SimulationLoop(0);
+	};
 	return 0;
 }
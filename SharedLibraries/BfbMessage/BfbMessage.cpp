@@ -7,6 +7,7 @@
 // Boost includes
 #include <boost/assign.hpp>
 #include <boost/date_time.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/pthread/mutex.hpp>
 
@@ -175,6 +176,29 @@ namespace BfbFunctions{
 		return output;
 	}
 	
+	bool isFragment(const BfbMessage &message){
+		return message.GetProtocol()==fragmentProtocolId && message.GetPayload().size()>fragmentDataStart;
+	}
+	
+	std::vector<boost::shared_ptr<BfbMessage>> splitIntoFragments(const BfbMessage &message, unsigned char transferId){
+		std::vector<unsigned char> payload=message.GetPayload();
+		if(payload.size()>maxFragmentedPayloadLength){
+			throw std::invalid_argument("The payload is too large to be fragmented.");
+		};
+		unsigned char numOfFragments=(payload.size()+maxFragmentDataLength-1)/maxFragmentDataLength;
+		std::vector<boost::shared_ptr<BfbMessage>> fragments;
+		fragments.reserve(numOfFragments);
+		for(unsigned int i=0;i<numOfFragments;i++){
+			auto dataStart=payload.begin()+i*maxFragmentDataLength;
+			auto dataEnd=(i+1==numOfFragments ? payload.end() : dataStart+maxFragmentDataLength);
+			std::vector<unsigned char> fragmentPayload={message.GetProtocol(), message.GetCommand(), transferId, static_cast<unsigned char>(i), numOfFragments};
+			fragmentPayload.insert(fragmentPayload.end(), dataStart, dataEnd);
+			bool isLastFragment=(i+1==numOfFragments);
+			fragments.push_back(boost::make_shared<BfbMessage>(message.GetDestination(), message.GetSource(), isLastFragment && message.GetBusAllocation(), message.GetError(), fragmentProtocolId, message.GetCommand(), fragmentPayload));
+		};
+		return fragments;
+	}
+	
 	std::vector<unsigned char> convertDoublesToBytes(std::vector<double> input, unsigned char numOfBits, bool isSigned){
 		std::vector<unsigned char> output;
 		output.reserve(input.size()*(numOfBits/8));
@@ -308,7 +332,7 @@ std::vector<unsigned char> BfbMessage::GetRawData() const {
 		rawData[ultraLongHeaderCrcPos]=ultraLongHeaderCrcDummy;
 		rawData[ultraLongProtocolPos]=this->Protocol;
 		rawData[ultraLongCommandPos]=this->Command;
-		for(unsigned long int i=0;i<=this->Payload.size();i++){
+		for(unsigned long int i=0;i<this->Payload.size();i++){
 			rawData[i+ultraLongPayloadStart]=this->Payload[i];
 		};
 		rawData[rawData.size()+ultraLongPayloadCrcStart]=ultraLongPayloadCrcDummy1;
@@ -395,3 +419,28 @@ void BfbMessage::SetRawData(std::vector<unsigned char>  newRawData){
 void BfbMessage::SetComment(std::string comment){
 	Comment=comment;
 }
+
+boost::shared_ptr<BfbMessage> BfbFragmentAssembler::AddFragment(const BfbMessage &fragment){
+	std::vector<unsigned char> payload=fragment.GetPayload();
+	if(!BfbFunctions::isFragment(fragment)){
+		return boost::shared_ptr<BfbMessage>();
+	};
+	Transfer& transfer=Transfers[fragment.GetSource()];
+	if(payload[fragmentIndexPos]==0){ // The first fragment starts a new transfer. An incomplete one is discarded.
+		transfer.TransferId=payload[fragmentTransferIdPos];
+		transfer.NextIndex=0;
+		transfer.Payload.clear();
+	};
+	if(payload[fragmentTransferIdPos]!=transfer.TransferId || payload[fragmentIndexPos]!=transfer.NextIndex){ // A fragment is missing.
+		Transfers.erase(fragment.GetSource());
+		return boost::shared_ptr<BfbMessage>();
+	};
+	transfer.Payload.insert(transfer.Payload.end(), payload.begin()+fragmentDataStart, payload.end());
+	transfer.NextIndex++;
+	if(transfer.NextIndex<payload[fragmentCountPos]){
+		return boost::shared_ptr<BfbMessage>();
+	};
+	auto message=boost::make_shared<BfbMessage>(fragment.GetDestination(), fragment.GetSource(), fragment.GetBusAllocation(), fragment.GetError(), payload[fragmentOriginalProtocolPos], payload[fragmentOriginalCommandPos], transfer.Payload);
+	Transfers.erase(fragment.GetSource());
+	return message;
+}
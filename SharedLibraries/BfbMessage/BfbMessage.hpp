@@ -2,6 +2,7 @@
 #define BFBMESSAGE_H
 
 // STL includes
+#include <map>
 #include <stdexcept>
 #include <type_traits>
 #include <vector>
@@ -9,6 +10,7 @@
 // Boost includes
 #include <boost/assign.hpp>
 #include <boost/date_time.hpp>
+#include <boost/shared_ptr.hpp>
 
 class BfbMessage;
 
@@ -67,6 +69,23 @@ namespace BfbConstants{
 		errorFlag		=0x40,
 		busAllocationFlag_bm	=0x80
 	};
+	
+	/* A message whose payload does not fit into a long packet is transmitted over the serial bus as a sequence of fragments.
+	 * Every fragment is a long packet of the fragment protocol. Its payload starts with the fragment header followed by the next part of the original payload.
+	 * Only the last fragment carries the bus allocation flag of the original message. Thus, the fragments are sent back to back and only the reassembled message is answered.
+	 */
+	const unsigned char fragmentProtocolId=2;
+	enum fragmentHeaderPosition_t{
+		fragmentOriginalProtocolPos=0,
+		fragmentOriginalCommandPos=1,
+		fragmentTransferIdPos	=2,
+		fragmentIndexPos	=3,
+		fragmentCountPos	=4,
+		fragmentDataStart	=5
+	};
+	const unsigned char maxLongPayloadLength=longMessageMaxLength-longMessageOverhead;
+	const unsigned char maxFragmentDataLength=maxLongPayloadLength-fragmentDataStart;
+	const unsigned long maxFragmentedPayloadLength=255*maxFragmentDataLength;
 }
 
 
@@ -110,6 +129,15 @@ namespace BfbFunctions{
 	void printMessage(boost::shared_ptr<const BfbMessage> message, std::string foreword="", signed long int maxPayloadPrintout=-1);
 	
 	
+	/*!\brief The function tests whether the message is a fragment of a larger message.
+	 */
+	bool isFragment(const BfbMessage &message);
+	/*!\brief The function splits a message into fragments that fit into long packets.
+	 * \param message The message whose payload is larger than maxLongPayloadLength (and not larger than maxFragmentedPayloadLength).
+	 * \param transferId A number that distinguishes the fragments of this message from those of the previous message sent to the same destination.
+	 * \return The fragments in the order they must be transmitted.
+	 */
+	std::vector<boost::shared_ptr<BfbMessage>> splitIntoFragments(const BfbMessage &message, unsigned char transferId);
 	double clip(double input, double lower, double upper);
 	
 	std::vector<unsigned char> convertDoubleToBytes(const double input, const unsigned char numOfBits, const bool isSigned);
@@ -290,5 +318,23 @@ class BfbMessage{
 		void SetComment(std::string comment);
 };
 
+/*!\brief The class reassembles the fragments of messages split by BfbFunctions::splitIntoFragments. 
+ * The fragments of one source must arrive in order. If a fragment is missing, the transfer is discarded and the sender has to repeat the whole message.
+ */
+class BfbFragmentAssembler{
+	public:
+		/*!\brief Add a received fragment.
+		 * \return The reassembled message if the fragment completed it, otherwise an empty pointer.
+		 */
+		boost::shared_ptr<BfbMessage> AddFragment(const BfbMessage &fragment);
+	private:
+		struct Transfer{
+			unsigned char TransferId=0;
+			unsigned char NextIndex=0; /*!< The index of the fragment that is expected next. */
+			std::vector<unsigned char> Payload; /*!< The payload that has been reassembled so far. */
+		};
+		std::map<unsigned char, Transfer> Transfers; /*!< The incomplete transfers accessible by the source of their fragments. */
+};
+
 
 #endif
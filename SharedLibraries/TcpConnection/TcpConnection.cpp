@@ -13,20 +13,21 @@
 TcpConnection::TcpConnection(boost::shared_ptr<boost::asio::io_service> ioService, 
 							boost::shared_ptr<boost::asio::ip::tcp::socket> socket, 
 							unsigned char TcpId, 
+							unsigned short connectionId, 
 							std::function<void (boost::shared_ptr<const BfbMessage>)>& incomingMessageSignal):
 			InputData(std::vector<unsigned char>(0)),
-			OutputData(std::vector<unsigned char>(0)), 
+			OutputData(), 
 			IoService(ioService),
 			Socket(socket),
 			TcpId(TcpId),
-			MessagesToBeSent(std::queue<boost::shared_ptr<const BfbMessage>>()),
+			ConnectionId(connectionId),
+			MessagesToBeSent(std::queue<boost::shared_ptr<const std::vector<unsigned char>>>()),
 			IsSendPending(false),
 			ConnectionMutex(boost::make_shared<boost::mutex>()),
 			IncomingMessageFunctionCallback(incomingMessageSignal){
 	boost::asio::ip::tcp::no_delay option(true);
 	Socket->set_option(option);
 	InputData.reserve(4096);
-	OutputData.reserve(4096);
 	boost::shared_ptr<boost::asio::io_service::work> Work;
 	TryToReceiveMessages();
 }
@@ -36,6 +37,10 @@ unsigned char TcpConnection::GetTcpId(){
 	return TcpId;
 }
 
+unsigned short TcpConnection::GetConnectionId(){
+	return ConnectionId;
+}
+
 bool TcpConnection::GetActivationState(){
 	return IsActive;
 }
@@ -53,7 +58,7 @@ void TcpConnection::HandleReceivedShortPacketOrLongPacketHeader(const boost::sys
     size_t bytes_transferred){
 	if (error){
 		IsActive=false;
-		throw TcpConnectionUtilities::LostConnection()<<TcpConnectionUtilities::lostConnectionTcpId(TcpId);
+		throw TcpConnectionUtilities::LostConnection()<<TcpConnectionUtilities::lostConnectionTcpId(TcpId)<<TcpConnectionUtilities::lostConnectionConnectionId(ConnectionId);
 		return;
 	}
 	if(BfbFunctions::isValidShortPacket(InputData)){//Short packet
@@ -79,7 +84,7 @@ void TcpConnection::HandleReceivedLongPacket(const boost::system::error_code& er
     size_t bytes_transferred){
 	if (error){
 		IsActive=false;
-		throw TcpConnectionUtilities::LostConnection()<<TcpConnectionUtilities::lostConnectionTcpId(TcpId);
+		throw TcpConnectionUtilities::LostConnection()<<TcpConnectionUtilities::lostConnectionTcpId(TcpId)<<TcpConnectionUtilities::lostConnectionConnectionId(ConnectionId);
 		return;
 	}
 	if( BfbFunctions::isValidLongPacket(InputData) || BfbFunctions::isValidUltraLongPacket(InputData)){//Long packet
@@ -97,28 +102,28 @@ void TcpConnection::HandleReceivedLongPacket(const boost::system::error_code& er
 
 
 void TcpConnection::SendMessage(boost::shared_ptr<const BfbMessage> message){
+	SendRawData(boost::make_shared<const std::vector<unsigned char>>(message->GetRawData()));
+};
+
+void TcpConnection::SendRawData(boost::shared_ptr<const std::vector<unsigned char>> rawData){
 	boost::lock_guard<boost::mutex> lock(*ConnectionMutex); 
-	MessagesToBeSent.push(message);
+	MessagesToBeSent.push(rawData);
 	if(!IsSendPending){
 		SendNextMessage();
 	};
 };
 
 void TcpConnection::SendNextMessage(){//Don't call this function without having locked the ConnectionMutex before. 
-	boost::shared_ptr<BfbMessage> tempMessage(boost::make_shared<BfbMessage>(*(MessagesToBeSent.front())));
+	OutputData=MessagesToBeSent.front();
 	MessagesToBeSent.pop();
-	//if(TcpId!=2){
-	//	tempMessage->SetDestination(2);
-	//};
-	OutputData=tempMessage->GetRawData();
 	IsSendPending=true;
-	size_t numOfBytesToTransfer=OutputData.size();
+	size_t numOfBytesToTransfer=OutputData->size();
 	if(numOfBytesToTransfer>pow(2,16)){
 		SendPartialMessage(static_cast<boost::asio::error::basic_errors>(0), 0);
 		return;
 	};
 	boost::asio::async_write(*Socket,
-			boost::asio::buffer(OutputData.data(), numOfBytesToTransfer),
+			boost::asio::buffer(OutputData->data(), numOfBytesToTransfer),
 			boost::bind(&TcpConnection::HandleSentMessage, this,
 				boost::asio::placeholders::error));
 };
@@ -126,19 +131,19 @@ void TcpConnection::SendNextMessage(){//Don't call this function without having
 void TcpConnection::SendPartialMessage(const boost::system::error_code& error, long unsigned int bytes_transferred){
 	if (error){
 		IsActive=false;
-		throw TcpConnectionUtilities::LostConnection()<<TcpConnectionUtilities::lostConnectionTcpId(TcpId);
+		throw TcpConnectionUtilities::LostConnection()<<TcpConnectionUtilities::lostConnectionTcpId(TcpId)<<TcpConnectionUtilities::lostConnectionConnectionId(ConnectionId);
 		return;
 	}
-	size_t numOfBytesToTransfer=OutputData.size()-bytes_transferred;
+	size_t numOfBytesToTransfer=OutputData->size()-bytes_transferred;
 	if(numOfBytesToTransfer>pow(2,14)){
 		numOfBytesToTransfer=pow(2,14);
 		boost::asio::async_write(*Socket,
-			boost::asio::buffer(OutputData.data()+bytes_transferred, numOfBytesToTransfer),
+			boost::asio::buffer(OutputData->data()+bytes_transferred, numOfBytesToTransfer),
 			boost::bind(&TcpConnection::SendPartialMessage, this,
 				boost::asio::placeholders::error, bytes_transferred+numOfBytesToTransfer));  
 	}else{
 		boost::asio::async_write(*Socket,
-			boost::asio::buffer(OutputData.data()+bytes_transferred, numOfBytesToTransfer),
+			boost::asio::buffer(OutputData->data()+bytes_transferred, numOfBytesToTransfer),
 			boost::bind(&TcpConnection::HandleSentMessage, this,
 				boost::asio::placeholders::error));  
 	}
@@ -149,7 +154,7 @@ void TcpConnection::SendPartialMessage(const boost::system::error_code& error, l
 void TcpConnection::HandleSentMessage(const boost::system::error_code& error){
 	if (error){
 		IsActive=false;
-		throw TcpConnectionUtilities::LostConnection()<<TcpConnectionUtilities::lostConnectionTcpId(TcpId);
+		throw TcpConnectionUtilities::LostConnection()<<TcpConnectionUtilities::lostConnectionTcpId(TcpId)<<TcpConnectionUtilities::lostConnectionConnectionId(ConnectionId);
 		return;
 	}
 	boost::lock_guard<boost::mutex> lock(*ConnectionMutex); 
@@ -21,6 +21,7 @@
 
 namespace TcpConnectionUtilities{
 	typedef boost::error_info<struct blah, unsigned char> lostConnectionTcpId; 
+	typedef boost::error_info<struct lostConnectionConnectionIdTag, unsigned short> lostConnectionConnectionId; 
 	struct LostConnection: virtual std::exception, virtual boost::exception { };
 };
 
@@ -30,21 +31,32 @@ class TcpConnection
 		/** \brief The constructor 
 		 * \param ioService The connection handler for asynchronous communication
 		 * \param socket The socket this TCP-client is supposed to use for communication
-		 * \param tcpId The internally used ID that is used route messages to the serial clients and back towards the corresponding TCP-client. Every TCP-client gets an unique ID.
+		 * \param tcpId The internally used ID that is used route messages to the serial clients and back towards the corresponding TCP-client. Every TCP-client gets an unique ID unless it shares the multiplexed TCP-ID of the server.
+		 * \param connectionId The server-side handle of the connection. For connections with an unique TCP-ID, it equals the TCP-ID. Multiplexed connections get an ID above 255.
 		 * \param incomingMessageSignal This is used for the signaling of received messages. Modules that should be informed about a received message must be connected to this signal.
 		 */ 
-		TcpConnection(boost::shared_ptr<boost::asio::io_service> ioService, boost::shared_ptr<boost::asio::ip::tcp::socket> socket, unsigned char tcpId, std::function<void (boost::shared_ptr<const BfbMessage>)>& incomingMessageFunction);
+		TcpConnection(boost::shared_ptr<boost::asio::io_service> ioService, boost::shared_ptr<boost::asio::ip::tcp::socket> socket, unsigned char tcpId, unsigned short connectionId, std::function<void (boost::shared_ptr<const BfbMessage>)>& incomingMessageFunction);
 		
 		/** \brief Method responsible for sending messages via the TCP-socket that was assigned to an instance of this class.
 		 * \param message The message that should be send.
 		 */
 		void SendMessage(boost::shared_ptr<const BfbMessage> message);
 		
+		/** \brief Send the already serialised raw data of a message. The buffer is not copied. Therefore, the same buffer can be passed to multiple connections (e.g. for a broadcast).
+		 * \param rawData The raw data of the message that should be sent. It must not be modified afterwards.
+		 */
+		void SendRawData(boost::shared_ptr<const std::vector<unsigned char>> rawData);
+		
 		/** \brief Get the TCP-ID of the instance
 		 * \return The TCP-ID is an unique number used for routing of messages on the serial side of the communication
 		 */
 		unsigned char GetTcpId();
 		
+		/** \brief Get the connection ID of the instance
+		 * \return The connection ID is the handle the server uses for this connection. It is only identical to the TCP-ID for connections that are not multiplexed.
+		 */
+		unsigned short GetConnectionId();
+		
 		/** \brief Test whether the connection is still active/the socket was closed.*/
 		bool GetActivationState();
 
@@ -76,14 +88,15 @@ class TcpConnection
 		bool IsActive=true; /*!< This variable represents the status of the TCP connection. If it is true, messages can be send and received. If it is false, the connection has been closed by the receiver and therefore no communication is possible. */ 
 		
 		std::vector<unsigned char> InputData; /*!< This variable holds the received bytes until a complete message has been received and it can be converted into an appropriate object. It should only be used in the handler methods! If the bytes are modified inbetween, the message will be undecipherable! */
-		std::vector<unsigned char> OutputData; /*!< This variable holds the to-be-send bytes. Again: Do not modify the contents except for within the corresponding handler methods! */
+		boost::shared_ptr<const std::vector<unsigned char>> OutputData; /*!< This variable holds the bytes that are currently being sent. The buffer may be shared with other connections and must therefore never be modified. */
 		
 		boost::shared_ptr<boost::asio::io_service> IoService; /*!< Asynchronous communication handler used by the instance to connect to the socket and to call the handler methods. */
 
 		boost::shared_ptr<boost::asio::ip::tcp::socket> Socket; /*!< The assigned TCP-socket used for communication. */
 		unsigned char TcpId; /*!< The assigned ID of a TCP-client. It is used for message routing. */
+		unsigned short ConnectionId; /*!< The handle of the connection within the server. It is reported when the connection is lost so that the server can reclaim it. */
 		
-		std::queue<boost::shared_ptr<const BfbMessage>> MessagesToBeSent; /*!< Queue in which all messages are teporarily saved before they are sent.*/
+		std::queue<boost::shared_ptr<const std::vector<unsigned char>>> MessagesToBeSent; /*!< Queue in which the raw data of all messages is teporarily saved before it is sent.*/
 		bool IsSendPending; /*!< Status variable signaling whether a message is waiting to be sent completely.*/
 		boost::shared_ptr<boost::mutex> ConnectionMutex; /*!< This mutex is used to make sure only one thread accesses the send methods at the same time. */
 		std::function<void (boost::shared_ptr<const BfbMessage>)> IncomingMessageFunctionCallback; /*!> In this variable, the reference to the signaling function is saved. The corresponding signla will be called every time a message was received. */
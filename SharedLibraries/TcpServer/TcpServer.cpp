@@ -21,9 +21,9 @@
 TcpServer::TcpServer(const unsigned short port):
 		Work(*IoService),
 		Acceptor(*IoService, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port)),
-		TcpConnections(std::map<unsigned char, boost::shared_ptr<TcpConnection>>()){
-	for(unsigned char i=192;i<224;i++){
-		TcpConnections[i]=boost::shared_ptr<TcpConnection>();//Create a lot of Null pointers
+		TcpConnections(std::map<unsigned short, boost::shared_ptr<TcpConnection>>()){
+	for(unsigned short i=TcpServerConstants::firstTcpId;i<=TcpServerConstants::lastTcpId;i++){
+		FreeTcpIds.push_back(i);
 	};
 	StartAcceptConnections();
 	std::function<void()> tempFunction=[this](){
@@ -34,6 +34,10 @@ TcpServer::TcpServer(const unsigned short port):
 			}catch(const TcpConnectionUtilities::LostConnection& error){
 				unsigned char temp=*boost::get_error_info<TcpConnectionUtilities::lostConnectionTcpId>(error);
 				std::cout<<"The network connection to the client with the TCP-ID "<<std::dec<<int(temp)<<" ( "<<std::hex<<int(temp)<<" ) was closed."<<std::endl;
+				const unsigned short* connectionId=boost::get_error_info<TcpConnectionUtilities::lostConnectionConnectionId>(error);
+				if(connectionId){
+					ReleaseConnectionId(*connectionId);
+				};
 			}
 		};
 	};
@@ -45,51 +49,149 @@ TcpServer::~TcpServer(){
 	IoServiceThread->join();
 };
 
-void TcpServer::SetTcpConnectionBroadcastState(unsigned char tcpId, bool enableBroadcast){
+bool TcpServer::AllocateConnectionId(unsigned short& connectionId, unsigned char& tcpId){
+	boost::lock_guard<boost::mutex> lock(RoutingMutex);
+	if(!FreeTcpIds.empty()){
+		connectionId=FreeTcpIds.front();
+		FreeTcpIds.pop_front();
+		tcpId=connectionId;
+	}else if(!FreeExtendedConnectionIds.empty()){
+		connectionId=FreeExtendedConnectionIds.back();
+		FreeExtendedConnectionIds.pop_back();
+		tcpId=TcpServerConstants::multiplexedTcpId;
+	}else if(NextExtendedConnectionId<=TcpServerConstants::lastExtendedConnectionId){
+		connectionId=NextExtendedConnectionId++;
+		tcpId=TcpServerConstants::multiplexedTcpId;
+	}else{
+		return false;
+	};
+	ConnectionIdInUse.set(connectionId);
+	return true;
+}
+
+void TcpServer::ReleaseConnectionId(unsigned short connectionId){
+	boost::lock_guard<boost::mutex> lock(RoutingMutex);
+	if(!ConnectionIdInUse.test(connectionId)){ // The ID was already released (e.g. if both the pending read and write operation failed).
+		return;
+	};
+	auto it=TcpConnections.find(connectionId);
+	if(it!=TcpConnections.end() && it->second!=nullptr && it->second->GetActivationState()){
+		return;
+	};
+	ConnectionIdInUse.reset(connectionId);
+	TcpConnectionBroadcastList.erase(connectionId);
+	// The connection instance itself stays in the map until the ID is reused since asynchronous handlers might still refer to it.
+	if(connectionId<TcpServerConstants::firstExtendedConnectionId){
+		FreeTcpIds.push_back(connectionId);
+	}else{
+		FreeExtendedConnectionIds.push_back(connectionId);
+	};
+}
+
+unsigned long TcpServer::MultiplexedRequestKey(unsigned char replySource, unsigned char protocol, unsigned char replyCommand){
+	return (static_cast<unsigned long>(replySource)<<16) | (static_cast<unsigned long>(protocol)<<8) | replyCommand;
+}
+
+void TcpServer::SetTcpConnectionBroadcastState(unsigned short connectionId, bool enableBroadcast){
+	boost::lock_guard<boost::mutex> lock(RoutingMutex);
 	if(enableBroadcast){
-		TcpConnectionBroadcastList.insert(tcpId);
+		TcpConnectionBroadcastList.insert(connectionId);
 	}else{
-		TcpConnectionBroadcastList.erase(TcpConnectionBroadcastList.find(tcpId));
+		TcpConnectionBroadcastList.erase(connectionId);
 	};
 }
 
-bool TcpServer::GetTcpConnectionBroadcastState(unsigned char tcpId){
-	return (TcpConnectionBroadcastList.count(tcpId)>0);
+bool TcpServer::GetTcpConnectionBroadcastState(unsigned short connectionId){
+	boost::lock_guard<boost::mutex> lock(RoutingMutex);
+	return (TcpConnectionBroadcastList.count(connectionId)>0);
 }
 
 
-void TcpServer::BroadcastMessage(boost::shared_ptr< const BfbMessage > message){
-	unsigned char destination=message->GetDestination();
-	for(auto it=TcpConnectionBroadcastList.begin(); it!=TcpConnectionBroadcastList.end(); ){
-		try{
-			if(destination==*it){ // Broadcast the message only if the client is NOT the correct receiver. Since the message should be already sent to this client, this prevents double messages.
-				TcpConnections[*it]->SendMessage(message);
+void TcpServer::BroadcastMessage(boost::shared_ptr< const BfbMessage > message, boost::shared_ptr<const std::vector<unsigned char>> rawData, boost::shared_ptr<TcpConnection> receiver){
+	std::vector<boost::shared_ptr<TcpConnection>> broadcastReceivers;
+	{
+		boost::lock_guard<boost::mutex> lock(RoutingMutex);
+		if(TcpConnectionBroadcastList.empty()){
+			return;
+		};
+		broadcastReceivers.reserve(TcpConnectionBroadcastList.size());
+		for(auto it=TcpConnectionBroadcastList.begin(); it!=TcpConnectionBroadcastList.end(); it++){
+			auto connection=TcpConnections.find(*it);
+			if(connection!=TcpConnections.end() && connection->second!=nullptr && connection->second!=receiver && connection->second->GetActivationState()){ // Broadcast the message only if the client is NOT the correct receiver. Since the message should be already sent to this client, this prevents double messages.
+				broadcastReceivers.push_back(connection->second);
 			};
-			it++;
-		}catch(std::out_of_range& err){
-			auto tempIt=it;
-			it++;
-			TcpConnectionBroadcastList.erase(tempIt);
 		};
+	}
+	if(broadcastReceivers.empty()){
+		return;
+	};
+	if(rawData==nullptr){
+		rawData=boost::make_shared<const std::vector<unsigned char>>(message->GetRawData());
+	};
+	for(auto it=broadcastReceivers.begin(); it!=broadcastReceivers.end(); it++){
+		(*it)->SendRawData(rawData);
 	};
 };
 
-void TcpServer::ForwardIncomingMessage(boost::shared_ptr< const BfbMessage > message){
+void TcpServer::ForwardIncomingMessage(unsigned short connectionId, boost::shared_ptr< const BfbMessage > message){
 	for(auto it=InputMessagesRouteList.begin(); it!=InputMessagesRouteList.end(); it++){
 		(*it)(message);
 	};
-	if(TcpConnectionBroadcastList.size()>0){
-		BroadcastMessage(message);
+	for(auto it=InputMessagesOfConnectionsRouteList.begin(); it!=InputMessagesOfConnectionsRouteList.end(); it++){
+		(*it)(message, connectionId);
 	};
+	boost::shared_ptr<TcpConnection> sender;
+	{
+		boost::lock_guard<boost::mutex> lock(RoutingMutex);
+		auto it=TcpConnections.find(connectionId);
+		if(it!=TcpConnections.end()){
+			sender=it->second;
+		};
+	}
+	BroadcastMessage(message, boost::shared_ptr<const std::vector<unsigned char>>(), sender); // The sender does not get its own message back.
 }
 
-void TcpServer::ForwardOutgoingMessage(boost::shared_ptr< const BfbMessage > message){
+void TcpServer::ForwardOutgoingMessage(boost::shared_ptr< const BfbMessage > message, boost::shared_ptr<const std::vector<unsigned char>> rawData, boost::shared_ptr<TcpConnection> receiver){
 	for(auto it=OutputMessagesRouteList.begin(); it!=OutputMessagesRouteList.end(); it++){
 		(*it)(message);
 	};
-	if(TcpConnectionBroadcastList.size()>0){
-		BroadcastMessage(message);
+	BroadcastMessage(message, rawData, receiver);
+}
+
+void TcpServer::ForwardIncomingMultiplexedMessage(unsigned short connectionId, boost::shared_ptr< const BfbMessage > message){
+	if(message->GetBusAllocation()){ // Only messages with bus allocation may be answered. Therefore, only those have to be remembered.
+		boost::lock_guard<boost::mutex> lock(RoutingMutex);
+		auto connection=TcpConnections.find(connectionId);
+		if(connection!=TcpConnections.end()){
+			std::deque<PendingReply>& requesters=MultiplexedRequests[MultiplexedRequestKey(message->GetDestination(), message->GetProtocol(), message->GetCommand()+1)];
+			if(requesters.size()>=TcpServerConstants::maxPendingMultiplexedRequests){
+				requesters.pop_front();
+			};
+			PendingReply request;
+			request.Connection=connection->second;
+			request.TimeOfRequest=std::chrono::steady_clock::now();
+			requesters.push_back(request);
+		};
 	};
+	ForwardIncomingMessage(connectionId, message);
+}
+
+boost::shared_ptr<TcpConnection> TcpServer::FindMultiplexedRequester(boost::shared_ptr<const BfbMessage> message){
+	boost::lock_guard<boost::mutex> lock(RoutingMutex);
+	auto it=MultiplexedRequests.find(MultiplexedRequestKey(message->GetSource(), message->GetProtocol(), message->GetCommand()));
+	if(it==MultiplexedRequests.end()){
+		return boost::shared_ptr<TcpConnection>();
+	};
+	const auto now=std::chrono::steady_clock::now();
+	while(!it->second.empty()){ // Replies are expected in the order of the requests. Requests that were not answered in time or whose connection was closed are skipped.
+		PendingReply request=it->second.front();
+		it->second.pop_front();
+		boost::shared_ptr<TcpConnection> connection=request.Connection.lock();
+		if(connection!=nullptr && connection->GetActivationState() && now-request.TimeOfRequest<TcpServerConstants::multiplexedReplyTimeout){
+			return connection;
+		};
+	};
+	return boost::shared_ptr<TcpConnection>();
 }
 
 void TcpServer::RouteIncomingMessagesTo(boost::function<void (boost::shared_ptr<const BfbMessage>)> forwardFunction){
@@ -98,6 +200,10 @@ void TcpServer::RouteIncomingMessagesTo(boost::function<void (boost::shared_ptr<
 	return;
 };
 
+void TcpServer::RouteIncomingMessagesOfConnectionsTo(boost::function<void (boost::shared_ptr<const BfbMessage>, unsigned short)> forwardFunction){
+	InputMessagesOfConnectionsRouteList.push_back(forwardFunction);
+}
+
 void TcpServer::RouteOutgoingMessagesTo(boost::function<void (boost::shared_ptr<const BfbMessage>)> forwardFunction){
 	//OutputMessageSignal.connect(forwardFunction); // Connect the function to the notification signal.
 	OutputMessagesRouteList.push_back(forwardFunction); // Connect the function to the notification signal.
@@ -113,13 +219,71 @@ boost::function<void (boost::shared_ptr<const BfbMessage>)> TcpServer::GetSendMe
 };
 
 void TcpServer::SendMessage(boost::shared_ptr<const BfbMessage> message){
-	auto it=TcpConnections.find(message->GetDestination()); // Search for the TCP-client with the appropriate TCP-ID
-	if(it!=TcpConnections.end() && it->second!=nullptr){ // If a client was found and it is not just a nullptr,...
-		it->second->SendMessage(message); // forward the message to it's send method.
+	boost::shared_ptr<TcpConnection> receiver;
+	if(message->GetDestination()==TcpServerConstants::multiplexedTcpId){ // The receiver shares its TCP-ID. Therefore, it must be looked up from the requests.
+		receiver=FindMultiplexedRequester(message);
+	}else{
+		boost::lock_guard<boost::mutex> lock(RoutingMutex);
+		auto it=TcpConnections.find(message->GetDestination()); // Search for the TCP-client with the appropriate TCP-ID
+		if(it!=TcpConnections.end()){
+			receiver=it->second;
+		};
 	};
-	ForwardOutgoingMessage(message);
+	boost::shared_ptr<const std::vector<unsigned char>> rawData;
+	if(receiver!=nullptr){ // If a client was found and it is not just a nullptr,...
+		rawData=boost::make_shared<const std::vector<unsigned char>>(message->GetRawData()); // The message is serialised only once. The buffer is reused if the message is broadcasted.
+		receiver->SendRawData(rawData); // forward the message to it's send method.
+	};
+	ForwardOutgoingMessage(message, rawData, receiver);
 };
 
+void TcpServer::SendMessageToConnection(unsigned short connectionId, boost::shared_ptr<const BfbMessage> message){
+	boost::shared_ptr<TcpConnection> receiver;
+	{
+		boost::lock_guard<boost::mutex> lock(RoutingMutex);
+		auto it=TcpConnections.find(connectionId);
+		if(it==TcpConnections.end() || it->second==nullptr || !it->second->GetActivationState()){
+			return;
+		};
+		receiver=it->second;
+		// If the connection is waiting for a reply of this kind, the message answers its oldest request. Otherwise, a later reply would be routed to this connection.
+		if(connectionId>=TcpServerConstants::firstExtendedConnectionId){
+			auto requesters=MultiplexedRequests.find(MultiplexedRequestKey(message->GetSource(), message->GetProtocol(), message->GetCommand()));
+			if(requesters!=MultiplexedRequests.end()){
+				for(auto request=requesters->second.begin(); request!=requesters->second.end(); request++){
+					if(request->Connection.lock()==receiver){
+						requesters->second.erase(request);
+						break;
+					};
+				};
+			};
+		};
+	}
+	auto rawData=boost::make_shared<const std::vector<unsigned char>>(message->GetRawData());
+	receiver->SendRawData(rawData);
+	ForwardOutgoingMessage(message, rawData, receiver);
+}
+
+void TcpServer::SendMessageToAll(boost::shared_ptr<const BfbMessage> message){
+	std::vector<boost::shared_ptr<TcpConnection>> receivers;
+	{
+		boost::lock_guard<boost::mutex> lock(RoutingMutex);
+		receivers.reserve(TcpConnections.size());
+		for(auto it=TcpConnections.begin(); it!=TcpConnections.end(); it++){
+			if(it->second!=nullptr && it->second->GetActivationState()){
+				receivers.push_back(it->second);
+			};
+		};
+	}
+	if(receivers.empty()){
+		return;
+	};
+	auto rawData=boost::make_shared<const std::vector<unsigned char>>(message->GetRawData());
+	for(auto it=receivers.begin(); it!=receivers.end(); it++){
+		(*it)->SendRawData(rawData);
+	};
+}
+
 void TcpServer::StartAcceptConnections(){
 		boost::shared_ptr<boost::asio::ip::tcp::socket> newSocket=boost::make_shared<boost::asio::ip::tcp::socket>(*IoService);
 		Acceptor.async_accept( *newSocket,
@@ -129,27 +293,38 @@ void TcpServer::StartAcceptConnections(){
 				boost::asio::placeholders::error));
 }
 
-void TcpServer::NotifyOfNewConnection(std::function<void(unsigned char)> notificationFunction){
+void TcpServer::NotifyOfNewConnection(std::function<void(unsigned short)> notificationFunction){
 	NewConnectionNotificationFunctions.push_back(notificationFunction);
 };
 
+boost::thread::native_handle_type TcpServer::GetIoThreadHandle(){
+	return IoServiceThread->native_handle();
+};
+
 void TcpServer::HandleAcceptedConnection(boost::shared_ptr<boost::asio::ip::tcp::socket> newSocket,
 	const boost::system::error_code& error){
 	if (error){
 		StartAcceptConnections();
 		return;
 	}
-	std::map<unsigned char,boost::shared_ptr<TcpConnection>>::iterator it;
-	for(it=TcpConnections.begin(); it!=TcpConnections.end(); ++it){ // Search for an unused TCP-ID. If one of the listed clients is inactive, it's TCP-ID will be reused.
-		if(it->second==nullptr || !it->second->GetActivationState()){break;};
-	}
-	if(it!=TcpConnections.end()){ //If an unused TCP-ID was found
-		std::cout<<"Established a new network connection. It will use the  TCP-ID "<<std::dec<< int(it->first)<<" ( "<<std::showbase<<std::hex<< int(it->first) <<" )."<<std::endl;
-		std::function<void(boost::shared_ptr<const BfbMessage> message)> tempFunction= boost::bind(&TcpServer::ForwardIncomingMessage, this,_1);
-		boost::shared_ptr<TcpConnection> newConnection=boost::make_shared<TcpConnection>(IoService, newSocket, it->first, tempFunction);
-		TcpConnections.at(it->first)=newConnection;
+	unsigned short connectionId;
+	unsigned char tcpId;
+	if(AllocateConnectionId(connectionId, tcpId)){ //If an unused connection ID was found
+		std::function<void(boost::shared_ptr<const BfbMessage> message)> tempFunction;
+		if(tcpId==TcpServerConstants::multiplexedTcpId){
+			std::cout<<"Established a new network connection. It will share the TCP-ID "<<std::dec<< int(tcpId)<<" ( "<<std::showbase<<std::hex<< int(tcpId) <<" ) using the connection ID "<<std::dec<<connectionId<<"."<<std::endl;
+			tempFunction=boost::bind(&TcpServer::ForwardIncomingMultiplexedMessage, this, connectionId, _1);
+		}else{
+			std::cout<<"Established a new network connection. It will use the  TCP-ID "<<std::dec<< int(tcpId)<<" ( "<<std::showbase<<std::hex<< int(tcpId) <<" )."<<std::endl;
+			tempFunction=boost::bind(&TcpServer::ForwardIncomingMessage, this, connectionId, _1);
+		};
+		boost::shared_ptr<TcpConnection> newConnection=boost::make_shared<TcpConnection>(IoService, newSocket, tcpId, connectionId, tempFunction);
+		{
+			boost::lock_guard<boost::mutex> lock(RoutingMutex);
+			TcpConnections[connectionId]=newConnection;
+		}
 		for(auto func=NewConnectionNotificationFunctions.begin(); func!=NewConnectionNotificationFunctions.end(); func++){
-			(*func)(it->first);
+			(*func)(connectionId);
 		};
 	}else{
 		newSocket->close();
@@ -2,8 +2,13 @@
 #define TCPSERVER_HPP
 
 // STL includes
+#include <bitset>
+#include <chrono>
+#include <deque>
 #include <set>
 #include <stdlib.h>
+#include <unordered_map>
+#include <vector>
 
 // Boost includes
 #include <boost/asio.hpp>
@@ -18,6 +23,16 @@
 
 class TcpConnection;
 
+namespace TcpServerConstants{
+	const unsigned char firstTcpId=192; /*!< The first of the TCP-IDs that are assigned exclusively to one connection. */
+	const unsigned char lastTcpId=223; /*!< The last of the TCP-IDs that are assigned exclusively to one connection. */
+	const unsigned char multiplexedTcpId=224; /*!< If all exclusive TCP-IDs are in use, further connections share this TCP-ID. Replies are routed back to them based on the requests they have sent. */
+	const unsigned long firstExtendedConnectionId=256; /*!< Connection IDs starting at this value are used for connections that share the multiplexed TCP-ID. */
+	const unsigned long lastExtendedConnectionId=0xFFFF;
+	const unsigned int maxPendingMultiplexedRequests=64; /*!< The maximum number of unanswered requests that are remembered per request type for multiplexed connections. */
+	const std::chrono::milliseconds multiplexedReplyTimeout(1000); /*!< Unanswered requests of multiplexed connections older than this are considered to be lost. */
+};
+
 class TcpServer
 {
 	public:
@@ -30,19 +45,33 @@ class TcpServer
 		/** \brief Use this method in order to send a message to the appropriate  TCP-client. */ 
 		void SendMessage(boost::shared_ptr<const BfbMessage> Message); // non-blocking
 		
+		/** \brief Send the message to every active connection regardless of its destination. It is used for notifications of the server itself. The message is serialised only once. */
+		void SendMessageToAll(boost::shared_ptr<const BfbMessage> message);
+		
 		/** \brief When specified using this method, incoming messages (from the tcp-clients) will be routed to the passed function. The function must accept a shared_ptr to a BioFlexBus message. */
 		void RouteIncomingMessagesTo(boost::function<void (boost::shared_ptr<const BfbMessage>)> forwardFunction);
 		
+		/** \brief Like RouteIncomingMessagesTo, but the function additionally gets the connection ID of the sender. Unlike the TCP-ID in the source of the message, it identifies connections that share the multiplexed TCP-ID as well. */
+		void RouteIncomingMessagesOfConnectionsTo(boost::function<void (boost::shared_ptr<const BfbMessage>, unsigned short)> forwardFunction);
+		
+		/** \brief Send the message to the connection with the passed connection ID regardless of its destination. This reaches connections that share the multiplexed TCP-ID without a preceding request (e.g. for notifications). */
+		void SendMessageToConnection(unsigned short connectionId, boost::shared_ptr<const BfbMessage> message);
+		
 		/** \brief When specified using this method, outgoing messages (to the tcp-clients) will be routed to the passed function. The function must accept a shared_ptr to a BioFlexBus message. */
 		void RouteOutgoingMessagesTo(boost::function<void (boost::shared_ptr<const BfbMessage>)> forwardFunction);
 		
 		/** \brief This method returns a handle to the SendMessage-method of the instance. This makes it redundant to work with boost::bind in order to create a handle manually. */
 		boost::function<void (boost::shared_ptr<const BfbMessage>)> GetSendMessageHandle();
 		
-		void SetTcpConnectionBroadcastState(unsigned char tcpId, bool enableBroadcast);
-		bool GetTcpConnectionBroadcastState(unsigned char tcpId);
+		/** \brief Enable/disable the broadcast for the connection with the passed connection ID. */
+		void SetTcpConnectionBroadcastState(unsigned short connectionId, bool enableBroadcast);
+		bool GetTcpConnectionBroadcastState(unsigned short connectionId);
+		
+		/** \brief The passed function is called with the connection ID of every new connection, including the connections that share the multiplexed TCP-ID. */
+		void NotifyOfNewConnection(std::function<void(unsigned short)> notificationFunction);
 		
-		void NotifyOfNewConnection(std::function<void(unsigned char)> notificationFunction);
+		/** \brief The native handle of the thread that serves all TCP connections. It can be used to change the scheduling of the thread. */
+		boost::thread::native_handle_type GetIoThreadHandle();
 	private:
 		TcpServer(const TcpServer&) = delete;
 		TcpServer & operator=(const TcpServer&) = delete;
@@ -51,10 +80,41 @@ class TcpServer
 		boost::asio::io_service::work Work; /*!< The worker keeps the IoService object busy. Without it, the IOService sometimes runs out of work before the asynchronous receive operations are started and stops itself.*/
 		boost::shared_ptr<boost::thread> IoServiceThread=boost::shared_ptr<boost::thread>(); /*!< Thread in which the IoService object runs. */
 		boost::asio::ip::tcp::acceptor Acceptor; /*!< The Acceptor is responsible for the handling of connection attempts. */
-		std::map<unsigned char, boost::shared_ptr<TcpConnection>> TcpConnections; /*!< This map holds pointers to the Connection instances of which each is managing one connection to a TCP client. The key is always the TCP ID (a number used for routing of messages) of the connection. */
+		std::map<unsigned short, boost::shared_ptr<TcpConnection>> TcpConnections; /*!< This map holds pointers to the Connection instances of which each is managing one connection to a TCP client. The key is the connection ID which equals the TCP ID (a number used for routing of messages) for all connections that are not multiplexed. */
+		boost::mutex RoutingMutex; /*!< This mutex protects the connection map, the ID pools and the table of pending multiplexed requests. */
 		
-		std::set<unsigned char> TcpConnectionBroadcastList;
-		void BroadcastMessage(boost::shared_ptr<const BfbMessage> message);
+		std::deque<unsigned short> FreeTcpIds; /*!< Pool of the unused exclusive TCP-IDs. IDs are taken from the front and returned to the back so that a recently closed ID is reused as late as possible. */
+		std::vector<unsigned short> FreeExtendedConnectionIds; /*!< Pool of the extended connection IDs that have been used before and are free again. */
+		unsigned long NextExtendedConnectionId=TcpServerConstants::firstExtendedConnectionId; /*!< The next extended connection ID that has never been used. */
+		std::bitset<TcpServerConstants::lastExtendedConnectionId+1> ConnectionIdInUse; /*!< Marks the connection IDs that are currently assigned. This prevents an ID from being returned twice to the pools. */
+		
+		/** \brief Take a free connection ID from the pools. Exclusive TCP-IDs are preferred.
+		 * \return false if all connection IDs are in use.
+		 */
+		bool AllocateConnectionId(unsigned short& connectionId, unsigned char& tcpId);
+		/** \brief Return the ID of a closed connection to the pools. */
+		void ReleaseConnectionId(unsigned short connectionId);
+		
+		/** \brief An unanswered request of a multiplexed connection. */
+		struct PendingReply{
+			boost::weak_ptr<TcpConnection> Connection;
+			std::chrono::steady_clock::time_point TimeOfRequest;
+		};
+		/** The requests of the multiplexed connections. The key combines the source, protocol and command ID of the expected reply (see MultiplexedRequestKey). The requesters are stored in the order of their requests. */
+		std::unordered_map<unsigned long, std::deque<PendingReply>> MultiplexedRequests;
+		static unsigned long MultiplexedRequestKey(unsigned char replySource, unsigned char protocol, unsigned char replyCommand);
+		
+		/** \brief Incoming messages of multiplexed connections are passed to this method. It remembers the requester before the message is forwarded. */
+		void ForwardIncomingMultiplexedMessage(unsigned short connectionId, boost::shared_ptr<const BfbMessage> message);
+		/** \brief Find the multiplexed connection that is waiting for the passed reply. */
+		boost::shared_ptr<TcpConnection> FindMultiplexedRequester(boost::shared_ptr<const BfbMessage> message);
+		
+		std::set<unsigned short> TcpConnectionBroadcastList;
+		/** \brief Send a message to all connections with an active broadcast state except for the passed receiver. For outgoing messages, this is the regular receiver (which already got it). For incoming messages, it is the sender. 
+		 * The message is serialised only once and the resulting buffer is shared by all connections.
+		 * \param rawData The raw data of the message if it has already been serialised. If it is a nullptr, the message will be serialised if there is at least one receiver.
+		 */
+		void BroadcastMessage(boost::shared_ptr<const BfbMessage> message, boost::shared_ptr<const std::vector<unsigned char>> rawData, boost::shared_ptr<TcpConnection> receiver);
 		
 		/** \brief Start to accept connection attempts from external programs via network.*/
 		void StartAcceptConnections(); 
@@ -67,16 +127,17 @@ class TcpServer
 		 * In order to add a receiver, the "RouteIncomingMessagesTo" function may be used.
 		 */
 		std::list<boost::function<void (boost::shared_ptr<const BfbMessage>)>> InputMessagesRouteList={};
+		std::list<boost::function<void (boost::shared_ptr<const BfbMessage>, unsigned short)>> InputMessagesOfConnectionsRouteList={}; /*!< The receivers that also get the connection ID of the sender (see RouteIncomingMessagesOfConnectionsTo). */
 		
-		void ForwardIncomingMessage(boost::shared_ptr<const BfbMessage> message);
+		void ForwardIncomingMessage(unsigned short connectionId, boost::shared_ptr<const BfbMessage> message);
 		
 		/** This signal is used to connect receivers (for example a printing function or another interface) to the tcp-clients. 
 		 * Every time a message is made ready for transmission, it will use this signal to inform all receivers.
 		 * In order to add a receiver, the "RouteIncomingMessagesTo" function may be used.
 		 */
 		std::list<boost::function<void (boost::shared_ptr<const BfbMessage>)>> OutputMessagesRouteList={};
-		void ForwardOutgoingMessage(boost::shared_ptr< const BfbMessage > message);
+		void ForwardOutgoingMessage(boost::shared_ptr< const BfbMessage > message, boost::shared_ptr<const std::vector<unsigned char>> rawData, boost::shared_ptr<TcpConnection> receiver);
 		
-		std::list<std::function<void(unsigned char)>> NewConnectionNotificationFunctions={};
+		std::list<std::function<void(unsigned short)>> NewConnectionNotificationFunctions={};
 };
 #endif 